@@ -7,3 +7,17 @@
 5 advanced/io_and_pipes.py
 5 advanced/pipe_job_cntl.py
 10 advanced/exclusive_access_test.py
+5 advanced/job_table_stress_test.py
+5 advanced/resource_usage_test.py
+5 advanced/hash_test.py
+5 advanced/long_line_test.py
+5 advanced/noninteractive_test.py
+5 advanced/plugin_cache_test.py
+5 advanced/async_prompt_test.py
+5 advanced/parallel_test.py
+5 advanced/jobserver_test.py
+5 advanced/cgroup_test.py
+5 advanced/pin_test.py
+5 advanced/heredoc_test.py
+5 advanced/subst_test.py
+5 advanced/fanout_test.py
@@ -0,0 +1,83 @@
+#!/usr/bin/python
+#
+# Tests prompt fragments made on a thread of their own: a fragment that
+# misses its deadline is shown as a placeholder, or as it was last made,
+# and the prompt is redrawn, keeping typed input, once it is ready.
+#
+import sys, imp, atexit
+sys.path.append("/home/courses/cs3214/software/pexpect-dpty/");
+import pexpect, shellio, signal, time, os, re, proc_check, tempfile, shutil, subprocess
+
+#pulling in the regular expression and other definitions
+definitions_scriptname = sys.argv[1]
+def_module = imp.load_source('', definitions_scriptname)
+logfile = None
+if hasattr(def_module, 'logfile'):
+    logfile = def_module.logfile
+
+# a plugin whose fragment takes 300 ms to make, with a deadline of 50 ms
+plugin = r'''
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "esh.h"
+
+static int count;
+
+static char *
+slow_prompt(void)
+{
+    char *p = malloc(32);
+    usleep(300000);
+    snprintf(p, 32, "slow %d> ", ++count);
+    return p;
+}
+
+struct esh_plugin esh_module = {
+    .rank = 5,
+    .make_prompt = slow_prompt,
+    .prompt_deadline = 50,
+    .prompt_placeholder = "wait> "
+};
+'''
+
+plugindir = tempfile.mkdtemp()
+os.environ["XDG_CACHE_HOME"] = plugindir
+
+#Ensure the shell process is terminated
+def cleanup():
+	if c is not None:
+		c.close(force=True)
+	shutil.rmtree(plugindir, ignore_errors=True)
+
+c = None
+atexit.register(cleanup)
+
+source = os.path.join(plugindir, "slow.c")
+with open(source, "w") as f:
+	f.write(plugin)
+subprocess.check_call(["gcc", "-shared", "-fPIC", "-I.", "-o",
+		       os.path.join(plugindir, "slow.so"), source])
+os.remove(source)
+
+c = pexpect.spawn(def_module.shell, ["-p", plugindir], drainpty=True,
+		  logfile=logfile)
+c.timeout = 2
+
+# the placeholder is shown first, then the fragment once it is made
+assert c.expect_exact("wait> ") == 0, "placeholder was not shown"
+assert c.expect_exact("slow 1> ") == 0, "prompt was not redrawn"
+
+# the next prompt shows the last fragment at once; what is typed before
+# the fresh one arrives is kept
+c.sendline("true")
+assert c.expect_exact("slow 1> ") == 0, "last fragment was not shown"
+c.send("echo kept")
+assert c.expect_exact("slow 2> ") == 0, "prompt was not redrawn"
+c.sendline("")
+assert c.expect_exact("\rkept\r\n") == 0, "typed input was lost"
+assert c.expect_exact("slow 3> ") == 0, "prompt was not redrawn"
+
+c.sendeof()
+assert c.expect(pexpect.EOF) == 0, "esh did not exit"
+shellio.success()
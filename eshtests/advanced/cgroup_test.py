@@ -0,0 +1,75 @@
+#!/usr/bin/python
+#
+# Tests per-job cgroups: with -g, 'jobs' shows what a job's cgroup
+# uses, and 'kill' removes the whole job through cgroup.kill, even a
+# process that left the job's process group.  Where cgroups are not
+# delegated to the shell, jobs must run as without -g.
+#
+import sys, imp, atexit
+sys.path.append("/home/courses/cs3214/software/pexpect-dpty/");
+import pexpect, shellio, signal, time, os, re, proc_check, tempfile, shutil
+
+#Ensure the shell process is terminated
+def force_shell_termination(shell_process):
+	c.close(force=True)
+	shutil.rmtree(tmpdir, ignore_errors=True)
+
+#pulling in the regular expression and other definitions
+definitions_scriptname = sys.argv[1]
+def_module = imp.load_source('', definitions_scriptname)
+logfile = None
+if hasattr(def_module, 'logfile'):
+    logfile = def_module.logfile
+
+# a job whose second process leaves the job's process group
+tmpdir = tempfile.mkdtemp()
+script = os.path.join(tmpdir, "escape.sh")
+f = open(script, "w")
+f.write("#!/bin/sh\nsetsid sleep 47 &\nsleep 47\n")
+f.close()
+os.chmod(script, 0o755)
+
+#spawn an instance of the shell
+c = pexpect.spawn(def_module.shell + " -g", drainpty=True, logfile=logfile)
+atexit.register(force_shell_termination, shell_process=c)
+
+c.timeout = 5
+
+delegated = c.expect(["not delegated", def_module.prompt]) == 1
+if not delegated:
+	assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+c.sendline(script + " &")
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+time.sleep(0.5)
+
+c.sendline("jobs")
+assert c.expect("\[1\] Running") == 0, "job is not running"
+if delegated:
+	assert c.expect("cgroup: cpu \d+\.\d+s") == 0, "jobs did not show cgroup usage"
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+if not delegated:
+	c.sendline("limit 1 mem=10M")
+	assert c.expect_exact("has no cgroup") == 0, "limit did not notice missing cgroup"
+	assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+c.sendline("kill 1")
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+time.sleep(0.5)
+
+# with a cgroup, the process that escaped the process group is gone too
+escaped = os.popen("pgrep -f '^sleep 47'").read().split()
+if delegated:
+	assert escaped == [], "kill left a process of the job behind"
+for pid in escaped:
+	os.kill(int(pid), signal.SIGKILL)
+
+c.sendline("jobs")
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+assert "Running" not in c.before, "killed job is still listed"
+
+c.sendline("exit")
+assert c.expect_exact("exit") == 0, "Shell output extraneous characters"
+
+shellio.success()
@@ -0,0 +1,84 @@
+#!/usr/bin/python
+#
+# Tests fan-out redirection: 'cmd >& f1 f2 |> cmd2' sends the output of
+# cmd to both files and to cmd2, all of it even if it is larger than a
+# pipe holds; the relay that copies it belongs to cmd's job, so that ^Z
+# stops and kill ends it with the job, and it exits once every command
+# it writes to has.
+#
+import sys, imp, atexit
+sys.path.append("/home/courses/cs3214/software/pexpect-dpty/");
+import pexpect, shellio, signal, time, os, re, proc_check, tempfile
+
+#pulling in the regular expression and other definitions
+definitions_scriptname = sys.argv[1]
+def_module = imp.load_source('', definitions_scriptname)
+logfile = None
+if hasattr(def_module, 'logfile'):
+    logfile = def_module.logfile
+
+tmpdir = tempfile.mkdtemp()
+f1 = os.path.join(tmpdir, "f1")
+f2 = os.path.join(tmpdir, "f2")
+
+#Ensure the shell process is terminated
+def cleanup():
+	c.close(force=True)
+	for f in [f1, f2]:
+		if os.path.exists(f):
+			os.unlink(f)
+	os.rmdir(tmpdir)
+
+#spawn an instance of the shell
+c = pexpect.spawn(def_module.shell, drainpty=True, logfile=logfile)
+atexit.register(cleanup)
+
+c.timeout = 5
+
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+c.sendline("seq 3 >& %s %s |> wc -l" % (f1, f2))
+assert c.expect_exact("3") == 0, "command did not receive the output"
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+assert open(f1).read() == "1\n2\n3\n", "first file did not receive the output"
+assert open(f2).read() == "1\n2\n3\n", "second file did not receive the output"
+
+# 8 MB, more than any pipe holds
+c.sendline("head -c 8000000 /dev/zero >& %s |> wc -c |> tr '\\0' x |> wc -c" % f1)
+assert c.expect_exact("8000000\r\n8000000") == 0, "large output was not copied in full"
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+assert os.path.getsize(f1) == 8000000, "large output was not written in full"
+
+# the relay exits once both readers have, and so does yes
+c.sendline("yes >& |> head -1 |> head -2")
+assert c.expect_exact("y\r\ny\r\ny") == 0, "commands did not receive the output"
+assert c.expect(def_module.prompt) == 0, "relay did not exit with its readers"
+
+c.sendline("ls >& %s | wc" % f1)
+assert c.expect_exact("Ambiguous output redirect.") == 0, "unused pipe was accepted"
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+# the relay is part of the foreground job: ^Z stops it with the job
+c.sendline("sleep 48 >& %s |> cat" % f1)
+time.sleep(0.5)
+c.sendcontrol('z')
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+pids = os.popen("pgrep -f '^esh-relay '").read().split()
+assert len(pids) == 1, "relay is not running"
+assert proc_check.check_pid_status(pids[0], 'T'), "relay was not stopped"
+
+c.sendline("jobs")
+assert c.expect("\[1\] Stopped") == 0, "job was not stopped"
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+assert "[2]" not in c.before, "relay became a job of its own"
+
+c.sendline("kill 1")
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+time.sleep(0.5)
+assert os.popen("pgrep -f '^esh-relay '").read() == "", "kill left the relay"
+
+c.sendline("exit")
+assert c.expect_exact("exit") == 0, "Shell output extraneous characters"
+
+shellio.success()
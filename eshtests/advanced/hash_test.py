@@ -0,0 +1,86 @@
+#!/usr/bin/python
+#
+# Tests the cache of resolved command names: 'hash' lists cached
+# commands, unknown commands are rejected, and the cache notices when
+# an executable is added to or removed from a directory on PATH.
+#
+import sys, imp, atexit
+sys.path.append("/home/courses/cs3214/software/pexpect-dpty/");
+import pexpect, shellio, signal, time, os, re, proc_check, tempfile, shutil
+
+#Ensure the shell process is terminated
+def force_shell_termination(shell_process):
+	c.close(force=True)
+	shutil.rmtree(bindir, ignore_errors=True)
+
+#pulling in the regular expression and other definitions
+definitions_scriptname = sys.argv[1]
+def_module = imp.load_source('', definitions_scriptname)
+logfile = None
+if hasattr(def_module, 'logfile'):
+    logfile = def_module.logfile
+
+# a private directory at the front of PATH
+bindir = tempfile.mkdtemp()
+env = dict(os.environ)
+env['PATH'] = bindir + ":" + env.get('PATH', '/bin:/usr/bin')
+script = os.path.join(bindir, "esh-hash-probe")
+
+def make_script(message):
+	f = open(script, "w")
+	f.write("#!/bin/sh\necho " + message + "\n")
+	f.close()
+	os.chmod(script, 0o755)
+
+#spawn an instance of the shell
+c = pexpect.spawn(def_module.shell, drainpty=True, logfile=logfile, env=env)
+atexit.register(force_shell_termination, shell_process=c)
+
+c.timeout = 2
+
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+c.sendline("hash")
+assert c.expect_exact("hash table empty") == 0, "hash table is not empty"
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+# the probe does not exist yet
+c.sendline("esh-hash-probe")
+assert c.expect_exact("command not found") == 0, "unknown command was not rejected"
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+# once it is created, the shell must find it
+make_script("first")
+c.sendline("esh-hash-probe")
+assert c.expect_exact("first\r\n") == 0, "new command was not found"
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+c.sendline("esh-hash-probe")
+assert c.expect_exact("first\r\n") == 0, "cached command did not run"
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+c.sendline("hash")
+assert c.expect("\s+2\s+" + re.escape(script) + "\r\n") == 0, \
+	"hash did not list the command with its hits"
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+# removing it invalidates the cache
+os.unlink(script)
+c.sendline("esh-hash-probe")
+assert c.expect_exact("command not found") == 0, "removed command was still run"
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+# hash -r empties the cache
+c.sendline("hash ls")
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+c.sendline("hash -r")
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+c.sendline("hash")
+assert c.expect_exact("hash table empty") == 0, "hash -r did not empty the table"
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+c.sendline("hash esh-no-such-command")
+assert c.expect_exact("not found") == 0, "hash did not report unknown command"
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+shellio.success()
@@ -0,0 +1,71 @@
+#!/usr/bin/python
+#
+# Tests here-strings and here-documents: 'cmd <<< word' feeds word and
+# a newline to cmd, 'cmd <<END' the lines up to END, which are read
+# after a "> " prompt; a here-document of several megabytes in a script
+# reaches its command in full, or not at all if the command exits early,
+# without hanging the shell.
+#
+import sys, imp, atexit
+sys.path.append("/home/courses/cs3214/software/pexpect-dpty/");
+import pexpect, shellio, signal, time, os, re, proc_check, tempfile
+
+#pulling in the regular expression and other definitions
+definitions_scriptname = sys.argv[1]
+def_module = imp.load_source('', definitions_scriptname)
+logfile = None
+if hasattr(def_module, 'logfile'):
+    logfile = def_module.logfile
+
+script = tempfile.mktemp(suffix=".esh")
+
+#Ensure the shell process is terminated
+def cleanup():
+	c.close(force=True)
+	if os.path.exists(script):
+		os.unlink(script)
+
+#spawn an instance of the shell
+c = pexpect.spawn(def_module.shell, drainpty=True, logfile=logfile)
+atexit.register(cleanup)
+
+c.timeout = 5
+
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+c.sendline("tr a-z A-Z <<< here-string")
+assert c.expect_exact("HERE-STRING") == 0, "here-string was not fed to the command"
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+c.sendline("tr a-z A-Z <<END | cat")
+assert c.expect_exact("> ") == 0, "no prompt for the here-document"
+c.sendline("first line")
+assert c.expect_exact("> ") == 0, "no prompt for the here-document"
+c.sendline("second line")
+c.sendline("END")
+assert c.expect_exact("FIRST LINE\r\nSECOND LINE\r\n") == 0, \
+	"here-document was not fed to the command"
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+c.sendline("cat <x <<< y")
+assert c.expect_exact("Ambiguous input redirect.") == 0, "two inputs were accepted"
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+c.sendline("exit")
+assert c.expect_exact("exit") == 0, "Shell output extraneous characters"
+
+# 4 MB, more than any pipe holds
+line = "x" * 99 + "\n"
+f = open(script, "w")
+f.write("wc -c <<EOF\n" + line * 40000 + "EOF\n")
+f.write("head -c 5 <<EOF\n" + line * 40000 + "EOF\n")
+f.write("echo done\n")
+f.close()
+
+c = pexpect.spawn(def_module.shell, [script], drainpty=True, logfile=logfile)
+c.timeout = 10
+assert c.expect_exact("4000000") == 0, "large here-document was not fed in full"
+assert c.expect_exact("xxxxxdone") == 0, "early exit of the reader hung the shell"
+assert c.expect(pexpect.EOF) == 0, "esh did not exit"
+
+shellio.success()
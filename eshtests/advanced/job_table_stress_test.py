@@ -0,0 +1,80 @@
+#!/usr/bin/python
+#
+# Stress test for the job table: starts 10000 concurrent background
+# jobs, then checks that jobs can still be found, killed and listed.
+#
+import sys, imp, atexit
+sys.path.append("/home/courses/cs3214/software/pexpect-dpty/");
+import pexpect, shellio, signal, time, os, re, proc_check
+
+# number of concurrent background jobs
+NJOBS = 10000
+
+pgrps = []
+
+#Ensure the shell process and all jobs it started are terminated
+def force_shell_termination(shell_process):
+	for pgrp in pgrps:
+		try:
+			os.killpg(pgrp, signal.SIGKILL)
+		except OSError:
+			pass
+	c.close(force=True)
+
+#pulling in the regular expression and other definitions
+definitions_scriptname = sys.argv[1]
+def_module = imp.load_source('', definitions_scriptname)
+logfile = None
+if hasattr(def_module, 'logfile'):
+    logfile = def_module.logfile
+
+#spawn an instance of the shell
+c = pexpect.spawn(def_module.shell, drainpty=True, logfile=logfile)
+atexit.register(force_shell_termination, shell_process=c)
+
+# starting thousands of processes takes a while
+c.timeout = 60
+
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+# start all jobs from a single command line
+c.sendline("sleep 600 & " * NJOBS)
+
+for i in range(NJOBS):
+	assert c.expect(def_module.bgjob_regex) == 0, "Job %d was not started" % (i + 1)
+	jobid, pgrp = c.match.groups()
+	assert int(jobid) == i + 1, "Unexpected job id"
+	pgrps.append(int(pgrp))
+
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+# kill a job in the middle of the table and make sure its process is gone
+victim = NJOBS // 2
+c.sendline(def_module.builtin_commands['kill'] % victim)
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+time.sleep(1)
+try:
+	os.killpg(pgrps[victim - 1], 0)
+	assert False, "Killed job is still running"
+except OSError:
+	pass
+
+# all other jobs must still be listed, in order
+c.sendline(def_module.builtin_commands['jobs'])
+expected = [j for j in range(1, NJOBS + 1) if j != victim]
+for jobid in expected:
+	assert c.expect(def_module.job_status_regex) == 0, "jobs did not list job %d" % jobid
+	assert int(c.match.group(1)) == jobid, "jobs listed unexpected job"
+	assert c.match.group(2) == def_module.jobs_status_msg['running'], \
+		"job %d is not running" % jobid
+
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+# the next job gets the next job id
+c.sendline("sleep 600 &")
+assert c.expect(def_module.bgjob_regex) == 0, "Job was not started"
+jobid, pgrp = c.match.groups()
+pgrps.append(int(pgrp))
+assert int(jobid) == NJOBS + 1, "Unexpected job id for new job"
+
+shellio.success()
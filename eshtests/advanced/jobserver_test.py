@@ -0,0 +1,75 @@
+#!/usr/bin/python
+#
+# Tests the jobserver: commands find its pipe in MAKEFLAGS, background
+# jobs of the shell take its tokens and are queued when there are none,
+# a queued job starts once a token is put back, and the pool cannot be
+# removed while jobs hold tokens.
+#
+import sys, imp, atexit
+sys.path.append("/home/courses/cs3214/software/pexpect-dpty/");
+import pexpect, shellio, signal, time, os, re, proc_check
+
+#Ensure the shell process is terminated
+def force_shell_termination(shell_process):
+	c.close(force=True)
+
+#pulling in the regular expression and other definitions
+definitions_scriptname = sys.argv[1]
+def_module = imp.load_source('', definitions_scriptname)
+logfile = None
+if hasattr(def_module, 'logfile'):
+    logfile = def_module.logfile
+
+#spawn an instance of the shell
+c = pexpect.spawn(def_module.shell, drainpty=True, logfile=logfile)
+atexit.register(force_shell_termination, shell_process=c)
+
+c.timeout = 5
+
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+c.sendline("jobserver")
+assert c.expect_exact("jobserver: off") == 0, "jobserver was on from the start"
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+c.sendline("jobserver 2")
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+# commands inherit the pipe through MAKEFLAGS
+c.sendline("printenv MAKEFLAGS")
+assert c.expect("-j2 --jobserver-auth=(\d+),(\d+)\r\n") == 0, \
+	"MAKEFLAGS does not name the jobserver"
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+# two tokens: the third background job waits for one
+c.sendline("sleep 1 &")
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+c.sendline("sleep 1 &")
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+c.sendline("sleep 1 &")
+assert c.expect_exact("[3] Queued") == 0, "job beyond the pool was not queued"
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+c.sendline("jobserver 0")
+assert c.expect_exact("jobs hold tokens") == 0, "pool was removed while in use"
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+# the queued job starts once a token comes back through the pipe
+time.sleep(1.5)
+c.sendline("jobs")
+assert c.expect("\[3\] Running\s+\(sleep 1\)") == 0, "queued job was not started"
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+c.sendline("fg 3")
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+c.sendline("jobserver 0")
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+c.sendline("jobserver")
+assert c.expect_exact("jobserver: off") == 0, "jobserver was not removed"
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+c.sendline("exit")
+assert c.expect_exact("exit") == 0, "Shell output extraneous characters"
+
+shellio.success()
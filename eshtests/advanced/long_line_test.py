@@ -0,0 +1,52 @@
+#!/usr/bin/python
+#
+# Tests that command lines of several kilobytes with thousands of
+# words are parsed and run correctly.
+#
+import sys, imp, atexit
+sys.path.append("/home/courses/cs3214/software/pexpect-dpty/");
+import pexpect, shellio, signal, time, os, re, proc_check, tempfile
+
+#Ensure the shell process is terminated
+def force_shell_termination(shell_process):
+	c.close(force=True)
+	if os.path.exists(outfile):
+		os.unlink(outfile)
+
+#pulling in the regular expression and other definitions
+definitions_scriptname = sys.argv[1]
+def_module = imp.load_source('', definitions_scriptname)
+logfile = None
+if hasattr(def_module, 'logfile'):
+    logfile = def_module.logfile
+
+outfile = tempfile.mktemp()
+
+#spawn an instance of the shell
+c = pexpect.spawn(def_module.shell, drainpty=True, logfile=logfile)
+atexit.register(force_shell_termination, shell_process=c)
+
+c.timeout = 5
+
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+# 3000 words, about 20 KB, through a two-stage pipeline into a file.
+# readline reads the terminal in non-canonical mode, so the tty's line
+# length limit does not apply.
+NWORDS = 3000
+words = ["w%d" % i for i in range(NWORDS)]
+c.sendline("echo " + " ".join(words) + " | wc -w > " + outfile)
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+count = -1
+for i in range(20):
+	if os.path.exists(outfile):
+		content = open(outfile).read().strip()
+		if content:
+			count = int(content)
+			break
+	time.sleep(.1)
+
+assert count == NWORDS, "Long command line lost words: %d" % count
+
+shellio.success()
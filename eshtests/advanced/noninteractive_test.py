@@ -0,0 +1,65 @@
+#!/usr/bin/python
+#
+# Tests non-interactive use: 'esh -c cmdline' and 'esh script' run
+# their commands without a prompt and exit with the status of the last
+# foreground pipeline.
+#
+import sys, imp, atexit
+sys.path.append("/home/courses/cs3214/software/pexpect-dpty/");
+import pexpect, shellio, signal, time, os, re, proc_check, tempfile
+
+#pulling in the regular expression and other definitions
+definitions_scriptname = sys.argv[1]
+def_module = imp.load_source('', definitions_scriptname)
+logfile = None
+if hasattr(def_module, 'logfile'):
+    logfile = def_module.logfile
+
+script = tempfile.mktemp(suffix=".esh")
+
+#Ensure the shell process is terminated
+def cleanup():
+	if c is not None:
+		c.close(force=True)
+	if os.path.exists(script):
+		os.unlink(script)
+
+# run esh with 'args', return its output and exit status
+def run_esh(args):
+	global c
+	c = pexpect.spawn(def_module.shell, args, drainpty=True, logfile=logfile)
+	c.timeout = 5
+	assert c.expect(pexpect.EOF) == 0, "esh did not exit"
+	output = c.before
+	c.close()
+	return output, c.exitstatus
+
+c = None
+atexit.register(cleanup)
+
+output, status = run_esh(["-c", "echo first | cat; echo second"])
+assert "first\r\nsecond\r\n" in output, "-c did not run every pipeline"
+assert def_module.prompt not in output, "-c printed a prompt"
+assert status == 0, "unexpected exit status %s" % status
+
+output, status = run_esh(["-c", "true; false"])
+assert status == 1, "exit status is not that of the last pipeline"
+
+output, status = run_esh(["-c", "esh-no-such-command"])
+assert status == 127, "unknown command did not exit with 127"
+
+f = open(script, "w")
+f.write("#!" + def_module.shell + "\n")
+f.write("echo one\n")
+f.write("   # a comment\n")
+f.write("sleep 1 &\n")
+f.write("echo two | cat\n")
+f.write("false")
+f.close()
+
+output, status = run_esh([script])
+assert "one\r\ntwo\r\n" in output, "script did not run every line"
+assert def_module.prompt not in output, "script printed a prompt"
+assert status == 1, "script exit status is not that of its last line"
+
+shellio.success()
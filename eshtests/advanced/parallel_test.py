@@ -0,0 +1,125 @@
+#!/usr/bin/python
+#
+# Tests job slots: with 'jobs-max', background jobs beyond the limit are
+# queued, shown as Queued by 'jobs', and started as running jobs exit;
+# 'parallel -j N' runs at most N jobs at once, waits for all of them,
+# and ^C interrupts running jobs and drops queued ones.
+#
+import sys, imp, atexit
+sys.path.append("/home/courses/cs3214/software/pexpect-dpty/");
+import pexpect, shellio, signal, time, os, re, proc_check
+
+#Ensure the shell process is terminated
+def force_shell_termination(shell_process):
+	c.close(force=True)
+
+#pulling in the regular expression and other definitions
+definitions_scriptname = sys.argv[1]
+def_module = imp.load_source('', definitions_scriptname)
+logfile = None
+if hasattr(def_module, 'logfile'):
+    logfile = def_module.logfile
+
+#spawn an instance of the shell
+c = pexpect.spawn(def_module.shell, drainpty=True, logfile=logfile)
+atexit.register(force_shell_termination, shell_process=c)
+
+c.timeout = 5
+
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+# with one slot, the second background job is queued
+c.sendline("jobs-max 1")
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+c.sendline("sleep 1 &")
+assert c.expect_exact("[1]") == 0, "first job was not started"
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+c.sendline("sleep 1 &")
+assert c.expect_exact("[2] Queued") == 0, "second job was not queued"
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+c.sendline("jobs")
+assert c.expect("\[1\] Running\s+\(sleep 1\)") == 0, "first job is not running"
+assert c.expect("\[2\] Queued\s+\(sleep 1\)") == 0, "jobs did not show the queued job"
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+# the queued job is started once the first one exits
+time.sleep(1.5)
+c.sendline("jobs")
+assert c.expect("\[2\] Running\s+\(sleep 1\)") == 0, "queued job was not started"
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+c.sendline("jobs-max 0")
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+c.sendline("fg 2")
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+# four jobs of half a second, two at a time, take about a second
+start = time.time()
+c.sendline("parallel -j 2 sleep ::: 0.5 0.5 0.5 0.5")
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+elapsed = time.time() - start
+assert 0.9 < elapsed < 1.8, "parallel -j 2 took %.2fs" % elapsed
+
+c.sendline("jobs")
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+assert "sleep" not in c.before, "parallel left jobs behind"
+
+# parallel in the background holds no slot, so its own jobs still get one
+c.sendline("jobs-max 1")
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+c.sendline("parallel echo ::: first second &")
+assert c.expect_exact("first") == 0, "jobs of parallel ... & did not run"
+assert c.expect_exact("second") == 0, "jobs of parallel ... & did not run"
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+# nor a jobserver token
+c.sendline("jobs-max 0")
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+c.sendline("jobserver 1")
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+c.sendline("parallel echo ::: third fourth &")
+assert c.expect_exact("third") == 0, "jobs of parallel ... & did not get a token"
+assert c.expect_exact("fourth") == 0, "jobs of parallel ... & did not get a token"
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+c.sendline("jobserver 0")
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+# ^C stops the running jobs and drops the queued ones
+start = time.time()
+c.sendline("parallel -j 1 sleep ::: 10 10 10")
+time.sleep(0.5)
+c.sendintr()
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+assert time.time() - start < 3, "^C did not interrupt parallel"
+
+c.sendline("jobs")
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+assert "sleep" not in c.before, "^C left jobs of the group behind"
+
+# a job of the group that was stopped ends parallel, and the rest of the
+# pipeline gets a jid of its own, not that of the stopped job
+c.sendline("parallel -j 1 sleep ::: 49 49 | sleep 30")
+time.sleep(0.5)
+os.system("pkill -STOP -f '^sleep 49'")
+time.sleep(0.5)
+c.sendcontrol('z')
+assert c.expect_exact("[3] Stopped") == 0, "pipeline took the jid of a job of parallel"
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+c.sendline("kill 1")
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+c.sendline("kill 3")
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+time.sleep(0.5)
+assert os.popen("pgrep -f '^sleep 30'").read() == "", "kill 3 left the pipeline"
+c.sendline("kill 2")
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+time.sleep(0.5)
+assert os.popen("pgrep -f '^sleep 49'").read() == "", "kill left jobs of parallel"
+
+c.sendline("exit")
+assert c.expect_exact("exit") == 0, "Shell output extraneous characters"
+
+shellio.success()
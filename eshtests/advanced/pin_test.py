@@ -0,0 +1,66 @@
+#!/usr/bin/python
+#
+# Tests CPU placement: 'pin' shows the policy and the cache domains,
+# 'pin auto' turns automatic placement on, and 'pin JID cpulist' pins a
+# running job, whose commands then may only run on those CPUs.
+#
+import sys, imp, atexit
+sys.path.append("/home/courses/cs3214/software/pexpect-dpty/");
+import pexpect, shellio, signal, time, os, re, proc_check
+
+#Ensure the shell process is terminated
+def force_shell_termination(shell_process):
+	c.close(force=True)
+
+#pulling in the regular expression and other definitions
+definitions_scriptname = sys.argv[1]
+def_module = imp.load_source('', definitions_scriptname)
+logfile = None
+if hasattr(def_module, 'logfile'):
+    logfile = def_module.logfile
+
+#spawn an instance of the shell
+c = pexpect.spawn(def_module.shell, drainpty=True, logfile=logfile)
+atexit.register(force_shell_termination, shell_process=c)
+
+c.timeout = 5
+
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+c.sendline("pin")
+assert c.expect_exact("pin: off") == 0, "placement is not off at first"
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+c.sendline("pin auto")
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+c.sendline("pin")
+assert c.expect_exact("pin: auto") == 0, "pin auto did not turn placement on"
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+c.sendline("pin off")
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+# pin a running job to the first CPU the shell may use
+cpu = min(os.sched_getaffinity(c.pid))
+c.sendline("sleep 47 &")
+(jid, pid) = shellio.parse_regular_expression(c, def_module.bgjob_regex)
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+c.sendline("pin %s %d" % (jid, cpu))
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+assert os.sched_getaffinity(int(pid)) == set([cpu]), "job was not pinned"
+
+c.sendline("pin")
+assert c.expect_exact("[%s] %d" % (jid, cpu)) == 0, "pin did not show the pinned job"
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+c.sendline("pin %s bogus" % jid)
+assert c.expect_exact("invalid cpulist") == 0, "bad cpulist was accepted"
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+c.sendline("kill %s" % jid)
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+c.sendline("exit")
+assert c.expect_exact("exit") == 0, "Shell output extraneous characters"
+
+shellio.success()
@@ -0,0 +1,64 @@
+#!/usr/bin/python
+#
+# Tests the plugin manifest cache: the first run with a plugin directory
+# loads every plugin and writes a manifest; later runs load a plugin only
+# when it is needed, until a plugin changes.
+#
+import sys, imp, atexit
+sys.path.append("/home/courses/cs3214/software/pexpect-dpty/");
+import pexpect, shellio, signal, time, os, re, proc_check, tempfile, shutil
+
+#pulling in the regular expression and other definitions
+definitions_scriptname = sys.argv[1]
+def_module = imp.load_source('', definitions_scriptname)
+logfile = None
+if hasattr(def_module, 'logfile'):
+    logfile = def_module.logfile
+
+plugindir = "plugins"
+cache = tempfile.mkdtemp()
+os.environ["XDG_CACHE_HOME"] = cache
+
+#Ensure the shell process is terminated
+def cleanup():
+	if c is not None:
+		c.close(force=True)
+	shutil.rmtree(cache, ignore_errors=True)
+
+# run esh with 'args', return its output
+def run_esh(args):
+	global c
+	c = pexpect.spawn(def_module.shell, ["-p", plugindir] + args,
+			  drainpty=True, logfile=logfile)
+	c.timeout = 5
+	assert c.expect(pexpect.EOF) == 0, "esh did not exit"
+	output = c.before
+	c.close()
+	return output
+
+c = None
+atexit.register(cleanup)
+
+# no manifest yet: every plugin is loaded at startup
+output = run_esh(["-c", "cd /; pwd"])
+assert "Loading" in output, "plugins were not loaded"
+assert "/\r\n" in output, "cd did not work"
+assert os.listdir(os.path.join(cache, "esh")), "no manifest was written"
+
+# with the manifest, the cd plugin is loaded only once 'cd' is run
+output = run_esh(["-c", "true"])
+assert "Loading" not in output, "plugins were loaded at startup"
+assert "Plugin 'cd' initialized" not in output, "cd plugin was loaded"
+
+output = run_esh(["-c", "cd /; pwd"])
+assert "Plugin 'cd' initialized" in output, "cd plugin was not loaded"
+assert "/\r\n" in output, "cd did not work"
+
+# a changed plugin invalidates the manifest
+so = os.path.join(plugindir, "cd.so")
+st = os.stat(so)
+os.utime(so, (st.st_atime, st.st_mtime + 1))
+output = run_esh(["-c", "true"])
+assert "Loading" in output, "stale manifest was used"
+
+shellio.success()
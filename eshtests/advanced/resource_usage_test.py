@@ -0,0 +1,64 @@
+#!/usr/bin/python
+#
+# Tests per-job resource accounting: 'jobs -l' lists every command of a
+# job with its pid, and 'times' reports the commands of the last job.
+#
+import sys, imp, atexit
+sys.path.append("/home/courses/cs3214/software/pexpect-dpty/");
+import pexpect, shellio, signal, time, os, re, proc_check
+
+#Ensure the shell process is terminated
+def force_shell_termination(shell_process):
+	c.close(force=True)
+
+#pulling in the regular expression and other definitions
+definitions_scriptname = sys.argv[1]
+def_module = imp.load_source('', definitions_scriptname)
+logfile = None
+if hasattr(def_module, 'logfile'):
+    logfile = def_module.logfile
+
+#spawn an instance of the shell
+c = pexpect.spawn(def_module.shell, drainpty=True, logfile=logfile)
+atexit.register(force_shell_termination, shell_process=c)
+
+c.timeout = 4
+
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+# start a two-stage background job whose second stage finishes first
+c.sendline("sleep 30 | sleep 1 &")
+(jobid, pid) = shellio.parse_regular_expression(c, def_module.bgjob_regex)
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+time.sleep(1.5)
+
+# the running stage is listed with its pid, the finished one with its status
+c.sendline("jobs -l")
+assert c.expect(def_module.job_status_regex) == 0, "jobs -l did not list the job"
+assert c.expect("\s+" + pid + "\s+running\s+[\d.]+.*?sleep\r\n") == 0, \
+	"jobs -l did not list the running command"
+assert c.expect("\s+-\s+exit 0\s+[\d.]+\s+[\d.]+\s+[\d.]+\s+\d+K.*?sleep\r\n") == 0, \
+	"jobs -l did not list the finished command"
+assert c.expect("\s+total\s+") == 0, "jobs -l did not print totals"
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+c.sendline(def_module.builtin_commands['kill'] % jobid)
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+# give the shell time to reap the killed job
+time.sleep(.5)
+
+# run a foreground job, then ask for its resource usage
+c.sendline("echo hello | cat")
+assert c.expect_exact("hello\r\n") == 0, "pipeline did not run"
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+c.sendline("times")
+assert c.expect("\d+m\d+\.\d+s \d+m\d+\.\d+s\r\n") == 0, "times did not report shell time"
+assert c.expect("\d+m\d+\.\d+s \d+m\d+\.\d+s\r\n") == 0, "times did not report child time"
+assert c.expect("exit 0.*?echo\r\n") == 0, "times did not report first stage"
+assert c.expect("exit 0.*?cat\r\n") == 0, "times did not report second stage"
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+shellio.success()
@@ -0,0 +1,75 @@
+#!/usr/bin/python
+#
+# Tests process substitution: <(cmd) and >(cmd) are replaced by /dev/fd
+# paths to pipes from and to cmd, whose processes belong to the job of
+# the command they are an argument of, so that ^Z stops, fg continues
+# and kill ends all of them together.
+#
+import sys, imp, atexit
+sys.path.append("/home/courses/cs3214/software/pexpect-dpty/");
+import pexpect, shellio, signal, time, os, re, proc_check
+
+#Ensure the shell process is terminated
+def force_shell_termination(shell_process):
+	c.close(force=True)
+
+#pulling in the regular expression and other definitions
+definitions_scriptname = sys.argv[1]
+def_module = imp.load_source('', definitions_scriptname)
+logfile = None
+if hasattr(def_module, 'logfile'):
+    logfile = def_module.logfile
+
+#spawn an instance of the shell
+c = pexpect.spawn(def_module.shell, drainpty=True, logfile=logfile)
+atexit.register(force_shell_termination, shell_process=c)
+
+c.timeout = 5
+
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+c.sendline("diff <(echo same) <(echo same) | wc -l")
+assert c.expect_exact("0") == 0, "<(...) did not substitute both outputs"
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+c.sendline("cat <(echo one) <(echo two | tr a-z A-Z)")
+assert c.expect_exact("one\r\nTWO\r\n") == 0, "<(...) outputs are out of order"
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+c.sendline("echo hello | tee >(tr a-z A-Z) > /dev/null")
+assert c.expect_exact("HELLO") == 0, ">(...) did not receive the output"
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+c.sendline("cat <(ls >x)")
+assert c.expect_exact("Ambiguous output redirect.") == 0, "unused pipe was accepted"
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+# the substitution is part of the foreground job: ^Z stops both
+c.sendline("cat <(sleep 47)")
+time.sleep(0.5)
+c.sendcontrol('z')
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+
+pids = os.popen("pgrep -f '^sleep 47'").read().split()
+assert len(pids) == 1, "substituted command is not running"
+assert proc_check.check_pid_status(pids[0], 'T'), "substituted command was not stopped"
+
+c.sendline("jobs")
+assert c.expect("\[1\] Stopped") == 0, "job was not stopped"
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+assert "[2]" not in c.before, "substitution became a job of its own"
+
+c.sendline("bg 1")
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+time.sleep(0.5)
+assert proc_check.check_pid_status(pids[0], 'S'), "substituted command was not continued"
+
+c.sendline("kill 1")
+assert c.expect(def_module.prompt) == 0, "Shell did not print expected prompt"
+time.sleep(0.5)
+assert os.popen("pgrep -f '^sleep 47'").read() == "", "kill left the substituted command"
+
+c.sendline("exit")
+assert c.expect_exact("exit") == 0, "Shell output extraneous characters"
+
+shellio.success()
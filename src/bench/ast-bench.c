@@ -0,0 +1,95 @@
+/*
+ * AST build and free benchmark.
+ *
+ * Builds command lines the way the parser does, with pipelines of
+ * commands whose argv and words live in the command line's arena, and
+ * frees them with esh_command_line_free().  Also measures copying
+ * pipelines out of the arena with esh_pipeline_copy(), as is done for
+ * every job, and freeing the copies.
+ *
+ * Usage: ast-bench [-j] [-t seconds]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../esh.h"
+#include "bench.h"
+
+#define obstack_chunk_alloc malloc
+#define obstack_chunk_free free
+
+static const char *words[] = { "grep", "-v", "--color=never", "pattern", "file.txt" };
+#define NWORDS (sizeof words / sizeof words[0])
+
+/* Build a command line of 'npipes' pipelines of 'ncmds' commands */
+static struct esh_command_line *
+build(int npipes, int ncmds)
+{
+    struct esh_command_line *cline = esh_command_line_create_empty();
+    struct obstack *arena = &cline->arena;
+    int p, c;
+    unsigned int w;
+
+    for (p = 0; p < npipes; p++) {
+        struct esh_pipeline *pipe = NULL;
+        for (c = 0; c < ncmds; c++) {
+            char **argv = obstack_alloc(arena, (NWORDS + 1) * sizeof *argv);
+            for (w = 0; w < NWORDS; w++)
+                argv[w] = obstack_copy0(arena, words[w], strlen(words[w]));
+            argv[NWORDS] = NULL;
+
+            struct esh_command *cmd = esh_command_create(arena, argv,
+                                                         NULL, NULL, false);
+            if (pipe == NULL) {
+                pipe = esh_pipeline_create(arena, cmd);
+            } else {
+                cmd->pipeline = pipe;
+                list_push_back(&pipe->commands, &cmd->elem);
+            }
+        }
+        esh_pipeline_finish(pipe);
+        list_push_back(&cline->pipes, &pipe->elem);
+    }
+    return cline;
+}
+
+int
+main(int ac, char *av[])
+{
+    static const int shapes[][2] = { { 1, 1 }, { 1, 10 }, { 10, 10 }, { 100, 10 } };
+    unsigned int s;
+    char name[64];
+
+    bench_init(ac, av, "ast");
+    for (s = 0; s < sizeof shapes / sizeof shapes[0]; s++) {
+        int npipes = shapes[s][0], ncmds = shapes[s][1];
+        long rounds = 0;
+        double start = bench_now(), elapsed;
+
+        do {
+            esh_command_line_free(build(npipes, ncmds));
+            rounds++;
+        } while ((elapsed = bench_now() - start) < bench_budget());
+
+        snprintf(name, sizeof name, "build+free/pipes=%d/cmds=%d", npipes, ncmds);
+        bench_report(name, elapsed * 1e9 / (rounds * npipes * ncmds), "ns/cmd");
+
+        /* copy every pipeline of one command line, as for jobs */
+        struct esh_command_line *cline = build(npipes, ncmds);
+        rounds = 0;
+        start = bench_now();
+        do {
+            struct list_elem *e = list_begin(&cline->pipes);
+            for (; e != list_end(&cline->pipes); e = list_next(e))
+                esh_pipeline_free(esh_pipeline_copy(
+                            list_entry(e, struct esh_pipeline, elem)));
+            rounds++;
+        } while ((elapsed = bench_now() - start) < bench_budget());
+        esh_command_line_free(cline);
+
+        snprintf(name, sizeof name, "copy+free/pipes=%d/cmds=%d", npipes, ncmds);
+        bench_report(name, elapsed * 1e9 / (rounds * npipes * ncmds), "ns/cmd");
+    }
+    return bench_finish();
+}
@@ -0,0 +1,100 @@
+/*
+ * Minimal benchmark harness; see bench.h.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+struct result {
+    char name[64];
+    double value;
+    const char *unit;
+};
+
+static const char *suite_name;
+static bool json;
+static double budget = 1.0;
+static struct result *results;
+static int nresults, maxresults;
+
+int
+bench_init(int ac, char *av[], const char *suite)
+{
+    int opt;
+
+    suite_name = suite;
+    while ((opt = getopt(ac, av, "jt:")) > 0) {
+        switch (opt) {
+        case 'j':
+            json = true;
+            break;
+        case 't':
+            budget = atof(optarg);
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-j] [-t seconds] ...\n", av[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (!json)
+        printf("%-40s %14s  %s\n", suite, "value", "unit");
+    return optind;
+}
+
+double
+bench_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+double
+bench_budget(void)
+{
+    return budget;
+}
+
+void
+bench_report(const char *name, double value, const char *unit)
+{
+    if (!json) {
+        printf("%-40s %14.2f  %s\n", name, value, unit);
+        fflush(stdout);
+        return;
+    }
+
+    if (nresults == maxresults) {
+        maxresults = maxresults ? 2 * maxresults : 16;
+        results = realloc(results, maxresults * sizeof *results);
+        if (results == NULL) {
+            perror("realloc");
+            exit(EXIT_FAILURE);
+        }
+    }
+    snprintf(results[nresults].name, sizeof results[nresults].name, "%s", name);
+    results[nresults].value = value;
+    results[nresults].unit = unit;
+    nresults++;
+}
+
+int
+bench_finish(void)
+{
+    int i;
+
+    if (!json)
+        return 0;
+
+    printf("{\"suite\": \"%s\", \"results\": [", suite_name);
+    for (i = 0; i < nresults; i++)
+        printf("%s{\"name\": \"%s\", \"value\": %.6g, \"unit\": \"%s\"}",
+               i ? ", " : "", results[i].name, results[i].value, results[i].unit);
+    printf("]}\n");
+    return 0;
+}
@@ -0,0 +1,33 @@
+/*
+ * Minimal benchmark harness shared by the programs in bench/.
+ *
+ * Each program measures a few things and reports each measurement with
+ * bench_report().  By default results are printed as a table; with -j
+ * the program instead prints a single line of JSON,
+ *
+ *   {"suite": "...", "results": [{"name": "...", "value": ..., "unit": "..."}, ...]}
+ *
+ * which 'make bench' collects so that results can be compared between
+ * releases.  -t sets the time, in seconds, that a program should spend
+ * on each measurement.
+ */
+#ifndef ESH_BENCH_H
+#define ESH_BENCH_H
+
+/* Parse the harness options -j and -t.  Returns the index of the first
+ * remaining argument in av. */
+int bench_init(int ac, char *av[], const char *suite);
+
+/* Monotonic time in seconds */
+double bench_now(void);
+
+/* Seconds to spend on each measurement */
+double bench_budget(void);
+
+/* Record a measurement */
+void bench_report(const char *name, double value, const char *unit);
+
+/* Print the results if needed; returns the program's exit status */
+int bench_finish(void);
+
+#endif /* ESH_BENCH_H */
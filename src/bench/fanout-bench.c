@@ -0,0 +1,95 @@
+/*
+ * Fan-out benchmark.
+ *
+ * Measures the throughput of sending SIZE megabytes of zeros to two
+ * files and to 'wc -c', once with a fan-out redirection, whose relay
+ * copies with tee(2) and splice(2) (see esh-relay.c), and once with
+ * tee(1), which copies through user space:
+ *
+ *   head -c SIZE /dev/zero >& f1 f2 |> wc -c
+ *   head -c SIZE /dev/zero | tee f1 f2 | wc -c
+ *
+ * The files are in a temporary directory under /tmp.  Must be run from
+ * the directory that holds esh.
+ *
+ * Usage: fanout-bench [-j] [-t seconds] [megabytes]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "bench.h"
+
+extern char **environ;
+
+/* Run 'esh -c line' once */
+static void
+run_esh(char *line)
+{
+    char *argv[] = { "./esh", "-c", line, NULL };
+    posix_spawn_file_actions_t fa;
+    pid_t pid;
+    int status;
+
+    posix_spawn_file_actions_init(&fa);
+    posix_spawn_file_actions_addopen(&fa, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+    if (posix_spawn(&pid, argv[0], &fa, NULL, argv, environ) != 0) {
+        perror("posix_spawn ./esh");
+        exit(EXIT_FAILURE);
+    }
+    posix_spawn_file_actions_destroy(&fa);
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status)
+            || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "esh failed: %s\n", line);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* Time runs of 'line', which copies 'mb' megabytes; returns MB/s */
+static double
+measure(char *line, int mb)
+{
+    long runs = 0;
+    double start = bench_now(), elapsed;
+
+    do {
+        run_esh(line);
+        runs++;
+    } while ((elapsed = bench_now() - start) < bench_budget());
+    return runs * mb / elapsed;
+}
+
+int
+main(int ac, char *av[])
+{
+    int arg = bench_init(ac, av, "fanout");
+    int mb = arg < ac ? atoi(av[arg]) : 256;
+    char dir[] = "/tmp/esh-fanout-XXXXXX";
+    char line[4096], name[64], f1[64], f2[64];
+
+    if (mkdtemp(dir) == NULL) {
+        perror("mkdtemp");
+        return EXIT_FAILURE;
+    }
+    snprintf(f1, sizeof f1, "%s/f1", dir);
+    snprintf(f2, sizeof f2, "%s/f2", dir);
+
+    snprintf(line, sizeof line,
+             "head -c %dM /dev/zero >& %s %s |> wc -c", mb, f1, f2);
+    snprintf(name, sizeof name, "relay/mb=%d", mb);
+    bench_report(name, measure(line, mb), "MB/s");
+
+    snprintf(line, sizeof line,
+             "head -c %dM /dev/zero | tee %s %s | wc -c", mb, f1, f2);
+    snprintf(name, sizeof name, "tee/mb=%d", mb);
+    bench_report(name, measure(line, mb), "MB/s");
+
+    unlink(f1);
+    unlink(f2);
+    rmdir(dir);
+    return bench_finish();
+}
@@ -0,0 +1,97 @@
+/*
+ * Launch-latency benchmark.
+ *
+ * Compares esh_launch_command() (posix_spawn) against the fork()/
+ * setpgid()/execvp() sequence esh used to run, for a shell whose
+ * resident set has been grown to various sizes.  Each iteration starts
+ * /bin/true in a new process group and waits for it to exit.
+ *
+ * Usage: launch-bench [-j] [-t seconds]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "../esh.h"
+#include "bench.h"
+
+static char *true_argv[] = { "/bin/true", NULL };
+
+/* The launch sequence used by esh before it switched to posix_spawn */
+static pid_t
+fork_launch(void)
+{
+    pid_t pid = fork();
+    if (pid == 0) {
+        setpgid(0, 0);
+        execvp(true_argv[0], true_argv);
+        _exit(127);
+    }
+    if (pid > 0)
+        setpgid(pid, pid);
+    return pid;
+}
+
+static pid_t
+spawn_launch(void)
+{
+    struct esh_command_line *cline = esh_command_line_create_empty();
+    struct esh_command *cmd = esh_command_create(&cline->arena, true_argv,
+                                                 NULL, NULL, false);
+    pid_t pid = esh_launch_command(cmd, -1, -1, -1);
+    close(cmd->pidfd);
+    esh_command_line_free(cline);
+    return pid;
+}
+
+/* Average launch+reap latency of 'launch' in microseconds, over as
+ * many iterations as fit in the time budget */
+static double
+measure(pid_t (*launch)(void))
+{
+    int iterations = 0, status;
+    double start = bench_now(), elapsed;
+
+    do {
+        pid_t pid = launch();
+        if (pid < 0 || waitpid(pid, &status, 0) != pid)
+            esh_sys_fatal_error("launch failed: ");
+        iterations++;
+    } while ((elapsed = bench_now() - start) < bench_budget() || iterations < 10);
+
+    return elapsed * 1e6 / iterations;
+}
+
+int
+main(int ac, char *av[])
+{
+    static const size_t rss_mb[] = { 0, 64, 256, 1024 };
+    unsigned int i;
+
+    bench_init(ac, av, "launch");
+    for (i = 0; i < sizeof rss_mb / sizeof rss_mb[0]; i++) {
+        size_t sz = rss_mb[i] << 20;
+        char *ballast = NULL;
+        char name[64];
+
+        /* grow the resident set; touching every page makes fork copy
+         * page tables for all of it */
+        if (sz > 0) {
+            ballast = malloc(sz);
+            if (ballast == NULL)
+                break;
+            memset(ballast, 1, sz);
+        }
+
+        snprintf(name, sizeof name, "fork-exec/rss=%zuMB", rss_mb[i]);
+        bench_report(name, measure(fork_launch), "us");
+        snprintf(name, sizeof name, "spawn/rss=%zuMB", rss_mb[i]);
+        bench_report(name, measure(spawn_launch), "us");
+        free(ballast);
+    }
+    return bench_finish();
+}
@@ -0,0 +1,129 @@
+/*
+ * list.c benchmark.
+ *
+ * Measures the operations of the intrusive doubly-linked list that esh
+ * uses for jobs, commands and plugins, on lists of 1000 to 1000000
+ * elements: appending, iterating, removing from the middle, list_size()
+ * (which walks the list), sorting and ordered insertion.
+ *
+ * Usage: list-bench [-j] [-t seconds]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../list.h"
+#include "bench.h"
+
+struct item {
+    struct list_elem elem;
+    unsigned int key;
+};
+
+static bool
+item_less(const struct list_elem *a, const struct list_elem *b, void *aux)
+{
+    return list_entry(a, struct item, elem)->key
+         < list_entry(b, struct item, elem)->key;
+}
+
+static void
+report(const char *op, int n, double seconds, long ops)
+{
+    char name[64];
+    snprintf(name, sizeof name, "%s/n=%d", op, n);
+    bench_report(name, seconds * 1e9 / ops, "ns/op");
+}
+
+int
+main(int ac, char *av[])
+{
+    static const int sizes[] = { 1000, 10000, 100000, 1000000 };
+    unsigned int s, seed = 3214;
+
+    bench_init(ac, av, "list");
+    for (s = 0; s < sizeof sizes / sizeof sizes[0]; s++) {
+        int n = sizes[s], i;
+        struct item *items = malloc(n * sizeof *items);
+        struct list list;
+        double start;
+        long rounds;
+
+        for (i = 0; i < n; i++)
+            items[i].key = rand_r(&seed);
+
+        /* push_back, then empty the list again */
+        start = bench_now();
+        rounds = 0;
+        do {
+            list_init(&list);
+            for (i = 0; i < n; i++)
+                list_push_back(&list, &items[i].elem);
+            rounds++;
+        } while (bench_now() - start < bench_budget());
+        report("push_back", n, bench_now() - start, rounds * n);
+
+        /* iterate */
+        volatile unsigned int sum = 0;
+        start = bench_now();
+        rounds = 0;
+        do {
+            struct list_elem *e = list_begin(&list);
+            for (; e != list_end(&list); e = list_next(e))
+                sum += list_entry(e, struct item, elem)->key;
+            rounds++;
+        } while (bench_now() - start < bench_budget());
+        report("iterate", n, bench_now() - start, rounds * n);
+
+        /* list_size walks the whole list */
+        start = bench_now();
+        rounds = 0;
+        do {
+            sum += list_size(&list);
+            rounds++;
+        } while (bench_now() - start < bench_budget());
+        report("size", n, bench_now() - start, rounds);
+
+        /* remove from and reinsert in the middle, in batches so that
+         * reading the clock does not dominate */
+        start = bench_now();
+        rounds = 0;
+        do {
+            for (i = 0; i < 1000; i++) {
+                struct list_elem *e = &items[(n / 2 + i) % n].elem;
+                struct list_elem *next = list_remove(e);
+                list_insert(next, e);
+            }
+            rounds++;
+        } while (bench_now() - start < bench_budget());
+        report("remove+insert", n, bench_now() - start, rounds * 1000);
+
+        /* sort a shuffled list */
+        start = bench_now();
+        rounds = 0;
+        do {
+            list_init(&list);
+            for (i = 0; i < n; i++) {
+                items[i].key = rand_r(&seed);
+                list_push_back(&list, &items[i].elem);
+            }
+            list_sort(&list, item_less, NULL);
+            rounds++;
+        } while (bench_now() - start < bench_budget());
+        report("sort", n, bench_now() - start, rounds * n);
+
+        /* ordered insertion is O(n) per element; keep it small */
+        if (n <= 10000) {
+            start = bench_now();
+            rounds = 0;
+            do {
+                list_init(&list);
+                for (i = 0; i < n; i++)
+                    list_insert_ordered(&list, &items[i].elem, item_less, NULL);
+                rounds++;
+            } while (bench_now() - start < bench_budget());
+            report("insert_ordered", n, bench_now() - start, rounds * n);
+        }
+        free(items);
+    }
+    return bench_finish();
+}
@@ -0,0 +1,163 @@
+/*
+ * Parser throughput benchmark.
+ *
+ * Generates a corpus of machine-generated command lines of 1, 4, 16
+ * and 64 KB, each made of thousands of words joined into pipelines with
+ * redirections and background jobs, and reports how many bytes and
+ * lines per second esh_parse_command_line() gets through.  The corpus
+ * is then parsed again by several threads at once, which also checks
+ * that the parser is reentrant: every thread must see the same number
+ * of commands in every line.
+ *
+ * Usage: parse-bench [-j] [-t seconds] [threads]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "../esh.h"
+#include "bench.h"
+
+#define CORPUS_LINES 64
+
+/* Build a command line of roughly 'size' bytes */
+static char *
+make_line(size_t size, unsigned int *seed)
+{
+    static const char *seps[] = { " | ", " ; ", " & " };
+    char *line = malloc(size + 64);
+    size_t len = 0;
+    int words = 0;
+
+    while (len < size || words == 0) {
+        if (words > 0 && rand_r(seed) % 16 == 0) {
+            const char *sep = seps[rand_r(seed) % 3];
+            /* only the last command of a pipeline may redirect output */
+            if (sep[1] != '|' && rand_r(seed) % 4 == 0)
+                len += sprintf(line + len, " >> out%u", rand_r(seed) % 100);
+            len += sprintf(line + len, "%s", sep);
+            words = 0;
+        } else {
+            len += sprintf(line + len, "%sword%u", words ? " " : "",
+                           rand_r(seed) % 100000);
+            words++;
+        }
+    }
+    line[len] = '\0';
+    return line;
+}
+
+/* Parse 'line' and return the number of commands in it, or -1 */
+static int
+parse_line(char *line)
+{
+    struct esh_command_line *cline = esh_parse_command_line(line);
+    int ncommands = 0;
+
+    if (cline == NULL)
+        return -1;
+
+    struct list_elem *e = list_begin(&cline->pipes);
+    for (; e != list_end(&cline->pipes); e = list_next(e)) {
+        struct esh_pipeline *pipe = list_entry(e, struct esh_pipeline, elem);
+        ncommands += list_size(&pipe->commands);
+    }
+    esh_command_line_free(cline);
+    return ncommands;
+}
+
+struct worker {
+    pthread_t thread;
+    char **corpus;
+    int *expected;
+    int rounds;
+    int errors;
+};
+
+static void *
+worker_main(void *arg)
+{
+    struct worker *w = arg;
+    int r, i;
+
+    for (r = 0; r < w->rounds; r++)
+        for (i = 0; i < CORPUS_LINES; i++)
+            if (parse_line(w->corpus[i]) != w->expected[i])
+                w->errors++;
+    return NULL;
+}
+
+int
+main(int ac, char *av[])
+{
+    static const size_t sizes[] = { 1 << 10, 4 << 10, 16 << 10, 64 << 10 };
+    int arg = bench_init(ac, av, "parse");
+    int nthreads = arg < ac ? atoi(av[arg]) : 4;
+    unsigned int s, seed = 3214;
+    char name[64];
+    for (s = 0; s < sizeof sizes / sizeof sizes[0]; s++) {
+        char *corpus[CORPUS_LINES];
+        int expected[CORPUS_LINES];
+        size_t bytes = 0;
+        long words = 0;
+        int i, t;
+
+        for (i = 0; i < CORPUS_LINES; i++) {
+            corpus[i] = make_line(sizes[s], &seed);
+            bytes += strlen(corpus[i]);
+            for (char *p = corpus[i]; *p; p++)
+                words += *p == ' ';
+            expected[i] = parse_line(corpus[i]);
+            if (expected[i] < 0) {
+                fprintf(stderr, "corpus line %d did not parse\n", i);
+                return EXIT_FAILURE;
+            }
+        }
+
+        /* single thread, for as many rounds as fit in 'seconds' */
+        int rounds = 0;
+        double start = bench_now(), elapsed;
+        do {
+            for (i = 0; i < CORPUS_LINES; i++)
+                parse_line(corpus[i]);
+            rounds++;
+        } while ((elapsed = bench_now() - start) < bench_budget());
+
+        snprintf(name, sizeof name, "lines/size=%zuK", sizes[s] >> 10);
+        bench_report(name, rounds * CORPUS_LINES / elapsed, "lines/s");
+        snprintf(name, sizeof name, "bytes/size=%zuK", sizes[s] >> 10);
+        bench_report(name, rounds * bytes / elapsed / 1e6, "MB/s");
+        snprintf(name, sizeof name, "words/size=%zuK", sizes[s] >> 10);
+        bench_report(name, rounds * (double) words / elapsed / 1e6, "Mwords/s");
+
+        /* the same number of rounds on each of 'nthreads' threads */
+        struct worker workers[nthreads];
+        start = bench_now();
+        for (t = 0; t < nthreads; t++) {
+            workers[t] = (struct worker) {
+                .corpus = corpus, .expected = expected, .rounds = rounds
+            };
+            pthread_create(&workers[t].thread, NULL, worker_main, &workers[t]);
+        }
+        int errors = 0;
+        for (t = 0; t < nthreads; t++) {
+            pthread_join(workers[t].thread, NULL);
+            errors += workers[t].errors;
+        }
+        elapsed = bench_now() - start;
+
+        snprintf(name, sizeof name, "bytes/size=%zuK/threads=%d",
+                 sizes[s] >> 10, nthreads);
+        bench_report(name, nthreads * rounds * bytes / elapsed / 1e6, "MB/s");
+        if (errors > 0) {
+            fprintf(stderr, "%d lines parsed differently on threads\n", errors);
+            return EXIT_FAILURE;
+        }
+
+        for (i = 0; i < CORPUS_LINES; i++)
+            free(corpus[i]);
+    }
+    return bench_finish();
+}
@@ -0,0 +1,130 @@
+/*
+ * Pipeline wiring benchmark.
+ *
+ * Builds pipelines of 'echo hi | cat | ... | cat' with 1, 10, 100, ...
+ * up to 'maxstages' stages, launches them through esh_wiring_* and
+ * esh_launch_command(), and reports the time to launch all stages and
+ * the time until the last stage has exited.  Also checks that no pipe
+ * descriptor is left open in the shell afterwards.
+ *
+ * Usage: pipeline-bench [-j] [maxstages]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "../esh.h"
+#include "bench.h"
+
+/* Number of descriptors open in this process */
+static int
+count_open_fds(void)
+{
+    DIR *dir = opendir("/proc/self/fd");
+    int n = 0;
+
+    if (dir == NULL)
+        return -1;
+    while (readdir(dir) != NULL)
+        n++;
+    closedir(dir);
+    return n;
+}
+
+static char **
+make_argv(struct obstack *arena, char *a0, char *a1)
+{
+    char **argv = obstack_alloc(arena, 3 * sizeof *argv);
+    argv[0] = a0;
+    argv[1] = a1;
+    argv[2] = NULL;
+    return argv;
+}
+
+/* Build the pipeline in a command line's arena */
+static struct esh_command_line *
+make_pipeline(int nstages)
+{
+    struct esh_command_line *cline = esh_command_line_create_empty();
+    struct obstack *arena = &cline->arena;
+    struct esh_pipeline *pipe;
+    int i;
+
+    pipe = esh_pipeline_create(arena,
+            esh_command_create(arena, make_argv(arena, "echo", "hi"),
+                               NULL, NULL, false));
+    for (i = 1; i < nstages; i++) {
+        struct esh_command *cmd;
+        cmd = esh_command_create(arena, make_argv(arena, "cat", NULL),
+                                 NULL, NULL, false);
+        cmd->pipeline = pipe;
+        list_push_back(&pipe->commands, &cmd->elem);
+    }
+
+    /* output of the pipeline goes nowhere */
+    struct esh_command *last = list_entry(list_back(&pipe->commands),
+                                          struct esh_command, elem);
+    last->iored_output = "/dev/null";
+    list_push_back(&cline->pipes, &pipe->elem);
+    return cline;
+}
+
+int
+main(int ac, char *av[])
+{
+    int arg = bench_init(ac, av, "pipeline");
+    int maxstages = arg < ac ? atoi(av[arg]) : 1000;
+    int nstages;
+
+    for (nstages = 1; nstages <= maxstages; nstages *= 10) {
+        struct esh_command_line *cline = make_pipeline(nstages);
+        struct esh_pipeline *pipe = list_entry(list_front(&cline->pipes),
+                                               struct esh_pipeline, elem);
+        struct esh_pipe_wiring wiring;
+        pid_t pgrp = -1;
+        int fds_before = count_open_fds();
+        double start = bench_now();
+
+        esh_wiring_init(&wiring, nstages);
+        struct list_elem *e = list_begin(&pipe->commands);
+        for (; e != list_end(&pipe->commands); e = list_next(e)) {
+            struct esh_command *cmd = list_entry(e, struct esh_command, elem);
+
+            esh_wiring_begin_stage(&wiring);
+            if (esh_launch_command(cmd, pgrp, wiring.infd, wiring.outfd) < 0)
+                exit(EXIT_FAILURE);
+            if (pgrp == -1)
+                pgrp = cmd->pid;
+            esh_wiring_end_stage(&wiring);
+        }
+
+        double launched = bench_now();
+        int status;
+        while (waitpid(-pgrp, &status, 0) > 0)
+            continue;
+        double done = bench_now();
+
+        for (e = list_begin(&pipe->commands); e != list_end(&pipe->commands);
+             e = list_next(e))
+            close(list_entry(e, struct esh_command, elem)->pidfd);
+
+        if (count_open_fds() != fds_before) {
+            fprintf(stderr, "descriptor leak: %d open before, %d after\n",
+                    fds_before, count_open_fds());
+            exit(EXIT_FAILURE);
+        }
+
+        char name[64];
+        snprintf(name, sizeof name, "launch/stages=%d", nstages);
+        bench_report(name, (launched - start) * 1e6, "us");
+        snprintf(name, sizeof name, "total/stages=%d", nstages);
+        bench_report(name, (done - start) * 1e6, "us");
+        esh_command_line_free(cline);
+    }
+    return bench_finish();
+}
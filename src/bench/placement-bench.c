@@ -0,0 +1,143 @@
+/*
+ * CPU placement benchmark.
+ *
+ * Runs 1, 2, 4, ... up to 'maxjobs' pipelines of
+ * 'head -c SIZE /dev/zero | cat | cat' at the same time, once as the
+ * scheduler places them and once with 'pin auto' placement (see
+ * esh-placement.c), and reports the throughput of all of them together.
+ * On a machine with a single cache domain, both place jobs alike.
+ *
+ * Usage: placement-bench [-j] [maxjobs [megabytes]]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "../esh.h"
+#include "bench.h"
+
+#define NSTAGES 3
+
+static char **
+make_argv(struct obstack *arena, char *a0, char *a1, char *a2)
+{
+    char **argv = obstack_alloc(arena, 4 * sizeof *argv);
+    argv[0] = a0;
+    argv[1] = a1;
+    argv[2] = a2;
+    argv[3] = NULL;
+    return argv;
+}
+
+/* Build the pipeline in a command line's arena */
+static struct esh_pipeline *
+make_pipeline(struct esh_command_line *cline, char *size)
+{
+    struct obstack *arena = &cline->arena;
+    struct esh_pipeline *pipe;
+    int i;
+
+    pipe = esh_pipeline_create(arena,
+            esh_command_create(arena, make_argv(arena, "head", "-c", size),
+                               "/dev/zero", NULL, false));
+    for (i = 1; i < NSTAGES; i++) {
+        struct esh_command *cmd;
+        cmd = esh_command_create(arena, make_argv(arena, "cat", NULL, NULL),
+                                 NULL, NULL, false);
+        cmd->pipeline = pipe;
+        list_push_back(&pipe->commands, &cmd->elem);
+    }
+
+    /* output of the pipeline goes nowhere */
+    struct esh_command *last = list_entry(list_back(&pipe->commands),
+                                          struct esh_command, elem);
+    last->iored_output = "/dev/null";
+    list_push_back(&cline->pipes, &pipe->elem);
+    return pipe;
+}
+
+static void
+launch(struct esh_pipeline *pipe)
+{
+    struct esh_pipe_wiring wiring;
+    pid_t pgrp = -1;
+
+    esh_placement_assign(pipe);
+    esh_wiring_init(&wiring, NSTAGES);
+    struct list_elem *e = list_begin(&pipe->commands);
+    for (; e != list_end(&pipe->commands); e = list_next(e)) {
+        struct esh_command *cmd = list_entry(e, struct esh_command, elem);
+
+        esh_wiring_begin_stage(&wiring);
+        if (esh_launch_command(cmd, pgrp, wiring.infd, wiring.outfd) < 0)
+            exit(EXIT_FAILURE);
+        if (pgrp == -1)
+            pgrp = cmd->pid;
+        esh_wiring_end_stage(&wiring);
+    }
+}
+
+/* Run 'njobs' pipelines at once; returns the time until all have ended */
+static double
+run(int njobs, char *size)
+{
+    struct esh_command_line *cline = esh_command_line_create_empty();
+    int i, status;
+
+    for (i = 0; i < njobs; i++)
+        make_pipeline(cline, size);
+
+    double start = bench_now();
+    struct list_elem *e = list_begin(&cline->pipes);
+    for (; e != list_end(&cline->pipes); e = list_next(e))
+        launch(list_entry(e, struct esh_pipeline, elem));
+    while (wait(&status) > 0)
+        continue;
+    double elapsed = bench_now() - start;
+
+    for (e = list_begin(&cline->pipes); e != list_end(&cline->pipes);
+         e = list_next(e)) {
+        struct esh_pipeline *pipe = list_entry(e, struct esh_pipeline, elem);
+        struct list_elem *c = list_begin(&pipe->commands);
+        for (; c != list_end(&pipe->commands); c = list_next(c))
+            close(list_entry(c, struct esh_command, elem)->pidfd);
+        esh_placement_release(pipe);
+    }
+    esh_command_line_free(cline);
+    return elapsed;
+}
+
+int
+main(int ac, char *av[])
+{
+    int arg = bench_init(ac, av, "placement");
+    int maxjobs = arg < ac ? atoi(av[arg]) : 4;
+    long mb = arg + 1 < ac ? atol(av[arg + 1]) : 256;
+    char size[32];
+    int njobs, pinned;
+
+    snprintf(size, sizeof size, "%ldM", mb);
+    for (njobs = 1; njobs <= maxjobs; njobs *= 2) {
+        for (pinned = 0; pinned <= 1; pinned++) {
+            double best = 0;
+            double until = bench_now() + bench_budget();
+
+            /* the best of the runs within the budget, and at least one */
+            esh_placement_set_auto(pinned);
+            do {
+                double t = run(njobs, size);
+                if (best == 0 || t < best)
+                    best = t;
+            } while (bench_now() < until);
+
+            char name[64];
+            snprintf(name, sizeof name, "%s/jobs=%d",
+                     pinned ? "auto" : "off", njobs);
+            bench_report(name, njobs * mb / best, "MB/s");
+        }
+    }
+    return bench_finish();
+}
@@ -0,0 +1,122 @@
+/*
+ * Plugin hook dispatch benchmark.
+ *
+ * Registers 1 to 1000 plugins in esh_plugin_list, half of which
+ * implement process_builtin and command_status_change, and measures
+ * the cost of offering one command to the plugins' process_builtin
+ * hooks, the way esh does for every command it runs, and of notifying
+ * them of one status change.  No plugin claims the command, so every
+ * dispatch visits every plugin, which is the common case.
+ *
+ * Each is measured through the dispatch tables esh_plugin_initialize()
+ * builds and, for comparison, by walking esh_plugin_list ("list/"
+ * results), which is how esh dispatched hooks before it had tables.
+ *
+ * Usage: plugin-bench [-j] [-t seconds]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../esh.h"
+#include "bench.h"
+
+#define BATCH 100
+
+static volatile int calls;
+
+static bool
+never_builtin(struct esh_command *cmd)
+{
+    calls++;
+    return false;
+}
+
+static bool
+status_change(struct esh_command *cmd, int status)
+{
+    calls++;
+    return false;
+}
+
+/* Offer a command to the plugins by walking the plugin list */
+static bool
+list_dispatch_builtin(struct esh_command *cmd)
+{
+    struct list_elem *e = list_begin(&esh_plugin_list);
+    for (; e != list_end(&esh_plugin_list); e = list_next(e)) {
+        struct esh_plugin *plugin = list_entry(e, struct esh_plugin, elem);
+        if (plugin->process_builtin && plugin->process_builtin(cmd))
+            return true;
+    }
+    return false;
+}
+
+/* Notify the plugins of a status change by walking the plugin list */
+static void
+list_dispatch_status_change(struct esh_command *cmd, int status)
+{
+    struct list_elem *e = list_begin(&esh_plugin_list);
+    for (; e != list_end(&esh_plugin_list); e = list_next(e)) {
+        struct esh_plugin *plugin = list_entry(e, struct esh_plugin, elem);
+        if (plugin->command_status_change)
+            plugin->command_status_change(cmd, status);
+    }
+}
+
+/* Report the time per call of 'dispatch' with 'n' plugins loaded */
+#define MEASURE(what, n, dispatch) do {                                 \
+    long rounds = 0;                                                    \
+    double start = bench_now(), elapsed;                                \
+    do {                                                                \
+        for (i = 0; i < BATCH; i++)                                     \
+            dispatch;                                                   \
+        rounds++;                                                       \
+    } while ((elapsed = bench_now() - start) < bench_budget());         \
+    snprintf(name, sizeof name, "%s/plugins=%d", what, n);              \
+    bench_report(name, elapsed * 1e9 / (rounds * BATCH), "ns/dispatch"); \
+} while (0)
+
+int
+main(int ac, char *av[])
+{
+    static const int counts[] = { 1, 10, 100, 1000 };
+    static char *argv[] = { "ls", "-l", NULL };
+    unsigned int c;
+    char name[64];
+
+    bench_init(ac, av, "plugin");
+
+    struct esh_command_line *cline = esh_command_line_create_empty();
+    struct esh_command *cmd = esh_command_create(&cline->arena, argv,
+                                                 NULL, NULL, false);
+
+    for (c = 0; c < sizeof counts / sizeof counts[0]; c++) {
+        int n = counts[c], i;
+        struct esh_plugin *plugins = calloc(n, sizeof *plugins);
+
+        list_init(&esh_plugin_list);
+        for (i = 0; i < n; i++) {
+            plugins[i].rank = i;
+            if (i % 2 == 0) {
+                plugins[i].process_builtin = never_builtin;
+                plugins[i].command_status_change = status_change;
+            }
+            list_push_back(&esh_plugin_list, &plugins[i].elem);
+        }
+
+        esh_plugin_initialize(NULL);
+
+        /* dispatch in batches so that reading the clock does not dominate */
+        MEASURE("process_builtin", n, esh_plugin_process_builtin(cmd));
+        MEASURE("list/process_builtin", n, list_dispatch_builtin(cmd));
+        MEASURE("command_status_change", n,
+                esh_plugin_command_status_change(cmd, 0));
+        MEASURE("list/command_status_change", n,
+                list_dispatch_status_change(cmd, 0));
+
+        free(plugins);
+    }
+    esh_command_line_free(cline);
+    return bench_finish();
+}
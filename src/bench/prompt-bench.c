@@ -0,0 +1,106 @@
+/*
+ * Prompt composition benchmark.
+ *
+ * Registers 1 to 64 plugins that implement make_prompt, each making a
+ * fragment from the working directory the way a typical prompt plugin
+ * does, and measures the cost of one prompt:
+ *
+ *  - "uncached", when every plugin makes its fragment for every prompt;
+ *  - "cached", when the plugins' fragments depend only on the working
+ *    directory, which does not change, so fragments are reused;
+ *  - "strcat", every plugin called and the fragments joined with
+ *    realloc() and strcat(), which is how esh made prompts before it
+ *    composed them in one buffer.
+ *
+ * Usage: prompt-bench [-j] [-t seconds]
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+
+#include "../esh.h"
+#include "bench.h"
+
+#define BATCH 10
+
+static char *
+cwd_prompt(void)
+{
+    char cwd[PATH_MAX], *p;
+
+    if (getcwd(cwd, sizeof cwd) == NULL || asprintf(&p, "[%s] ", cwd) < 0)
+        return NULL;
+    return p;
+}
+
+/* Make a prompt the way esh did before esh_prompt_compose() */
+static char *
+strcat_prompt(void)
+{
+    char *prompt = NULL;
+    esh_plugin_load_hook(ESH_HOOK_MAKE_PROMPT);
+    char *(**make_prompt)(void) = esh_plugin_hooks.make_prompt;
+
+    for (; *make_prompt; make_prompt++) {
+        char * p = (*make_prompt)();
+        if (prompt == NULL) {
+            prompt = p;
+        } else {
+            prompt = realloc(prompt, strlen(prompt) + strlen(p) + 1);
+            strcat(prompt, p);
+            free(p);
+        }
+    }
+    return prompt;
+}
+
+/* Report the time per prompt of 'make' with 'n' plugins loaded */
+#define MEASURE(what, n, make) do {                                     \
+    long rounds = 0;                                                    \
+    double start = bench_now(), elapsed;                                \
+    do {                                                                \
+        for (i = 0; i < BATCH; i++)                                     \
+            make;                                                       \
+        rounds++;                                                       \
+    } while ((elapsed = bench_now() - start) < bench_budget());         \
+    snprintf(name, sizeof name, "%s/plugins=%d", what, n);              \
+    bench_report(name, elapsed * 1e9 / (rounds * BATCH), "ns/prompt"); \
+} while (0)
+
+int
+main(int ac, char *av[])
+{
+    static const int counts[] = { 1, 4, 16, 64 };
+    unsigned int c;
+    char name[64];
+
+    bench_init(ac, av, "prompt");
+
+    for (c = 0; c < sizeof counts / sizeof counts[0]; c++) {
+        int n = counts[c], i;
+        struct esh_plugin *plugins = calloc(n, sizeof *plugins);
+
+        list_init(&esh_plugin_list);
+        for (i = 0; i < n; i++) {
+            plugins[i].rank = i;
+            plugins[i].make_prompt = cwd_prompt;
+            list_push_back(&esh_plugin_list, &plugins[i].elem);
+        }
+        esh_plugin_initialize(NULL);
+
+        MEASURE("uncached", n, esh_prompt_compose());
+        MEASURE("strcat", n, free(strcat_prompt()));
+
+        /* the fragments are set up again once the tables change */
+        for (i = 0; i < n; i++)
+            plugins[i].prompt_events = ESH_PROMPT_CWD;
+        esh_plugin_initialize(NULL);
+        MEASURE("cached", n, esh_prompt_compose());
+
+        free(plugins);
+    }
+    return bench_finish();
+}
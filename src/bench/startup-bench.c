@@ -0,0 +1,157 @@
+/*
+ * Startup benchmark.
+ *
+ * Measures how long 'esh -p dir -c true' takes with a directory of 64
+ * plugins, copies of plugins/cd.so by default:
+ *
+ *  - without a manifest cache, when every plugin is opened at startup;
+ *  - cold, when the manifest is missing and is written by the run;
+ *  - warm, when the manifest is valid and no plugin needs to be opened.
+ *
+ * Must be run from the directory that holds esh.
+ *
+ * Usage: startup-bench [-j] [-t seconds] [nplugins [plugin.so]]
+ */
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/wait.h>
+
+#include "bench.h"
+
+extern char **environ;
+
+/* Copy file 'from' to 'to' */
+static void
+copy_file(const char *from, const char *to)
+{
+    char buf[65536];
+    ssize_t n;
+    int in = open(from, O_RDONLY), out;
+
+    if (in < 0 || (out = open(to, O_WRONLY | O_CREAT | O_TRUNC, 0755)) < 0) {
+        perror(in < 0 ? from : to);
+        exit(EXIT_FAILURE);
+    }
+    while ((n = read(in, buf, sizeof buf)) > 0)
+        if (write(out, buf, n) != n) {
+            perror(to);
+            exit(EXIT_FAILURE);
+        }
+    close(in);
+    close(out);
+}
+
+/* Remove the files in 'dir', and 'dir' if 'rmself' */
+static void
+clear_dir(const char *dir, bool rmself)
+{
+    char path[4096];
+    struct dirent *d;
+    DIR *dp = opendir(dir);
+
+    while (dp != NULL && (d = readdir(dp)) != NULL) {
+        if (d->d_name[0] == '.')
+            continue;
+        snprintf(path, sizeof path, "%s/%s", dir, d->d_name);
+        unlink(path);
+    }
+    if (dp != NULL)
+        closedir(dp);
+    if (rmself)
+        rmdir(dir);
+}
+
+/* Run esh once with XDG_CACHE_HOME set to 'cache' */
+static void
+run_esh(const char *plugindir, const char *cache)
+{
+    char *argv[] = { "./esh", "-p", (char *) plugindir, "-c", "true", NULL };
+    posix_spawn_file_actions_t fa;
+    pid_t pid;
+    int status;
+
+    setenv("XDG_CACHE_HOME", cache, 1);
+    posix_spawn_file_actions_init(&fa);
+    posix_spawn_file_actions_addopen(&fa, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+    if (posix_spawn(&pid, argv[0], &fa, NULL, argv, environ) != 0) {
+        perror("posix_spawn ./esh");
+        exit(EXIT_FAILURE);
+    }
+    posix_spawn_file_actions_destroy(&fa);
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status)
+            || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "esh failed\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+enum mode { NO_CACHE, COLD, WARM };
+
+/* Time runs of esh in 'mode'; returns ms per run */
+static double
+measure(const char *plugindir, const char *cache, enum mode mode)
+{
+    char manifests[4096];
+    long runs = 0;
+
+    if (mode == WARM)
+        run_esh(plugindir, cache);      /* write the manifest */
+
+    double start = bench_now(), elapsed;
+
+    do {
+        if (mode == COLD) {
+            /* only the run itself is timed, not removing the manifest */
+            double t = bench_now();
+            snprintf(manifests, sizeof manifests, "%s/esh", cache);
+            clear_dir(manifests, false);
+            start += bench_now() - t;
+        }
+        /* a cache directory that cannot be created disables the cache */
+        run_esh(plugindir, mode == NO_CACHE ? "/dev/null/cache" : cache);
+        runs++;
+    } while ((elapsed = bench_now() - start) < bench_budget());
+    return elapsed * 1e3 / runs;
+}
+
+int
+main(int ac, char *av[])
+{
+    int arg = bench_init(ac, av, "startup");
+    int nplugins = arg < ac ? atoi(av[arg]) : 64;
+    const char *plugin = arg + 1 < ac ? av[arg + 1] : "plugins/cd.so";
+    char plugindir[] = "/tmp/esh-startup-XXXXXX";
+    char cache[] = "/tmp/esh-startup-cache-XXXXXX";
+    char path[4096], name[64];
+    int i;
+
+    /* the cache must not be in the plugin directory, whose
+     * modification time the manifest records */
+    if (mkdtemp(plugindir) == NULL || mkdtemp(cache) == NULL) {
+        perror("mkdtemp");
+        return EXIT_FAILURE;
+    }
+    for (i = 0; i < nplugins; i++) {
+        snprintf(path, sizeof path, "%s/plugin%03d.so", plugindir, i);
+        copy_file(plugin, path);
+    }
+
+    snprintf(name, sizeof name, "nocache/plugins=%d", nplugins);
+    bench_report(name, measure(plugindir, cache, NO_CACHE), "ms");
+    snprintf(name, sizeof name, "cold/plugins=%d", nplugins);
+    bench_report(name, measure(plugindir, cache, COLD), "ms");
+    snprintf(name, sizeof name, "warm/plugins=%d", nplugins);
+    bench_report(name, measure(plugindir, cache, WARM), "ms");
+
+    snprintf(path, sizeof path, "%s/esh", cache);
+    clear_dir(path, true);
+    clear_dir(cache, true);
+    clear_dir(plugindir, true);
+    return bench_finish();
+}
@@ -0,0 +1,47 @@
+/*
+ * Trace point benchmark.
+ *
+ * Measures what a trace point, ESH_TRACE_START() followed by
+ * ESH_TRACE_SPAN(), costs the launch path: first with tracing off, the
+ * normal case, where it should cost no more than a test and a branch,
+ * then with tracing on and events written to /dev/null.
+ *
+ * Usage: trace-bench [-j] [-t seconds]
+ */
+#include <stdio.h>
+
+#include "../esh.h"
+#include "bench.h"
+
+#define BATCH 1000
+
+/* Run trace points for the time budget; returns ns per trace point */
+static double
+run(void)
+{
+    double start = bench_now(), elapsed;
+    long ops = 0;
+    int i;
+
+    do {
+        for (i = 0; i < BATCH; i++) {
+            double t = ESH_TRACE_START();
+            /* keep the compiler from hoisting the test out of the loop */
+            __asm__ volatile("" ::: "memory");
+            ESH_TRACE_SPAN("bench", t, NULL);
+        }
+        ops += BATCH;
+    } while ((elapsed = bench_now() - start) < bench_budget());
+    return elapsed * 1e9 / ops;
+}
+
+int
+main(int ac, char *av[])
+{
+    bench_init(ac, av, "trace");
+
+    bench_report("span/off", run(), "ns/op");
+    esh_trace_open("/dev/null");
+    bench_report("span/on", run(), "ns/op");
+    return bench_finish();
+}
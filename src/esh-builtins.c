@@ -0,0 +1,115 @@
+/*
+ * esh-builtins.c
+ * Registry of built-in commands.
+ *
+ * Core builtins, which the shell implements itself, and builtins that
+ * plugins declare in their 'builtins' field are registered by name in
+ * one table, so that finding out whether a command is a builtin, and
+ * whose, takes a single lookup instead of a strcmp() per name.
+ *
+ * The table uses open addressing with linear probing.  Names are hashed
+ * with FNV-1a, from a seed chosen so that the core builtins (kill, stop,
+ * jobs, fg, bg, times, hash, parallel, jobs-max, jobserver, limit, pin)
+ * land in different slots for every table size from 16 to 256, which makes
+ * the hash perfect for them: a core builtin, and any command that is not a
+ * builtin and whose slot is empty, is resolved with one probe and at
+ * most one strcmp().  The seed
+ * must be chosen again when the set of core builtins changes.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esh.h"
+
+/* FNV-1a offset basis plus 2968; see above */
+#define BUILTIN_HASH_SEED UINT64_C(0xcbf29ce484222ebd)
+
+#define BUILTIN_MIN_SLOTS 16
+
+static struct esh_builtin *slots;   /* Array of 'nslots'; unused if name is NULL */
+static size_t nslots;               /* Number of slots, a power of 2 */
+static size_t count;                /* Number of registered builtins */
+
+/* FNV-1a; the slot is taken from the high bits, which mix best */
+static size_t
+name_slot(const char *name)
+{
+    uint64_t h = BUILTIN_HASH_SEED;
+    for (; *name; name++)
+        h = (h ^ (unsigned char) *name) * UINT64_C(1099511628211);
+    return h >> (64 - __builtin_ctzl(nslots));
+}
+
+/* Slot holding 'name', or the empty slot where it would go */
+static struct esh_builtin *
+slot_find(const char *name)
+{
+    size_t i = name_slot(name);
+
+    while (slots[i].name != NULL && strcmp(slots[i].name, name) != 0)
+        i = (i + 1) & (nslots - 1);
+    return &slots[i];
+}
+
+static void
+slots_init(size_t n)
+{
+    slots = calloc(n, sizeof slots[0]);
+    if (slots == NULL)
+        esh_sys_fatal_error("malloc: ");
+    nslots = n;
+}
+
+/* Double the number of slots. */
+static void
+slots_grow(void)
+{
+    struct esh_builtin *old = slots;
+    size_t oldn = nslots;
+    size_t i;
+
+    slots_init(oldn * 2);
+    for (i = 0; i < oldn; i++)
+        if (old[i].name != NULL)
+            *slot_find(old[i].name) = old[i];
+    free(old);
+}
+
+/* Register builtin 'name'.  A core builtin is run by 'run'; a plugin's
+ * builtin by the process_builtin hook of 'plugin'.  A name may be both:
+ * the plugin is then asked first, and the core builtin runs if the
+ * plugin declines.  If several plugins register a name, the first one
+ * keeps it; plugins are registered in increasing rank. */
+void
+esh_builtin_register(const char *name, void (*run)(char **argv),
+                     struct esh_plugin *plugin)
+{
+    if (slots == NULL)
+        slots_init(BUILTIN_MIN_SLOTS);
+
+    /* keep the table at most half full, so that probes stay short */
+    if (2 * (count + 1) > nslots)
+        slots_grow();
+
+    struct esh_builtin *b = slot_find(name);
+    if (b->name == NULL) {
+        b->name = name;
+        count++;
+    }
+    if (b->run == NULL)
+        b->run = run;
+    if (b->plugin == NULL)
+        b->plugin = plugin;
+}
+
+/* Return the builtin called 'name', or NULL if there is none */
+struct esh_builtin *
+esh_builtin_find(const char *name)
+{
+    if (slots == NULL)
+        return NULL;
+
+    struct esh_builtin *b = slot_find(name);
+    return b->name != NULL ? b : NULL;
+}
@@ -0,0 +1,346 @@
+/*
+ * esh-cgroup.c
+ * Per-job cgroups.
+ *
+ * With -g, every job is started in a cgroup v2 leaf of its own, so that
+ * the resources it uses can be limited and shown as a whole, and the
+ * whole job, including processes that left its process group, can be
+ * removed at once through cgroup.kill.
+ *
+ * The shell must be able to manage the cgroup it was started in, which
+ * is the case if the cgroup was delegated to the user running it (e.g.
+ * by 'systemd-run --user --scope -p Delegate=yes').  esh then makes
+ * the subtree
+ *
+ *   <its cgroup>/esh-<pid>/shell       the shell itself
+ *   <its cgroup>/esh-<pid>/job-<n>     one per job
+ *
+ * since a cgroup whose children use controllers may not hold processes
+ * itself.  The cpu, memory and pids controllers are enabled for the
+ * jobs where the parent cgroup allows it; without them, jobs still get
+ * cgroups, but cannot be limited.  If no subtree can be made, jobs are
+ * run as without -g.  At exit, the subtree is removed and the
+ * controllers esh enabled in the parent are disabled again, unless jobs
+ * are still running in it.
+ *
+ * A command is placed into its job's cgroup when it is created, so that
+ * not even a process it forks right away escapes: through clone3() with
+ * CLONE_INTO_CGROUP if posix_spawn supports it, and otherwise by moving
+ * the shell into the job's cgroup while the command is spawned.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "esh.h"
+
+struct esh_cgroup {
+    int fd;                         /* Its directory */
+    char path[PATH_MAX + 64];
+};
+
+static char root[PATH_MAX + 16];    /* esh-<pid>, or "" if not enabled */
+static char parent[PATH_MAX];       /* The cgroup esh was started in */
+static int shell_procs = -1;        /* cgroup.procs of root/shell */
+static unsigned long njobs;         /* Cgroups made so far, for names */
+
+static const char *controllers[] = { "cpu", "memory", "pids" };
+#define NCONTROLLERS (sizeof controllers / sizeof controllers[0])
+static bool enabled_in_parent[NCONTROLLERS];    /* By esh, undone at exit */
+
+/* Write 'value' to 'file' of cgroup 'dir'.  Returns false, with errno
+ * set, on failure. */
+static bool
+write_file(const char *dir, const char *file, const char *value)
+{
+    char path[PATH_MAX];
+    int fd;
+
+    snprintf(path, sizeof path, "%s/%s", dir, file);
+    if ((fd = open(path, O_WRONLY | O_CLOEXEC)) < 0)
+        return false;
+
+    ssize_t n = write(fd, value, strlen(value));
+    int err = errno;
+    close(fd);
+    errno = err;
+    return n == (ssize_t) strlen(value);
+}
+
+/* Read 'file' of cgroup 'dir' into 'buf', without the final newline */
+static bool
+read_file(const char *dir, const char *file, char *buf, size_t size)
+{
+    char path[PATH_MAX];
+    int fd;
+
+    snprintf(path, sizeof path, "%s/%s", dir, file);
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+        return false;
+
+    ssize_t n = read(fd, buf, size - 1);
+    close(fd);
+    if (n < 0)
+        return false;
+    buf[n] = '\0';
+    if (n > 0 && buf[n - 1] == '\n')
+        buf[n - 1] = '\0';
+    return true;
+}
+
+/* True if 'name' is one of the space-separated words of 'list' */
+static bool
+has_word(const char *list, const char *name)
+{
+    size_t len = strlen(name);
+    const char *p = list;
+
+    while ((p = strstr(p, name)) != NULL) {
+        if ((p == list || p[-1] == ' ') && (p[len] == ' ' || p[len] == '\0'))
+            return true;
+        p += len;
+    }
+    return false;
+}
+
+/* Find the directory of the cgroup v2 the shell is in */
+static bool
+find_own_cgroup(char *dir, size_t size)
+{
+    char *line = NULL, mnt[PATH_MAX] = "", cg[PATH_MAX] = "";
+    size_t linesize = 0;
+    FILE *f;
+
+    /* the unified hierarchy is the one with id 0 */
+    if ((f = fopen("/proc/self/cgroup", "re")) == NULL)
+        return false;
+    while (getline(&line, &linesize, f) > 0)
+        if (strncmp(line, "0::", 3) == 0)
+            sscanf(line + 3, "%4095s", cg);
+    fclose(f);
+
+    /* fields: id parent major:minor root mountpoint options... - type */
+    if ((f = fopen("/proc/self/mountinfo", "re")) != NULL) {
+        while (getline(&line, &linesize, f) > 0) {
+            char point[PATH_MAX];
+            char *dash = strstr(line, " - ");
+            if (dash != NULL && strncmp(dash + 3, "cgroup2 ", 8) == 0
+                    && sscanf(line, "%*s %*s %*s %*s %4095s", point) == 1)
+                strcpy(mnt, point);
+        }
+        fclose(f);
+    }
+    free(line);
+
+    if (mnt[0] == '\0' || cg[0] == '\0')
+        return false;
+    return snprintf(dir, size, "%s%s", mnt, strcmp(cg, "/") ? cg : "")
+        < (int) size;
+}
+
+static void
+cleanup(void)
+{
+    char dir[PATH_MAX + 300], ctl[16];
+    bool busy = false;
+    unsigned int i;
+
+    if (root[0] == '\0')
+        return;
+
+    DIR *dp = opendir(root);
+    struct dirent *d;
+    while (dp != NULL && (d = readdir(dp)) != NULL) {
+        if (d->d_type != DT_DIR || d->d_name[0] == '.'
+                || strcmp(d->d_name, "shell") == 0)
+            continue;
+        snprintf(dir, sizeof dir, "%s/%s", root, d->d_name);
+        if (rmdir(dir) < 0)
+            busy = true;
+    }
+    if (dp != NULL)
+        closedir(dp);
+
+    /* the parent may not hold the shell while it has controllers
+     * enabled for its children, unless it is the root cgroup.  Jobs that
+     * are still running keep their cgroups, esh-<pid> and its
+     * controllers. */
+    for (i = 0; i < NCONTROLLERS; i++) {
+        if (busy || !enabled_in_parent[i])
+            continue;
+        snprintf(ctl, sizeof ctl, "-%s", controllers[i]);
+        write_file(root, "cgroup.subtree_control", ctl);
+        write_file(parent, "cgroup.subtree_control", ctl);
+    }
+    if (!write_file(parent, "cgroup.procs", "0"))
+        return;
+    snprintf(dir, sizeof dir, "%s/shell", root);
+    rmdir(dir);
+    rmdir(root);
+}
+
+bool
+esh_cgroup_init(void)
+{
+    char dir[PATH_MAX + 64], have[256], ctl[16];
+    unsigned int i;
+
+    if (!find_own_cgroup(parent, sizeof parent))
+        return false;
+
+    snprintf(root, sizeof root, "%s/esh-%d", parent, getpid());
+    snprintf(dir, sizeof dir, "%s/shell", root);
+    if (mkdir(root, 0755) < 0 && errno != EEXIST)
+        goto fail;
+    if (mkdir(dir, 0755) < 0 && errno != EEXIST)
+        goto fail;
+
+    /* "0" is the writing process */
+    if (!write_file(dir, "cgroup.procs", "0"))
+        goto fail;
+    snprintf(dir, sizeof dir, "%s/shell/cgroup.procs", root);
+    shell_procs = open(dir, O_WRONLY | O_CLOEXEC);
+
+    /* each controller the parent has may be enabled on its own; those
+     * esh enables in the parent are disabled again at exit */
+    if (!read_file(parent, "cgroup.subtree_control", have, sizeof have))
+        have[0] = '\0';
+    for (i = 0; i < NCONTROLLERS; i++) {
+        snprintf(ctl, sizeof ctl, "+%s", controllers[i]);
+        if (!has_word(have, controllers[i])
+                && write_file(parent, "cgroup.subtree_control", ctl))
+            enabled_in_parent[i] = true;
+        write_file(root, "cgroup.subtree_control", ctl);
+    }
+
+    atexit(cleanup);
+    return true;
+
+fail:
+    snprintf(dir, sizeof dir, "%s/shell", root);
+    rmdir(dir);
+    rmdir(root);
+    root[0] = '\0';
+    return false;
+}
+
+bool
+esh_cgroup_enabled(void)
+{
+    return root[0] != '\0';
+}
+
+struct esh_cgroup *
+esh_cgroup_create(void)
+{
+    struct esh_cgroup *cg = malloc(sizeof *cg);
+    if (cg == NULL)
+        esh_sys_fatal_error("malloc: ");
+
+    /* the jid is not known yet when the first process is started */
+    snprintf(cg->path, sizeof cg->path, "%s/job-%lu", root, ++njobs);
+    if (mkdir(cg->path, 0755) < 0) {
+        esh_sys_error("cgroup: %s: ", cg->path);
+        free(cg);
+        return NULL;
+    }
+    if ((cg->fd = open(cg->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0) {
+        esh_sys_error("cgroup: %s: ", cg->path);
+        rmdir(cg->path);
+        free(cg);
+        return NULL;
+    }
+    return cg;
+}
+
+void
+esh_cgroup_destroy(struct esh_cgroup *cg)
+{
+    close(cg->fd);
+
+    /* fails if processes of the job are left; the cgroup then stays */
+    rmdir(cg->path);
+    free(cg);
+}
+
+int
+esh_cgroup_fd(struct esh_cgroup *cg)
+{
+    return cg->fd;
+}
+
+bool
+esh_cgroup_enter(struct esh_cgroup *cg)
+{
+    return write_file(cg->path, "cgroup.procs", "0");
+}
+
+void
+esh_cgroup_leave(void)
+{
+    if (write(shell_procs, "0", 1) != 1)
+        esh_sys_error("cgroup: ");
+}
+
+bool
+esh_cgroup_kill(struct esh_cgroup *cg)
+{
+    return write_file(cg->path, "cgroup.kill", "1");
+}
+
+bool
+esh_cgroup_set(struct esh_cgroup *cg, const char *file, const char *value)
+{
+    if (write_file(cg->path, file, value))
+        return true;
+
+    if (errno == ENOENT)
+        fprintf(stderr, "limit: %s: controller not enabled\n", file);
+    else
+        esh_sys_error("limit: %s: ", file);
+    return false;
+}
+
+void
+esh_cgroup_print_limits(struct esh_cgroup *cg)
+{
+    static const char *files[] = { "cpu.max", "memory.max", "pids.max" };
+    char buf[256];
+    unsigned int i, shown = 0;
+
+    for (i = 0; i < sizeof files / sizeof files[0]; i++)
+        if (read_file(cg->path, files[i], buf, sizeof buf)) {
+            printf("    %s %s\n", files[i], buf);
+            shown++;
+        }
+    if (shown == 0)
+        printf("    no controllers enabled\n");
+}
+
+void
+esh_cgroup_print_usage(struct esh_cgroup *cg)
+{
+    char buf[1024], *usage;
+    unsigned long long usec = 0, bytes;
+
+    printf("    cgroup:");
+    if (read_file(cg->path, "cpu.stat", buf, sizeof buf)
+            && (usage = strstr(buf, "usage_usec ")) != NULL) {
+        usec = strtoull(usage + 11, NULL, 10);
+        printf(" cpu %llu.%03llus", usec / 1000000, usec / 1000 % 1000);
+    }
+    if (read_file(cg->path, "memory.current", buf, sizeof buf)) {
+        bytes = strtoull(buf, NULL, 10);
+        printf(" memory %.1fM", bytes / (1024.0 * 1024.0));
+    }
+    if (read_file(cg->path, "pids.current", buf, sizeof buf))
+        printf(" pids %s", buf);
+    printf("\n");
+}
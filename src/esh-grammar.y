@@ -7,15 +7,16 @@
  * This is based on an assignment I did in 1993 as an undergraduate
  * student at Technische Universitaet Berlin.
  *
- * Known bugs: leaks memory when parse errors occur.
+ * Everything the parser allocates, including the words the scanner
+ * returns, comes from the arena of the command line being built, so
+ * nothing leaks when a parse error occurs.
  */
 %{
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #define YYDEBUG	1
 int yydebug;
-void yyerror(const char *msg);
-int yylex(void);
 
 /*
  * Error messages, csh-style
@@ -24,93 +25,230 @@ int yylex(void);
 #define INVNUL  "Invalid null command."
 #define AMBINP  "Ambiguous input redirect."
 #define AMBOUT  "Ambiguous output redirect."
+#define NESTSUB "Nested process substitution."
+#define MISPAR  "Missing )."
 
 #include "esh.h"
 
 #define obstack_chunk_alloc malloc
 #define obstack_chunk_free free
 
+/* A word of a command, in the arena */
+struct word_list {
+    char *word;
+    struct word_list *next;
+};
+
+/* A process substitution of a command, in the arena */
+struct subst {
+    struct esh_pipeline *pipe;  /* holds its commands until they are moved
+                                   into the pipeline of the command */
+    char kind;                  /* '<' or '>' */
+    int arg;                    /* index of the argument it stands for */
+    struct subst *next;
+};
+
 struct cmd_helper {
-    struct obstack words;   /* an obstack of char * to collect argv */
+    struct word_list *first;    /* words collected for argv, in order */
+    struct word_list *last;
+    int nwords;
+    struct subst *substs;       /* its process substitutions, last first */
     char *iored_input;
     char *iored_output;
     bool append_to_output;
+    char *here_document;        /* text of a <<< here-string */
+    char *here_end;             /* delimiter of a << here-document */
 };
 
+/* True if the command's input is redirected in any way */
+#define HAS_INPUT(cmd) \
+    ((cmd).iored_input || (cmd).here_document || (cmd).here_end)
+
+/* Append a word to cmd_helper */
+static void
+add_word(struct obstack *arena, struct cmd_helper *cmd, char *word)
+{
+    struct word_list *w = obstack_alloc(arena, sizeof *w);
+
+    w->word = word;
+    w->next = NULL;
+    if (cmd->last)
+        cmd->last->next = w;
+    else
+        cmd->first = w;
+    cmd->last = w;
+    cmd->nwords++;
+}
+
 /* Initialize cmd_helper and, optionally, set first argv */
 static void
-init_cmd(struct cmd_helper *cmd, char *firstcmd, 
+init_cmd(struct obstack *arena, struct cmd_helper *cmd, char *firstcmd, 
          char *iored_input, char *iored_output, bool append_to_output)
 {
-    obstack_init(&cmd->words);
+    cmd->first = cmd->last = NULL;
+    cmd->nwords = 0;
+    cmd->substs = NULL;
     if (firstcmd)
-        obstack_ptr_grow(&cmd->words, firstcmd);
+        add_word(arena, cmd, firstcmd);
 
     cmd->iored_output = iored_output;
     cmd->iored_input = iored_input;
     cmd->append_to_output = append_to_output;
+    cmd->here_document = NULL;
+    cmd->here_end = NULL;
+}
+
+/* The text a here-string feeds: its word and a newline */
+static char *
+here_string(struct obstack *arena, char *word)
+{
+    obstack_grow(arena, word, strlen(word));
+    obstack_grow0(arena, "\n", 1);
+    return obstack_finish(arena);
 }
 
 /* print error message */
 static void p_error(char *msg);
 
+/* Add process substitution 's' as the next argument of cmd_helper */
+static void
+add_subst(struct obstack *arena, struct cmd_helper *cmd, struct subst *s)
+{
+    s->arg = cmd->nwords;
+    s->next = cmd->substs;
+    cmd->substs = s;
+    add_word(arena, cmd, s->kind == '<' ? "<(...)" : ">(...)");
+}
+
+/* Make a process substitution of 'pipe'.  Returns NULL, after printing
+ * an error, if the substitution's pipe would not be used. */
+static struct subst *
+make_subst(struct obstack *arena, char kind, struct esh_pipeline *pipe)
+{
+    struct esh_command *first, *last;
+    struct list_elem *e;
+
+    for (e = list_begin(&pipe->commands); e != list_end(&pipe->commands);
+         e = list_next(e))
+        if (list_entry(e, struct esh_command, elem)->substitution) {
+            p_error(NESTSUB);
+            return NULL;
+        }
+
+    /* Error: '<(ls >x)' and '>(<x wc)' */
+    first = list_entry(list_front(&pipe->commands), struct esh_command, elem);
+    last = list_entry(list_back(&pipe->commands), struct esh_command, elem);
+    if (kind == '<' && last->iored_output) { p_error(AMBOUT); return NULL; }
+    if (kind == '>' && (first->iored_input || first->here_document
+                        || first->here_end)) {
+        p_error(AMBINP);
+        return NULL;
+    }
+
+    struct subst *s = obstack_alloc(arena, sizeof *s);
+    s->pipe = pipe;
+    s->kind = kind;
+    return s;
+}
+
+/* Move the commands of the process substitutions of cmd_helper into the
+ * pipeline of the command 'pcmd' made from it, right before 'pcmd', in
+ * the order they appear in */
+static void
+splice_substs(struct cmd_helper *cmd, struct esh_command *pcmd)
+{
+    struct list_elem *before = &pcmd->elem;
+    struct subst *s;
+
+    /* from the back, since both lists are in reverse */
+    for (s = cmd->substs; s != NULL; s = s->next) {
+        while (!list_empty(&s->pipe->commands)) {
+            struct esh_command *c = list_entry(list_pop_back(&s->pipe->commands),
+                                               struct esh_command, elem);
+            c->substitution = s->kind;
+            c->subst_arg = s->arg;
+            c->pipeline = pcmd->pipeline;
+            list_insert(before, &c->elem);
+            before = &c->elem;
+        }
+    }
+}
+
 /* Convert cmd_helper to esh_command.
  * Ensures NULL-terminated argv[] array
  */
 static struct esh_command * 
-make_esh_command(struct cmd_helper *cmd)
+make_esh_command(struct obstack *arena, struct cmd_helper *cmd)
 {
-    obstack_ptr_grow(&cmd->words, NULL);
+    if (cmd->nwords == 0)
+        return NULL; 
 
-    int sz = obstack_object_size(&cmd->words);
-    char **argv = malloc(sz);
-    memcpy(argv, obstack_finish(&cmd->words), sz);
-    obstack_free(&cmd->words, NULL);
+    char **argv = obstack_alloc(arena, (cmd->nwords + 1) * sizeof *argv);
+    struct word_list *w;
+    int i = 0;
 
-    if (*argv == NULL) {
-        free(argv);
-        return NULL; 
-    }
+    for (w = cmd->first; w != NULL; w = w->next)
+        argv[i++] = w->word;
+    argv[i] = NULL;
 
-    return esh_command_create(argv,
+    struct esh_command *pcmd = esh_command_create(arena, argv,
                               cmd->iored_input,
                               cmd->iored_output,
                               cmd->append_to_output);
+    pcmd->here_document = cmd->here_document;
+    pcmd->here_end = cmd->here_end;
+    return pcmd;
 }
 
-/* Called by parser when command line is complete */
-static void cmdline_complete(struct esh_command_line *);
-
-/* work-around for bug in flex 2.31 and later */
-static void yyunput (int c,char *buf_ptr  ) __attribute__((unused));
+/* The arena of the command line being parsed */
+#define ARENA (&cline->arena)
 
 %}
 
+/* The parser and the scanner keep no global state, so that command lines
+ * can be parsed concurrently, e.g. by plugins or on worker threads.
+ * 'scanner' is the reentrant flex scanner reading the line, and the
+ * pipelines are added to 'cline', whose arena they are allocated in. */
+%define api.pure full
+%lex-param   {void *scanner}
+%parse-param {void *scanner} {struct esh_command_line *cline}
+
 /* LALR stack types */
 %union {
   struct cmd_helper command;
   struct esh_pipeline * pipe;
   struct esh_command_line * cmdline;
   char *word;
+  struct subst *subst;
 }
 
+%{
+int yylex(YYSTYPE *lvalp, void *scanner);
+void yyerror(void *scanner, struct esh_command_line *cline, const char *msg);
+%}
+
 /* Nonterminals */
 %type <command> input output
-%type <command> command
+%type <command> command fanout fanout_files
 %type <pipe> pipeline
+%type <subst> substitution
 %type <cmdline> cmd_list
 
 /* Terminals */
 %token <word> WORD
 %token GREATER_GREATER 
+%token LESS_LESS LESS_LESS_LESS
+%token LESS_PAREN GREATER_PAREN
+%token GREATER_AMP PIPE_GREATER
 
 %%
-cmd_line: cmd_list { cmdline_complete($1); }
+cmd_line: cmd_list
 
-cmd_list:	/* Null Command */ { $$ = esh_command_line_create_empty(); }
+cmd_list:	/* Null Command */ { $$ = cline; }
 |		pipeline { 
             esh_pipeline_finish($1);
-            $$ = esh_command_line_create($1);
+            $$ = cline;
+            list_push_back(&$$->pipes, &$1->elem);
         } 
 |		cmd_list ';'
 |		cmd_list '&' {
@@ -138,48 +276,72 @@ cmd_list:	/* Null Command */ { $$ = esh_command_line_create_empty(); }
         }
 
 pipeline: command {
-            struct esh_command * pcmd = make_esh_command(&$1);
+            struct esh_command * pcmd = make_esh_command(ARENA, &$1);
             if (pcmd == NULL) { p_error(INVNUL); YYABORT; }
-            $$ = esh_pipeline_create(pcmd);
+            $$ = esh_pipeline_create(ARENA, pcmd);
+            splice_substs(&$1, pcmd);
 		}
 |		pipeline '|' command {
 		    /* Error: 'ls >x | wc' */
             struct esh_command * last;
             last = list_entry(list_back(&$1->commands), 
                               struct esh_command, elem);
-		    if (last->iored_output) { p_error(AMBOUT); YYABORT; }
+		    if (last->iored_output || last->relay) { p_error(AMBOUT); YYABORT; }
 
 		    /* Error: 'ls | <x wc' */
-		    if ($3.iored_input) { p_error(AMBINP); YYABORT; }
+		    if (HAS_INPUT($3)) { p_error(AMBINP); YYABORT; }
 
-            struct esh_command * pcmd = make_esh_command(&$3);
+            struct esh_command * pcmd = make_esh_command(ARENA, &$3);
             if (pcmd == NULL) { p_error(INVNUL); YYABORT; }
 
             list_push_back(&$1->commands, &pcmd->elem);
             pcmd->pipeline = $1;
+            splice_substs(&$3, pcmd);
+            $$ = $1;
+		}
+|		pipeline fanout {
+		    /* Error: 'ls >x >& y' */
+            struct esh_command * last;
+            last = list_entry(list_back(&$1->commands), 
+                              struct esh_command, elem);
+		    if (last->iored_output || last->relay) { p_error(AMBOUT); YYABORT; }
+
+		    /* Error: 'ls >&' */
+		    if ($2.nwords == 1) { p_error(MISRED); YYABORT; }
+
+            /* 'ls >& a |> wc' runs as 'ls | esh-relay a >(wc)' */
+            struct esh_command * relay = make_esh_command(ARENA, &$2);
+            relay->relay = true;
+            list_push_back(&$1->commands, &relay->elem);
+            relay->pipeline = $1;
+            splice_substs(&$2, relay);
             $$ = $1;
 		}
 |		'|' error 	   { p_error(INVNUL); YYABORT; }
 |		pipeline '|' error { p_error(INVNUL); YYABORT; }
 
 command:   WORD { 
-            init_cmd(&$$, $1, NULL, NULL, false);
+            init_cmd(ARENA, &$$, $1, NULL, NULL, false);
         }
 |		input   
 |		output
 |		command WORD {
             $$ = $1;
-            obstack_ptr_grow(&$$.words, $2);
+            add_word(ARENA, &$$, $2);
+		}
+|		command substitution {
+            $$ = $1;
+            add_subst(ARENA, &$$, $2);
 		}
 |		command input {
-            obstack_free(&$2.words, NULL);
             /* Error: ambiguous redirect 'a <b <c' */
-            if($1.iored_input)   { p_error(AMBINP); YYABORT; }
+            if (HAS_INPUT($1))   { p_error(AMBINP); YYABORT; }
             $$ = $1; 
             $$.iored_input = $2.iored_input;
+            $$.here_document = $2.here_document;
+            $$.here_end = $2.here_end;
 		}
 |		command output {
-            obstack_free(&$2.words, NULL);
             /* Error: ambiguous redirect 'a >b >c' */
             if ($1.iored_output) { p_error(AMBOUT); YYABORT; }
             $$ = $1; 
@@ -187,30 +349,68 @@ command:   WORD {
             $$.append_to_output = $2.append_to_output;
 		}
 
+substitution: LESS_PAREN pipeline ')' {
+            if (($$ = make_subst(ARENA, '<', $2)) == NULL) YYABORT;
+        }
+|		GREATER_PAREN pipeline ')' {
+            if (($$ = make_subst(ARENA, '>', $2)) == NULL) YYABORT;
+        }
+		/* Error: '<(ls' and '<()' */
+|		LESS_PAREN pipeline error { p_error(MISPAR); YYABORT; }
+|		GREATER_PAREN pipeline error { p_error(MISPAR); YYABORT; }
+|		LESS_PAREN error { p_error(INVNUL); YYABORT; }
+|		GREATER_PAREN error { p_error(INVNUL); YYABORT; }
+
+/* Files come first, so that the words after '|> cmd' are cmd's */
+fanout:	fanout_files
+|		fanout PIPE_GREATER command {
+            struct esh_command * pcmd = make_esh_command(ARENA, &$3);
+            if (pcmd == NULL) { p_error(INVNUL); YYABORT; }
+            esh_pipeline_create(ARENA, pcmd);
+            splice_substs(&$3, pcmd);
+
+            struct subst *s = make_subst(ARENA, '>', pcmd->pipeline);
+            if (s == NULL) YYABORT;
+            $$ = $1;
+            add_subst(ARENA, &$$, s);
+        }
+|		fanout PIPE_GREATER error { p_error(INVNUL); YYABORT; }
+
+fanout_files: GREATER_AMP {
+            init_cmd(ARENA, &$$, ESH_RELAY, NULL, NULL, false);
+        }
+|		fanout_files WORD {
+            $$ = $1;
+            add_word(ARENA, &$$, $2);
+        }
+
 input:	'<' WORD { 
-            init_cmd(&$$, NULL, $2, NULL, false);
+            init_cmd(ARENA, &$$, NULL, $2, NULL, false);
+        }
+|		LESS_LESS_LESS WORD { 
+            init_cmd(ARENA, &$$, NULL, NULL, NULL, false);
+            $$.here_document = here_string(ARENA, $2);
+        }
+|		LESS_LESS WORD { 
+            /* the lines are read after the command line is parsed */
+            init_cmd(ARENA, &$$, NULL, NULL, NULL, false);
+            $$.here_end = $2;
         }
 |		'<' error	  { p_error(MISRED); YYABORT; }
+|		LESS_LESS_LESS error { p_error(MISRED); YYABORT; }
+|		LESS_LESS error { p_error(MISRED); YYABORT; }
 
 output:	'>' WORD { 
-            init_cmd(&$$, NULL, NULL, $2, false);
+            init_cmd(ARENA, &$$, NULL, NULL, $2, false);
         }
 |		GREATER_GREATER WORD { 
-            init_cmd(&$$, NULL, NULL, $2, true);
+            init_cmd(ARENA, &$$, NULL, NULL, $2, true);
         }
 		/* Error: missing redirect */
 |		'>' error 	  { p_error(MISRED); YYABORT; }
 |		GREATER_GREATER error { p_error(MISRED); YYABORT; }
 
 %%
-static char * inputline;    /* currently processed input line */
-#define YY_INPUT(buf,result,max_size) \
-    { \
-        result = *inputline ? (buf[0] = *inputline++, 1) : YY_NULL; \
-    }
-
-#define YY_NO_UNPUT
-#define YY_NO_INPUT
 #include "lex.yy.c"
 
 static void
@@ -220,28 +420,36 @@ p_error(char *msg)
     fprintf(stderr, "%s\n", msg); 
 }
 
-extern int yyparse (void);
-
 /* do not use default error handling since errors are handled above. */
 void 
-yyerror(const char *msg) { }
-
-static struct esh_command_line * commandline;
-static void cmdline_complete(struct esh_command_line *cline)
-{
-    commandline = cline;
-}
+yyerror(void *scanner, struct esh_command_line *cline, const char *msg) { }
 
 /* 
  * parse a commandline.
+ *
+ * The scanner reads the line from a single buffer rather than a
+ * character at a time.  Safe to call from several threads at once.
  */
 struct esh_command_line *
 esh_parse_command_line(char * line)
 {
-    inputline = line;
-    commandline = NULL;
+    struct esh_command_line *commandline = esh_command_line_create_empty();
+    yyscan_t scanner;
+
+    /* the scanner copies words into the command line's arena */
+    if (yylex_init_extra(&commandline->arena, &scanner) != 0) {
+        esh_command_line_free(commandline);
+        return NULL;
+    }
 
-    int error = yyparse();
+    YY_BUFFER_STATE buf = yy_scan_bytes(line, strlen(line), scanner);
+    int error = yyparse(scanner, commandline);
+    yy_delete_buffer(buf, scanner);
+    yylex_destroy(scanner);
 
-    return error ? NULL : commandline;
+    if (error) {
+        esh_command_line_free(commandline);
+        return NULL;
+    }
+    return commandline;
 }
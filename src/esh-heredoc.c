@@ -0,0 +1,187 @@
+/*
+ * esh-heredoc.c
+ * Here-strings and here-documents.
+ *
+ * 'cmd <<< word' feeds 'word' and a newline to the standard input of
+ * cmd, and 'cmd <<END' the lines that follow the command line, up to a
+ * line that is just END.  The parser records the delimiter; the lines
+ * are read once the whole command line has been parsed, by
+ * esh_command_line_read_heredocs, and kept in the command line's arena.
+ *
+ * The text is handed to the command without a temporary file and
+ * without a helper process:
+ *
+ *  - text that fits into a pipe is written into a pipe right away,
+ *    which cannot block, and the command gets the read end,
+ *  - larger text is written into a memfd, which is then sealed so that
+ *    the command, which gets it read-write, cannot change it,
+ *  - if no memfd can be made, a thread writes the text into a pipe as
+ *    the command reads it, so that the shell is never blocked by a
+ *    command that does not read all of it.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "esh.h"
+
+#define obstack_chunk_alloc malloc
+#define obstack_chunk_free free
+
+void
+esh_command_line_read_heredocs(struct esh_command_line *cline,
+                               char *(*next_line)(void *ctx), void *ctx)
+{
+    struct obstack *arena = &cline->arena;
+    struct list_elem *p, *c;
+
+    /* in the order the here-documents appear on the command line */
+    for (p = list_begin(&cline->pipes); p != list_end(&cline->pipes);
+         p = list_next(p)) {
+        struct esh_pipeline *pipe = list_entry(p, struct esh_pipeline, elem);
+        for (c = list_begin(&pipe->commands); c != list_end(&pipe->commands);
+             c = list_next(c)) {
+            struct esh_command *cmd = list_entry(c, struct esh_command, elem);
+            char *line;
+
+            if (cmd->here_end == NULL)
+                continue;
+            while ((line = next_line(ctx)) != NULL
+                    && strcmp(line, cmd->here_end) != 0) {
+                obstack_grow(arena, line, strlen(line));
+                obstack_1grow(arena, '\n');
+            }
+            if (line == NULL)
+                fprintf(stderr, "esh: here-document ended by end of file "
+                        "(wanted '%s')\n", cmd->here_end);
+            obstack_1grow(arena, '\0');
+            cmd->here_document = obstack_finish(arena);
+            cmd->here_end = NULL;
+        }
+    }
+}
+
+/* Write all of 'len' bytes of 'text' to 'fd'.  Returns false, with
+ * errno set, on failure. */
+static bool
+write_all(int fd, const char *text, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = write(fd, text, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return false;
+        text += n;
+        len -= n;
+    }
+    return true;
+}
+
+struct writer {
+    int fd;
+    size_t len;
+    char text[];
+};
+
+/* Write a here-document into a pipe as it is read.  A command that
+ * exits without reading all of it makes write fail with EPIPE, since
+ * SIGPIPE is blocked in this thread. */
+static void *
+writer_thread(void *arg)
+{
+    struct writer *w = arg;
+
+    write_all(w->fd, w->text, w->len);
+    close(w->fd);
+    free(w);
+    return NULL;
+}
+
+/* Hand the text to a writer thread, which owns a copy of it, since the
+ * job may be freed before a command that shares the pipe has read it */
+static bool
+start_writer(int fd, const char *text, size_t len)
+{
+    struct writer *w = malloc(sizeof *w + len);
+    pthread_t thread;
+
+    if (w == NULL)
+        esh_sys_fatal_error("malloc: ");
+    w->fd = fd;
+    w->len = len;
+    memcpy(w->text, text, len);
+
+    /* signals are for the main thread */
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    int rc = pthread_create(&thread, NULL, writer_thread, w);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (rc != 0) {
+        free(w);
+        errno = rc;
+        return false;
+    }
+    pthread_detach(thread);
+    return true;
+}
+
+/* A sealed memfd holding 'text', positioned at its start, or -1 */
+static int
+sealed_memfd(const char *text, size_t len)
+{
+    int fd = memfd_create("esh-heredoc", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0)
+        return -1;
+
+    if (!write_all(fd, text, len)
+            || fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW
+                                      | F_SEAL_WRITE | F_SEAL_SEAL) < 0
+            || lseek(fd, 0, SEEK_SET) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int
+esh_heredoc_open(const char *text)
+{
+    size_t len = strlen(text);
+    int fds[2], fd;
+
+    if (pipe2(fds, O_CLOEXEC) < 0) {
+        esh_sys_error("pipe2: ");
+        return -1;
+    }
+
+    int capacity = fcntl(fds[1], F_GETPIPE_SZ);
+    if (capacity > 0 && len <= (size_t) capacity) {
+        if (!write_all(fds[1], text, len))
+            esh_sys_fatal_error("here-document: write: ");
+        close(fds[1]);
+        return fds[0];
+    }
+
+    if ((fd = sealed_memfd(text, len)) >= 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return fd;
+    }
+
+    if (!start_writer(fds[1], text, len)) {
+        esh_sys_error("here-document: pthread_create: ");
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+    return fds[0];
+}
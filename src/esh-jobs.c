@@ -0,0 +1,412 @@
+/*
+ * esh-jobs.c
+ * The job table: the list of current jobs plus hash indexes that map
+ * job ids and process groups to pipelines, and process ids to commands.
+ *
+ * All lookups and updates are O(1) on average, so that reaping a burst
+ * of children does not turn into a walk over every job for every child.
+ *
+ * The table is only changed on the main thread.  SIGCHLD stays blocked
+ * and child status changes are picked up by the shell's event loop.
+ *
+ * The table also keeps the job slots.  Every background job takes a
+ * slot while it is in the table; when the shell-wide limit set with
+ * 'jobs-max', or the limit of the job's 'parallel' group, is reached,
+ * new background jobs are QUEUED instead of started.  Each group,
+ * including one for background jobs not started by 'parallel', queues
+ * its jobs in jid order, and the groups that have QUEUED jobs are kept
+ * in a list, so that finding the next job to start when a job ends
+ * costs time proportional to the number of such groups, not of jobs.
+ * With a jobserver, a slot also takes one of its tokens; see
+ * esh-jobserver.c.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+
+#include "esh.h"
+
+/* A hash index.  Each bucket is a list of link elements; 'key' extracts
+ * the key from an element so that buckets can be searched and rehashed. */
+struct job_index {
+    struct list *buckets;       /* Array of 'nbuckets' lists. */
+    size_t nbuckets;            /* Number of buckets, a power of 2. */
+    size_t count;               /* Number of elements in index. */
+    long (* key)(struct list_elem *);
+};
+
+#define JOB_INDEX_MIN_BUCKETS 64
+
+static struct list jobs_list;           /* All jobs, in increasing jid order */
+static struct job_index jid_index;      /* jid -> esh_pipeline */
+static struct job_index pgrp_index;     /* pgrp -> esh_pipeline */
+static struct job_index pid_index;      /* pid -> esh_command */
+
+static int slots_max;                   /* The jobs-max setting, or 0 */
+static int slots_used;                  /* Jobs holding a slot */
+static int nqueued;                     /* QUEUED jobs */
+static struct esh_job_group background; /* Group of jobs not started
+                                           by 'parallel' */
+static struct list queued_groups;       /* Groups with QUEUED jobs */
+
+static long
+jid_key(struct list_elem *e)
+{
+    return list_entry(e, struct esh_pipeline, jid_elem)->jid;
+}
+
+static long
+pgrp_key(struct list_elem *e)
+{
+    return list_entry(e, struct esh_pipeline, pgrp_elem)->pgrp;
+}
+
+static long
+pid_key(struct list_elem *e)
+{
+    return list_entry(e, struct esh_command, pid_elem)->pid;
+}
+
+/* Fibonacci hashing; nbuckets is a power of 2. */
+static size_t
+index_hash(struct job_index *idx, long key)
+{
+    return ((uint64_t) key * UINT64_C(11400714819323198485))
+            >> (64 - __builtin_ctzl(idx->nbuckets));
+}
+
+static void
+index_init(struct job_index *idx, long (* key)(struct list_elem *))
+{
+    idx->nbuckets = JOB_INDEX_MIN_BUCKETS;
+    idx->buckets = malloc(idx->nbuckets * sizeof idx->buckets[0]);
+    if (idx->buckets == NULL)
+        esh_sys_fatal_error("malloc: ");
+
+    size_t i;
+    for (i = 0; i < idx->nbuckets; i++)
+        list_init(&idx->buckets[i]);
+    idx->count = 0;
+    idx->key = key;
+}
+
+/* Double the number of buckets. */
+static void
+index_grow(struct job_index *idx)
+{
+    struct list *old = idx->buckets;
+    size_t oldn = idx->nbuckets;
+
+    idx->nbuckets = oldn * 2;
+    idx->buckets = malloc(idx->nbuckets * sizeof idx->buckets[0]);
+    if (idx->buckets == NULL) {
+        /* keep using the old, more crowded table */
+        idx->buckets = old;
+        idx->nbuckets = oldn;
+        return;
+    }
+
+    size_t i;
+    for (i = 0; i < idx->nbuckets; i++)
+        list_init(&idx->buckets[i]);
+
+    for (i = 0; i < oldn; i++) {
+        while (!list_empty(&old[i])) {
+            struct list_elem *e = list_pop_front(&old[i]);
+            list_push_back(&idx->buckets[index_hash(idx, idx->key(e))], e);
+        }
+    }
+    free(old);
+}
+
+static void
+index_insert(struct job_index *idx, struct list_elem *e)
+{
+    if (idx->count >= 2 * idx->nbuckets)
+        index_grow(idx);
+
+    list_push_back(&idx->buckets[index_hash(idx, idx->key(e))], e);
+    idx->count++;
+}
+
+static void
+index_remove(struct job_index *idx, struct list_elem *e)
+{
+    list_remove(e);
+    idx->count--;
+}
+
+static struct list_elem *
+index_find(struct job_index *idx, long key)
+{
+    struct list *bucket = &idx->buckets[index_hash(idx, key)];
+    struct list_elem *e = list_begin(bucket);
+
+    for (; e != list_end(bucket); e = list_next(e))
+        if (idx->key(e) == key)
+            return e;
+
+    return NULL;
+}
+
+/* Initialize the job table */
+void
+esh_jobs_init(void)
+{
+    list_init(&jobs_list);
+    index_init(&jid_index, jid_key);
+    index_init(&pgrp_index, pgrp_key);
+    index_init(&pid_index, pid_key);
+
+    list_init(&queued_groups);
+    list_init(&background.queue);
+    background.in_use = true;
+}
+
+/* Return the list of current jobs */
+struct list *
+esh_jobs_get_list(void)
+{
+    return &jobs_list;
+}
+
+/* Return the job id the next job should use: one more than the highest
+ * job id in use, or 1 if there are no jobs. */
+int
+esh_jobs_next_jid(void)
+{
+    if (list_empty(&jobs_list))
+        return 1;
+
+    return list_entry(list_back(&jobs_list), struct esh_pipeline, elem)->jid + 1;
+}
+
+/* Add a pipeline to the job table.  Its jid, pgrp, and the pids of
+ * all its commands must be set.  Commands whose pid is -1 could not be
+ * started and are not tracked. */
+void
+esh_jobs_add(struct esh_pipeline *pipe)
+{
+    list_push_back(&jobs_list, &pipe->elem);
+    index_insert(&jid_index, &pipe->jid_elem);
+    if (pipe->group != NULL)
+        pipe->group->njobs++;
+    esh_jobs_started(pipe);
+}
+
+/* Index the process group and processes of a job in the table */
+void
+esh_jobs_started(struct esh_pipeline *pipe)
+{
+    index_insert(&pgrp_index, &pipe->pgrp_elem);
+
+    pipe->nlive = 0;
+    struct list_elem *e = list_begin(&pipe->commands);
+    for (; e != list_end(&pipe->commands); e = list_next(e)) {
+        struct esh_command *cmd = list_entry(e, struct esh_command, elem);
+        if (cmd->pid == -1)
+            continue;
+        index_insert(&pid_index, &cmd->pid_elem);
+        pipe->nlive++;
+    }
+}
+
+/* Record that the command has been reaped.  Returns true if this was
+ * the last live command of its pipeline. */
+bool
+esh_jobs_command_reaped(struct esh_command *cmd)
+{
+    index_remove(&pid_index, &cmd->pid_elem);
+    cmd->pid = -1;
+    return --cmd->pipeline->nlive == 0;
+}
+
+/* Remove a pipeline from the job table, freeing its slot and its cache
+ * domain.  Does not free it. */
+void
+esh_jobs_remove(struct esh_pipeline *pipe)
+{
+    if (pipe->status == QUEUED) {
+        esh_jobs_unqueue(pipe);
+    } else if (pipe->pgrp != -1) {
+        /* only a job that started a process was indexed by pgrp */
+        struct list_elem *e = list_begin(&pipe->commands);
+        for (; e != list_end(&pipe->commands); e = list_next(e)) {
+            struct esh_command *cmd = list_entry(e, struct esh_command, elem);
+            if (cmd->pid != -1)
+                esh_jobs_command_reaped(cmd);
+        }
+        index_remove(&pgrp_index, &pipe->pgrp_elem);
+    }
+
+    index_remove(&jid_index, &pipe->jid_elem);
+    list_remove(&pipe->elem);
+    esh_jobs_release_slot(pipe);
+    esh_placement_release(pipe);
+
+    struct esh_job_group *group = pipe->group;
+    if (group != NULL && --group->njobs == 0 && !group->in_use)
+        free(group);
+}
+
+static struct esh_job_group *
+job_group(struct esh_pipeline *pipe)
+{
+    return pipe->group != NULL ? pipe->group : &background;
+}
+
+void
+esh_jobs_set_max(int max)
+{
+    slots_max = max;
+}
+
+int
+esh_jobs_get_max(void)
+{
+    return slots_max;
+}
+
+bool
+esh_jobs_take_slot(struct esh_pipeline *pipe)
+{
+    struct esh_job_group *group = job_group(pipe);
+
+    if ((slots_max > 0 && slots_used >= slots_max)
+            || (group->max > 0 && group->running >= group->max))
+        return false;
+
+    int token = esh_jobserver_take();
+    if (token < 0)
+        return false;
+
+    pipe->holds_token = token > 0;
+    slots_used++;
+    group->running++;
+    pipe->holds_slot = true;
+    return true;
+}
+
+void
+esh_jobs_release_slot(struct esh_pipeline *pipe)
+{
+    if (!pipe->holds_slot)
+        return;
+
+    if (pipe->holds_token)
+        esh_jobserver_put();
+    slots_used--;
+    job_group(pipe)->running--;
+    pipe->holds_slot = false;
+    pipe->holds_token = false;
+}
+
+void
+esh_jobs_queue(struct esh_pipeline *pipe)
+{
+    struct esh_job_group *group = job_group(pipe);
+
+    pipe->status = QUEUED;
+    pipe->pgrp = -1;
+    if (pipe->jid == 0)
+        pipe->jid = esh_jobs_next_jid();
+    list_push_back(&jobs_list, &pipe->elem);
+    index_insert(&jid_index, &pipe->jid_elem);
+    if (pipe->group != NULL)
+        pipe->group->njobs++;
+
+    if (list_empty(&group->queue))
+        list_push_back(&queued_groups, &group->elem);
+    list_push_back(&group->queue, &pipe->queue_elem);
+    nqueued++;
+}
+
+void
+esh_jobs_unqueue(struct esh_pipeline *pipe)
+{
+    struct esh_job_group *group = job_group(pipe);
+
+    list_remove(&pipe->queue_elem);
+    if (list_empty(&group->queue))
+        list_remove(&group->elem);
+    nqueued--;
+}
+
+struct esh_pipeline *
+esh_jobs_next_startable(void)
+{
+    struct esh_pipeline *next = NULL;
+    struct list_elem *e;
+
+    if (slots_max > 0 && slots_used >= slots_max)
+        return NULL;
+
+    for (e = list_begin(&queued_groups); e != list_end(&queued_groups);
+         e = list_next(e)) {
+        struct esh_job_group *group = list_entry(e, struct esh_job_group, elem);
+        struct esh_pipeline *first = list_entry(list_front(&group->queue),
+                                                struct esh_pipeline, queue_elem);
+
+        if ((group->max == 0 || group->running < group->max)
+                && (next == NULL || first->jid < next->jid))
+            next = first;
+    }
+
+    /* without a jobserver token, no job can start */
+    if (next == NULL || !esh_jobs_take_slot(next))
+        return NULL;
+
+    esh_jobs_unqueue(next);
+    return next;
+}
+
+int
+esh_jobs_nqueued(void)
+{
+    return nqueued;
+}
+
+struct esh_job_group *
+esh_jobs_group_create(int max)
+{
+    struct esh_job_group *group = calloc(1, sizeof *group);
+
+    if (group == NULL)
+        esh_sys_fatal_error("malloc: ");
+    group->max = max;
+    group->in_use = true;
+    list_init(&group->queue);
+    return group;
+}
+
+void
+esh_jobs_group_done(struct esh_job_group *group)
+{
+    group->in_use = false;
+    if (group->njobs == 0)
+        free(group);
+}
+
+/* Return job corresponding to jid, or NULL */
+struct esh_pipeline *
+esh_jobs_find_jid(int jid)
+{
+    struct list_elem *e = index_find(&jid_index, jid);
+    return e ? list_entry(e, struct esh_pipeline, jid_elem) : NULL;
+}
+
+/* Return job corresponding to pgrp, or NULL */
+struct esh_pipeline *
+esh_jobs_find_pgrp(pid_t pgrp)
+{
+    struct list_elem *e = index_find(&pgrp_index, pgrp);
+    return e ? list_entry(e, struct esh_pipeline, pgrp_elem) : NULL;
+}
+
+/* Return the live command corresponding to pid, or NULL */
+struct esh_command *
+esh_jobs_find_pid(pid_t pid)
+{
+    struct list_elem *e = index_find(&pid_index, pid);
+    return e ? list_entry(e, struct esh_command, pid_elem) : NULL;
+}
@@ -0,0 +1,235 @@
+/*
+ * esh-jobserver.c
+ * A GNU make jobserver shared by esh and the commands it launches.
+ *
+ * With 'jobserver N', esh creates a pipe holding N - 1 tokens and sets
+ * MAKEFLAGS to " -jN --jobserver-auth=R,W", where R and W are the ends
+ * of the pipe, which every command esh launches inherits.  A make -j,
+ * or any tool that speaks the jobserver protocol, then takes a token
+ * from the pipe for each job beyond its first and puts it back when the
+ * job ends, so that however deeply such tools nest, at most N jobs run.
+ *
+ * esh counts its own background jobs against the same pool.  Like a
+ * make, esh itself owns one implicit token, which its first background
+ * job uses; every further background job needs a token from the pipe
+ * and is QUEUED until one is available.  The shell watches the read end
+ * of the pipe only while a job waits for a token.  Foreground jobs take
+ * no token; they run on the shell's behalf, as a make runs its first
+ * job on its implicit token.
+ *
+ * Shrinking the pool takes tokens out of the pipe.  Tokens that are
+ * held at that time are kept as a debt, which tokens coming back are
+ * used to pay, whether they are put back by esh or by another tool.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "esh.h"
+
+#define TOKEN '+'
+
+static int fds[2] = { -1, -1 };     /* The pipe; read end is non-blocking */
+static int size;                    /* Tokens in the pool, implicit one
+                                       included, or 0 if there is no pool */
+static bool implicit_used;          /* A job of esh uses the implicit token */
+static int held;                    /* Tokens esh took from the pipe */
+static int debt;                    /* Tokens to remove once they are back */
+static bool wanted;                 /* A job waits for a token */
+static char *makeflags;             /* MAKEFLAGS before the pool was made,
+                                       or NULL if it was not set */
+
+/* Take up to 'n' tokens out of the pipe; returns how many there were */
+static int
+drain(int n)
+{
+    char buf[64];
+    int taken = 0;
+
+    while (taken < n) {
+        int want = n - taken < (int) sizeof buf ? n - taken : (int) sizeof buf;
+        ssize_t r = read(fds[0], buf, want);
+        if (r <= 0) {
+            if (r < 0 && errno != EAGAIN && errno != EINTR)
+                esh_sys_error("jobserver: read: ");
+            break;
+        }
+        taken += r;
+    }
+    return taken;
+}
+
+/* Put 'n' tokens into the pipe */
+static void
+fill(int n)
+{
+    char buf[64];
+
+    memset(buf, TOKEN, sizeof buf);
+    while (n > 0) {
+        ssize_t w = write(fds[1], buf, n < (int) sizeof buf ? n : (int) sizeof buf);
+        if (w < 0) {
+            if (errno == EINTR)
+                continue;
+            esh_sys_error("jobserver: write: ");
+            return;
+        }
+        n -= w;
+    }
+}
+
+static void
+export_makeflags(void)
+{
+    char *flags;
+    const char *old = makeflags != NULL ? makeflags : "";
+
+    if (asprintf(&flags, "%s -j%d --jobserver-auth=%d,%d",
+                 old, size, fds[0], fds[1]) < 0)
+        esh_sys_fatal_error("malloc: ");
+    setenv("MAKEFLAGS", flags, 1);
+    free(flags);
+}
+
+/* Remove the pool.  Fails if esh's jobs hold tokens of it. */
+static bool
+pool_destroy(void)
+{
+    if (implicit_used || held > 0) {
+        fprintf(stderr, "jobserver: background jobs hold tokens\n");
+        return false;
+    }
+
+    /* tools still running keep their own copies of the pipe */
+    close(fds[0]);
+    close(fds[1]);
+    fds[0] = fds[1] = -1;
+    size = debt = 0;
+    wanted = false;
+
+    if (makeflags != NULL)
+        setenv("MAKEFLAGS", makeflags, 1);
+    else
+        unsetenv("MAKEFLAGS");
+    free(makeflags);
+    makeflags = NULL;
+    return true;
+}
+
+bool
+esh_jobserver_set(int n)
+{
+    if (n == size)
+        return true;
+    if (n == 0)
+        return pool_destroy();
+
+    if (size == 0) {
+        /* every command inherits the ends, so they are not close-on-exec */
+        if (pipe(fds) < 0) {
+            esh_sys_error("jobserver: pipe: ");
+            return false;
+        }
+        if (fcntl(fds[0], F_SETFL, O_NONBLOCK) < 0)
+            esh_sys_fatal_error("jobserver: fcntl: ");
+
+        const char *old = getenv("MAKEFLAGS");
+        makeflags = old != NULL ? strdup(old) : NULL;
+        fill(n - 1);
+    } else if (n > size) {
+        /* new tokens pay the debt first */
+        int add = n - size;
+        int paid = add < debt ? add : debt;
+        debt -= paid;
+        fill(add - paid);
+    } else {
+        int remove = size - n;
+        debt += remove - drain(remove);
+    }
+
+    size = n;
+    export_makeflags();
+    return true;
+}
+
+int
+esh_jobserver_get(void)
+{
+    return size;
+}
+
+void
+esh_jobserver_print(void)
+{
+    if (size == 0) {
+        printf("jobserver: off\n");
+        return;
+    }
+    printf("jobserver: -j%d, %d token(s) used by esh\n", size,
+           implicit_used + held);
+    printf("MAKEFLAGS=%s\n", getenv("MAKEFLAGS"));
+}
+
+int
+esh_jobserver_take(void)
+{
+    char token;
+
+    if (size == 0)
+        return 0;
+    if (!implicit_used) {
+        implicit_used = true;
+        return 1;
+    }
+
+    ssize_t r = read(fds[0], &token, 1);
+    if (r == 1) {
+        held++;
+        return 1;
+    }
+    if (r < 0 && errno != EAGAIN && errno != EINTR)
+        esh_sys_error("jobserver: read: ");
+
+    wanted = true;
+    return -1;
+}
+
+void
+esh_jobserver_put(void)
+{
+    if (held == 0) {
+        implicit_used = false;
+    } else {
+        held--;
+        if (debt > 0)
+            debt--;
+        else
+            fill(1);
+    }
+}
+
+int
+esh_jobserver_fd(void)
+{
+    return fds[0];
+}
+
+bool
+esh_jobserver_wants_fd(void)
+{
+    return size > 0 && (wanted || debt > 0);
+}
+
+void
+esh_jobserver_readable(void)
+{
+    if (debt > 0)
+        debt -= drain(debt);
+
+    /* the jobs that wait try again, and say so if they must wait on */
+    wanted = false;
+}
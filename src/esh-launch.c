@@ -0,0 +1,414 @@
+/*
+ * esh-launch.c
+ * Start the processes that make up a pipeline.
+ *
+ * Processes are started with posix_spawn(3) rather than fork(2).  glibc
+ * implements posix_spawn with clone(CLONE_VM|CLONE_VFORK), so the cost of
+ * starting a command does not grow with the size of the shell's address
+ * space.  Everything the child used to do between fork() and exec() is
+ * expressed as spawn attributes and file actions instead:
+ *
+ *  - the process group is set with POSIX_SPAWN_SETPGROUP, so it is
+ *    in place before the new program runs,
+ *  - SIGCHLD, which the shell blocks while launching, is unblocked via
+ *    POSIX_SPAWN_SETSIGMASK, and job control signals are reset to their
+ *    default dispositions via POSIX_SPAWN_SETSIGDEF,
+ *  - I/O redirections and pipe ends become open/dup2/close file actions,
+ *    and a here-document becomes a descriptor the shell makes beforehand,
+ *    see esh-heredoc.c,
+ *  - the pipe of a process substitution is passed under the number it
+ *    has in the shell, which the /dev/fd path in argv names.
+ *
+ * Command names are resolved through the shell's path cache before
+ * anything is spawned, so a command that cannot be found is reported by
+ * the shell without starting a process, and a command that can is
+ * started by its full path with posix_spawn rather than posix_spawnp.
+ *
+ * A command of a job that has a cgroup is created in that cgroup, and
+ * one of a job that is pinned to CPUs starts on them; see esh-cgroup.c
+ * and esh-placement.c.
+ *
+ * Each started command gets a pidfd.  The shell learns about a command's
+ * exit through its pidfd and signals it through its pidfd, so neither
+ * depends on a pid that may have been reused.  This requires Linux 5.4.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/pidfd.h>
+#include <sys/wait.h>
+
+#include "esh.h"
+
+extern char **environ;
+
+/* Signals whose disposition a child must not inherit from the shell */
+static const int job_control_signals[] = {
+    SIGINT, SIGQUIT, SIGTSTP, SIGTTIN, SIGTTOU, SIGCHLD, SIGPIPE
+};
+
+/* Copy the argv of 'cmd', replacing the arguments that its process
+ * substitutions stand for by /dev/fd paths, and add file actions that
+ * pass their pipes to the child.  Returns NULL if 'cmd' has none. */
+static char **
+substitute_args(struct esh_command *cmd, posix_spawn_file_actions_t *actions)
+{
+    struct list_elem *e;
+    char **argv = NULL;
+    size_t argc = 0;
+
+    if (cmd->substitution || cmd->pipeline == NULL)
+        return NULL;
+    struct list *cmds = &cmd->pipeline->commands;
+    for (e = list_prev(&cmd->elem); e != list_rend(cmds); e = list_prev(e)) {
+        struct esh_command *sub = list_entry(e, struct esh_command, elem);
+        if (!sub->substitution)
+            break;
+        if (sub->subst_fd == -1)
+            continue;
+
+        if (argv == NULL) {
+            while (cmd->argv[argc])
+                argc++;
+            if ((argv = malloc((argc + 1) * sizeof *argv)) == NULL)
+                esh_sys_fatal_error("malloc: ");
+            memcpy(argv, cmd->argv, (argc + 1) * sizeof *argv);
+        }
+        if (asprintf(&argv[sub->subst_arg], "/dev/fd/%d", sub->subst_fd) < 0)
+            esh_sys_fatal_error("malloc: ");
+
+        /* dup2 onto itself clears close-on-exec */
+        posix_spawn_file_actions_adddup2(actions, sub->subst_fd, sub->subst_fd);
+    }
+    return argv;
+}
+
+/* Free an argv made by substitute_args */
+static void
+free_args(struct esh_command *cmd, char **argv)
+{
+    size_t i;
+
+    for (i = 0; argv[i] != NULL; i++)
+        if (argv[i] != cmd->argv[i])
+            free(argv[i]);
+    free(argv);
+}
+
+/* Start 'cmd' in process group 'pgrp', or in a new process group of
+ * its own if 'pgrp' is -1, or in the shell's process group if 'pgrp'
+ * is 0.  If 'infd' or 'outfd' are not -1, they are
+ * connected to the command's standard input and output, respectively,
+ * and closed in the child.  All other descriptors the child should not
+ * inherit must be marked close-on-exec.
+ *
+ * Sets cmd->pid and cmd->pidfd and returns the pid of the new process,
+ * or returns -1 and prints a diagnostic if the command could not be
+ * started.
+ */
+pid_t
+esh_launch_command(struct esh_command *cmd, pid_t pgrp, int infd, int outfd)
+{
+    posix_spawnattr_t attr;
+    posix_spawn_file_actions_t actions;
+    sigset_t mask;
+    pid_t pid = -1;
+    int rc;
+    unsigned int i;
+
+    double t = ESH_TRACE_START();
+    /* the relay of a fan-out redirection is the shell itself */
+    const char *path = cmd->relay ? "/proc/self/exe"
+                                  : esh_path_resolve(cmd->argv[0]);
+    ESH_TRACE_SPAN("resolve", t, cmd->argv[0]);
+    if (path == NULL) {
+        printf("%s: command not found\n", cmd->argv[0]);
+        cmd->pid = -1;
+        return -1;
+    }
+
+    int herefd = -1;
+    if (cmd->here_document != NULL
+            && (herefd = esh_heredoc_open(cmd->here_document)) < 0) {
+        cmd->pid = -1;
+        return -1;
+    }
+
+    /* a command need not be part of a pipeline, e.g. in bench/ */
+    struct esh_cgroup *cgroup = cmd->pipeline != NULL ? cmd->pipeline->cgroup
+                                                      : NULL;
+    short flags = POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF;
+
+    posix_spawnattr_init(&attr);
+    if (pgrp != 0) {
+        flags |= POSIX_SPAWN_SETPGROUP;
+        posix_spawnattr_setpgroup(&attr, pgrp == -1 ? 0 : pgrp);
+    }
+#ifdef POSIX_SPAWN_SETCGROUP
+    /* glibc 2.39 and later create the child with clone3() right in
+     * its cgroup */
+    if (cgroup != NULL) {
+        flags |= POSIX_SPAWN_SETCGROUP;
+        posix_spawnattr_setcgroup_np(&attr, esh_cgroup_fd(cgroup));
+    }
+#else
+    /* the child starts in the cgroup the shell is in at the time */
+    if (cgroup != NULL && !esh_cgroup_enter(cgroup)) {
+        esh_sys_error("cgroup: ");
+        cgroup = NULL;
+    }
+#endif
+    posix_spawnattr_setflags(&attr, flags);
+
+    struct esh_placement *placement = cmd->pipeline != NULL
+                                      ? cmd->pipeline->placement : NULL;
+    if (placement != NULL && !esh_placement_enter(placement)) {
+        esh_sys_error("sched_setaffinity: ");
+        placement = NULL;
+    }
+
+    sigemptyset(&mask);
+    posix_spawnattr_setsigmask(&attr, &mask);
+    for (i = 0; i < sizeof job_control_signals / sizeof job_control_signals[0]; i++)
+        sigaddset(&mask, job_control_signals[i]);
+    posix_spawnattr_setsigdefault(&attr, &mask);
+
+    posix_spawn_file_actions_init(&actions);
+    if (cmd->iored_input != NULL)
+        posix_spawn_file_actions_addopen(&actions, STDIN_FILENO,
+                                         cmd->iored_input, O_RDONLY, 0);
+
+    /* herefd is close-on-exec; its copy on stdin is not */
+    if (herefd != -1)
+        posix_spawn_file_actions_adddup2(&actions, herefd, STDIN_FILENO);
+
+    if (cmd->iored_output != NULL)
+        posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO,
+            cmd->iored_output,
+            O_CREAT|O_WRONLY|(cmd->append_to_output ? O_APPEND : O_TRUNC),
+            S_IRWXU);
+
+    if (infd != -1 && infd != STDIN_FILENO) {
+        posix_spawn_file_actions_adddup2(&actions, infd, STDIN_FILENO);
+        posix_spawn_file_actions_addclose(&actions, infd);
+    }
+
+    if (outfd != -1 && outfd != STDOUT_FILENO) {
+        posix_spawn_file_actions_adddup2(&actions, outfd, STDOUT_FILENO);
+        posix_spawn_file_actions_addclose(&actions, outfd);
+    }
+
+    char **argv = substitute_args(cmd, &actions);
+
+    /* posix_spawn covers creating the child, setting its process
+     * group, opening redirections and exec'ing the program */
+    t = ESH_TRACE_START();
+    clock_gettime(CLOCK_MONOTONIC, &cmd->start_time);
+    rc = posix_spawn(&pid, path, &actions, &attr,
+                     argv != NULL ? argv : cmd->argv, environ);
+    ESH_TRACE_SPAN("posix_spawn", t, path);
+#ifndef POSIX_SPAWN_SETCGROUP
+    if (cgroup != NULL)
+        esh_cgroup_leave();
+#endif
+    if (placement != NULL)
+        esh_placement_leave();
+    if (rc == ENOENT && cmd->iored_input != NULL
+            && access(cmd->iored_input, F_OK) != 0) {
+        fprintf(stderr, "%s: %s\n", cmd->iored_input, strerror(rc));
+        pid = -1;
+    } else if (rc == ENOENT) {
+        /* the executable went away without its directory changing,
+         * e.g. on a file system that does not update mtimes */
+        printf("%s: command not found\n", cmd->argv[0]);
+        esh_path_forget(cmd->argv[0]);
+        pid = -1;
+    } else if (rc != 0) {
+        fprintf(stderr, "%s: %s\n", cmd->argv[0], strerror(rc));
+        pid = -1;
+    }
+
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    if (herefd != -1)
+        close(herefd);
+    if (argv != NULL)
+        free_args(cmd, argv);
+
+    /* The child cannot have been reaped yet, so its pid is still valid */
+    cmd->pid = pid;
+    if (pid == -1)
+        return -1;
+
+    t = ESH_TRACE_START();
+    cmd->pidfd = pidfd_open(pid, 0);
+    ESH_TRACE_SPAN("pidfd_open", t, NULL);
+
+    /* e.g. EMFILE: a child the shell cannot watch must not outlive it */
+    if (cmd->pidfd < 0) {
+        esh_sys_error("pidfd_open: ");
+        kill(pid, SIGKILL);
+        while (waitpid(pid, NULL, 0) < 0 && errno == EINTR)
+            continue;
+        cmd->pid = -1;
+        return -1;
+    }
+
+    if (esh_tracing())
+        esh_trace_command_started(cmd);
+
+    return pid;
+}
+
+/* Pipe wiring.
+ *
+ * Stage i of a pipeline reads from the pipe that stage i-1 writes to.
+ * Each pipe is created with pipe2(O_CLOEXEC) right before the stage that
+ * writes to it is launched, and the shell closes its copies of both pipe
+ * ends as soon as the stage that uses them has been started.  Thus the
+ * number of stages is not limited, at most two pipes are open in the
+ * shell at any time, no pipe is created after the last stage, and a
+ * child inherits no pipe end other than its own stdin and stdout.
+ */
+
+/* Prepare wiring for a pipeline of 'nstages' commands */
+void
+esh_wiring_init(struct esh_pipe_wiring *w, int nstages)
+{
+    w->nstages = nstages;
+    w->stage = 0;
+    w->infd = -1;
+    w->outfd = -1;
+    w->nextfd = -1;
+    w->endfd = -1;
+}
+
+/* Create the pipe out of the current stage, unless it is the last one.
+ * Afterwards, w->infd and w->outfd are the descriptors to pass to
+ * esh_launch_command() for this stage. */
+void
+esh_wiring_begin_stage(struct esh_pipe_wiring *w)
+{
+    int fds[2];
+
+    if (w->stage == w->nstages - 1)
+        return;
+
+    double t = ESH_TRACE_START();
+    if (pipe2(fds, O_CLOEXEC) < 0)
+        esh_sys_fatal_error("pipe2: ");
+    ESH_TRACE_SPAN("pipe2", t, NULL);
+
+    w->nextfd = fds[0];
+    w->outfd = fds[1];
+}
+
+/* Close the shell's copies of the current stage's descriptors, each
+ * exactly once, and advance to the next stage. */
+void
+esh_wiring_end_stage(struct esh_pipe_wiring *w)
+{
+    if (w->infd != -1 && close(w->infd) < 0)
+        esh_sys_error("close: ");
+
+    if (w->outfd != -1 && close(w->outfd) < 0)
+        esh_sys_error("close: ");
+
+    w->infd = w->nextfd;
+    w->outfd = -1;
+    w->nextfd = -1;
+    w->stage++;
+}
+
+/* Process substitutions.
+ *
+ * The commands of a substitution <(...) or >(...) come right before the
+ * command whose argument it is, and are started before it, into the
+ * same process group, so that the job is controlled as a whole.  They
+ * are connected among themselves like a pipeline, and through one more
+ * pipe to that command: the stdout of the last of them writes into it
+ * for <(...), and the stdin of the first reads from it for >(...).  The
+ * other end is kept in subst_fd of the first until the command that
+ * reads or writes it has been started.
+ */
+
+int
+esh_pipeline_nstages(struct esh_pipeline *pipe)
+{
+    struct list_elem *e = list_begin(&pipe->commands);
+    int n = 0;
+
+    for (; e != list_end(&pipe->commands); e = list_next(e))
+        if (!list_entry(e, struct esh_command, elem)->substitution)
+            n++;
+    return n;
+}
+
+/* True if 'e' is a command of the same substitution as 'cmd' */
+static bool
+same_substitution(struct esh_command *cmd, struct list_elem *e)
+{
+    struct list *cmds = &cmd->pipeline->commands;
+
+    if (e == list_rend(cmds) || e == list_end(cmds))
+        return false;
+    struct esh_command *other = list_entry(e, struct esh_command, elem);
+    return other->substitution && other->subst_arg == cmd->subst_arg;
+}
+
+/* Begin a command of a process substitution.  Afterwards, w->infd and
+ * w->outfd are the descriptors to pass to esh_launch_command() for it. */
+void
+esh_subst_begin_command(struct esh_pipe_wiring *w, struct esh_command *cmd)
+{
+    if (!same_substitution(cmd, list_prev(&cmd->elem))) {
+        struct list_elem *e = &cmd->elem;
+        int n = 0, fds[2];
+
+        while (same_substitution(cmd, e)) {
+            e = list_next(e);
+            n++;
+        }
+        esh_wiring_init(w, n);
+        if (pipe2(fds, O_CLOEXEC) < 0)
+            esh_sys_fatal_error("pipe2: ");
+
+        if (cmd->substitution == '<') {
+            cmd->subst_fd = fds[0];
+            w->endfd = fds[1];
+        } else {
+            cmd->subst_fd = fds[1];
+            w->infd = fds[0];
+        }
+    }
+
+    esh_wiring_begin_stage(w);
+    if (w->stage == w->nstages - 1 && w->endfd != -1) {
+        w->outfd = w->endfd;
+        w->endfd = -1;
+    }
+}
+
+void
+esh_subst_close(struct esh_command *cmd)
+{
+    struct list *cmds = &cmd->pipeline->commands;
+    struct list_elem *e;
+
+    for (e = list_prev(&cmd->elem); e != list_rend(cmds); e = list_prev(e)) {
+        struct esh_command *sub = list_entry(e, struct esh_command, elem);
+        if (!sub->substitution)
+            break;
+        if (sub->subst_fd != -1) {
+            close(sub->subst_fd);
+            sub->subst_fd = -1;
+        }
+    }
+}
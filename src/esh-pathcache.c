@@ -0,0 +1,344 @@
+/*
+ * esh-pathcache.c
+ * Resolution of command names to executables, with a cache.
+ *
+ * execvp() searches $PATH by attempting an execve() in every directory
+ * until one succeeds, and it does so in the child, after the shell has
+ * already created it.  esh instead resolves a command name in the shell,
+ * once, and remembers the result, so that
+ *
+ *  - a command that does not exist is reported without starting a
+ *    process, and
+ *  - a command that does is started by its full path, with no search.
+ *
+ * The cache is keyed by command name.  It is flushed when the value of
+ * PATH changes, or when the modification time of any directory on PATH
+ * changes, which happens whenever an entry is created, removed or renamed
+ * in it.  The directories are checked on every lookup; that is one
+ * stat(2) per PATH component, much cheaper than the execve() attempts
+ * it replaces.
+ *
+ * Names found in a relative PATH component, such as "." or an empty
+ * component, depend on the working directory and are never cached.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "esh.h"
+
+/* A cached command */
+struct path_entry {
+    struct list_elem elem;      /* Link element for bucket list */
+    char *name;                 /* Command name, as typed */
+    char *path;                 /* Executable the name resolves to */
+    unsigned long hits;         /* Number of times name was looked up */
+};
+
+/* A directory on PATH, and its state when the cache was last valid */
+struct path_dir {
+    char *name;
+    bool exists;
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+};
+
+#define PATH_CACHE_MIN_BUCKETS 64
+
+static struct list *buckets;    /* Array of 'nbuckets' lists of path_entry */
+static size_t nbuckets;         /* Number of buckets, a power of 2 */
+static size_t count;            /* Number of cached entries */
+
+static char *cached_path;       /* Value of PATH the cache is valid for */
+static struct path_dir *dirs;   /* Components of cached_path */
+static int ndirs;
+
+/* FNV-1a */
+static size_t
+name_hash(const char *name)
+{
+    uint64_t h = UINT64_C(14695981039346656037);
+    for (; *name; name++)
+        h = (h ^ (unsigned char) *name) * UINT64_C(1099511628211);
+    return h & (nbuckets - 1);
+}
+
+static void
+buckets_init(size_t n)
+{
+    size_t i;
+
+    buckets = malloc(n * sizeof buckets[0]);
+    if (buckets == NULL)
+        esh_sys_fatal_error("malloc: ");
+    for (i = 0; i < n; i++)
+        list_init(&buckets[i]);
+    nbuckets = n;
+}
+
+/* Double the number of buckets. */
+static void
+buckets_grow(void)
+{
+    struct list *old = buckets;
+    size_t oldn = nbuckets;
+    size_t i;
+
+    buckets_init(oldn * 2);
+    for (i = 0; i < oldn; i++) {
+        while (!list_empty(&old[i])) {
+            struct list_elem *e = list_pop_front(&old[i]);
+            struct path_entry *pe = list_entry(e, struct path_entry, elem);
+            list_push_back(&buckets[name_hash(pe->name)], e);
+        }
+    }
+    free(old);
+}
+
+static struct path_entry *
+cache_find(const char *name)
+{
+    struct list *b = &buckets[name_hash(name)];
+    struct list_elem *e;
+
+    for (e = list_begin(b); e != list_end(b); e = list_next(e)) {
+        struct path_entry *pe = list_entry(e, struct path_entry, elem);
+        if (strcmp(pe->name, name) == 0)
+            return pe;
+    }
+    return NULL;
+}
+
+static void
+cache_remove(struct path_entry *pe)
+{
+    list_remove(&pe->elem);
+    count--;
+    free(pe->name);
+    free(pe->path);
+    free(pe);
+}
+
+/* The search path; the system default if PATH is not set, like execvp */
+static const char *
+search_path(void)
+{
+    static char *default_path;
+    const char *path = getenv("PATH");
+
+    if (path != NULL)
+        return path;
+
+    if (default_path == NULL) {
+        size_t len = confstr(_CS_PATH, NULL, 0);
+        default_path = malloc(len > 0 ? len : 1);
+        if (default_path == NULL)
+            esh_sys_fatal_error("malloc: ");
+        if (len == 0 || confstr(_CS_PATH, default_path, len) == 0)
+            strcpy(default_path, "");
+    }
+    return default_path;
+}
+
+/* Record the current state of directory 'd'.
+ * Returns true if it differs from the recorded one. */
+static bool
+dir_update(struct path_dir *d)
+{
+    struct stat st;
+    bool exists = stat(d->name, &st) == 0;
+    bool changed = exists != d->exists;
+
+    if (exists) {
+        changed = changed || st.st_dev != d->dev || st.st_ino != d->ino
+                || st.st_mtim.tv_sec != d->mtime.tv_sec
+                || st.st_mtim.tv_nsec != d->mtime.tv_nsec;
+        d->dev = st.st_dev;
+        d->ino = st.st_ino;
+        d->mtime = st.st_mtim;
+    }
+    d->exists = exists;
+    return changed;
+}
+
+/* Split 'path' into its components.  An empty component means ".". */
+static void
+dirs_set(const char *path)
+{
+    int i;
+
+    for (i = 0; i < ndirs; i++)
+        free(dirs[i].name);
+    free(dirs);
+    free(cached_path);
+
+    cached_path = strdup(path);
+    ndirs = 1;
+    for (i = 0; path[i]; i++)
+        if (path[i] == ':')
+            ndirs++;
+
+    dirs = calloc(ndirs, sizeof dirs[0]);
+    if (cached_path == NULL || dirs == NULL)
+        esh_sys_fatal_error("malloc: ");
+
+    const char *p = path;
+    for (i = 0; i < ndirs; i++) {
+        size_t len = strcspn(p, ":");
+        dirs[i].name = len == 0 ? strdup(".") : strndup(p, len);
+        if (dirs[i].name == NULL)
+            esh_sys_fatal_error("malloc: ");
+        dir_update(&dirs[i]);
+        p += len + (p[len] == ':');
+    }
+}
+
+/* Flush the cache if PATH or any directory on it changed. */
+static void
+cache_validate(void)
+{
+    const char *path = search_path();
+    bool changed = false;
+    int i;
+
+    if (buckets == NULL)
+        buckets_init(PATH_CACHE_MIN_BUCKETS);
+
+    if (cached_path == NULL || strcmp(cached_path, path) != 0) {
+        dirs_set(path);
+        changed = true;
+    } else {
+        /* update every directory, so that all are current afterwards */
+        for (i = 0; i < ndirs; i++)
+            if (dir_update(&dirs[i]))
+                changed = true;
+    }
+
+    if (changed)
+        esh_path_cache_clear();
+}
+
+/* Search the PATH directories for an executable regular file called
+ * 'name'.  Returns a malloc'd path or NULL; sets *cacheable to false
+ * if it was found in a relative directory. */
+static char *
+path_search(const char *name, bool *cacheable)
+{
+    size_t namelen = strlen(name);
+    int i;
+
+    for (i = 0; i < ndirs; i++) {
+        size_t dirlen = strlen(dirs[i].name);
+        char *file = malloc(dirlen + namelen + 2);
+        struct stat st;
+
+        if (file == NULL)
+            esh_sys_fatal_error("malloc: ");
+        memcpy(file, dirs[i].name, dirlen);
+        file[dirlen] = '/';
+        memcpy(file + dirlen + 1, name, namelen + 1);
+
+        if (stat(file, &st) == 0 && S_ISREG(st.st_mode)
+                && access(file, X_OK) == 0) {
+            *cacheable = dirs[i].name[0] == '/';
+            return file;
+        }
+        free(file);
+    }
+    return NULL;
+}
+
+/* Return the executable that command 'name' refers to, or NULL if
+ * there is none.  Names that contain a slash are returned unchanged.
+ * The result is valid until the next call to any esh_path_* function. */
+const char *
+esh_path_resolve(const char *name)
+{
+    static char *uncached;
+    struct path_entry *pe;
+    bool cacheable;
+
+    if (strchr(name, '/') != NULL)
+        return name;
+
+    cache_validate();
+    pe = cache_find(name);
+    if (pe != NULL) {
+        pe->hits++;
+        return pe->path;
+    }
+
+    free(uncached);
+    uncached = NULL;
+
+    char *file = path_search(name, &cacheable);
+    if (file == NULL)
+        return NULL;
+
+    if (!cacheable) {
+        uncached = file;
+        return file;
+    }
+
+    if (count >= 2 * nbuckets)
+        buckets_grow();
+
+    pe = malloc(sizeof *pe);
+    if (pe == NULL || (pe->name = strdup(name)) == NULL)
+        esh_sys_fatal_error("malloc: ");
+    pe->path = file;
+    pe->hits = 1;
+    list_push_back(&buckets[name_hash(name)], &pe->elem);
+    count++;
+    return pe->path;
+}
+
+/* Drop the cached entry for 'name', if any */
+void
+esh_path_forget(const char *name)
+{
+    struct path_entry *pe;
+
+    if (buckets != NULL && (pe = cache_find(name)) != NULL)
+        cache_remove(pe);
+}
+
+/* Drop all cached entries */
+void
+esh_path_cache_clear(void)
+{
+    size_t i;
+
+    for (i = 0; buckets != NULL && i < nbuckets; i++)
+        while (!list_empty(&buckets[i]))
+            cache_remove(list_entry(list_front(&buckets[i]),
+                                    struct path_entry, elem));
+}
+
+/* Print the cached entries with their hit counts, like bash's 'hash' */
+void
+esh_path_cache_print(void)
+{
+    size_t i;
+
+    if (buckets != NULL)
+        cache_validate();
+
+    if (count == 0) {
+        printf("hash: hash table empty\n");
+        return;
+    }
+
+    printf("hits\tcommand\n");
+    for (i = 0; i < nbuckets; i++) {
+        struct list_elem *e = list_begin(&buckets[i]);
+        for (; e != list_end(&buckets[i]); e = list_next(e)) {
+            struct path_entry *pe = list_entry(e, struct path_entry, elem);
+            printf("%4lu\t%s\n", pe->hits, pe->path);
+        }
+    }
+}
@@ -0,0 +1,346 @@
+/*
+ * esh-placement.c
+ * Placement of jobs onto CPUs that share a cache.
+ *
+ * The stages of a pipeline pass data through pipes, so a stage reads
+ * what the stage before it has just written.  If the scheduler runs
+ * them on cores with no cache in common, that data moves from one core
+ * to the other through memory.  With 'pin auto', each job is pinned to
+ * a cache domain: a set of CPUs that share an L2 or L3 cache, read from
+ * /sys/devices/system/cpu.  A job gets a domain of the smallest level
+ * that has at least as many CPUs as the job has commands, so that its
+ * stages still run in parallel, and, among those, the domain with the
+ * fewest jobs, so that jobs that run at the same time are spread over
+ * separate caches.  'pin JID cpulist' pins a job by hand.
+ *
+ * posix_spawn cannot set the affinity of the child, which inherits that
+ * of the thread that spawns it, so the shell sets its own affinity to
+ * the job's CPUs while it spawns the job's commands.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <dirent.h>
+#include <unistd.h>
+
+#include "esh.h"
+
+#define CPU_DIR "/sys/devices/system/cpu"
+
+/* A set of CPUs sharing a cache of one level */
+struct domain {
+    cpu_set_t cpus;
+    int ncpus;
+    int njobs;                  /* Jobs placed on it */
+};
+
+struct cache_level {
+    int level;
+    struct domain *domains;
+    int ndomains;
+};
+
+struct esh_placement {
+    cpu_set_t cpus;
+    struct domain *domain;      /* Chosen by 'pin auto', or NULL */
+};
+
+static bool automatic;
+static bool topology_read;
+static cpu_set_t allowed;           /* CPUs the shell may run on */
+static struct cache_level levels[] = { { .level = 2 }, { .level = 3 } };
+#define NLEVELS (int) (sizeof levels / sizeof levels[0])
+
+static cpu_set_t shell_cpus;        /* The shell's affinity while a job's
+                                       commands are spawned */
+
+/* Parse a cpulist such as "0-3,8" into 'set' */
+static bool
+cpulist_parse(const char *list, cpu_set_t *set)
+{
+    const char *p = list;
+
+    CPU_ZERO(set);
+    while (*p != '\0') {
+        char *end;
+        long lo = strtol(p, &end, 10), hi = lo;
+        if (end == p)
+            return false;
+        if (*end == '-') {
+            p = end + 1;
+            hi = strtol(p, &end, 10);
+            if (end == p)
+                return false;
+        }
+        if (lo < 0 || hi < lo || hi >= CPU_SETSIZE)
+            return false;
+        for (; lo <= hi; lo++)
+            CPU_SET(lo, set);
+
+        if (*end == ',')
+            end++;
+        else if (*end != '\0' && *end != '\n')
+            return false;
+        else
+            break;
+        p = end;
+    }
+    return CPU_COUNT(set) > 0;
+}
+
+/* Print 'set' as a cpulist */
+static void
+cpulist_print(const cpu_set_t *set)
+{
+    const char *sep = "";
+    int cpu = 0;
+
+    while (cpu < CPU_SETSIZE) {
+        if (!CPU_ISSET(cpu, set)) {
+            cpu++;
+            continue;
+        }
+        int last = cpu;
+        while (last + 1 < CPU_SETSIZE && CPU_ISSET(last + 1, set))
+            last++;
+        if (last == cpu)
+            printf("%s%d", sep, cpu);
+        else
+            printf("%s%d-%d", sep, cpu, last);
+        sep = ",";
+        cpu = last + 1;
+    }
+}
+
+/* Add the cache of 'cpu' described in directory 'index' to its level */
+static void
+add_cache(int cpu, const char *index)
+{
+    char path[512], buf[256];
+    int level, i, l;
+    FILE *f;
+    cpu_set_t set;
+
+    snprintf(path, sizeof path, CPU_DIR "/cpu%d/cache/%s/level", cpu, index);
+    if ((f = fopen(path, "re")) == NULL)
+        return;
+    if (fscanf(f, "%d", &level) != 1)
+        level = 0;
+    fclose(f);
+
+    for (l = 0; l < NLEVELS && levels[l].level != level; l++)
+        continue;
+    if (l == NLEVELS)
+        return;
+
+    snprintf(path, sizeof path, CPU_DIR "/cpu%d/cache/%s/shared_cpu_list",
+             cpu, index);
+    if ((f = fopen(path, "re")) == NULL)
+        return;
+    bool ok = fgets(buf, sizeof buf, f) != NULL && cpulist_parse(buf, &set);
+    fclose(f);
+    if (!ok)
+        return;
+
+    CPU_AND(&set, &set, &allowed);
+    if (CPU_COUNT(&set) == 0)
+        return;
+
+    struct cache_level *cl = &levels[l];
+    for (i = 0; i < cl->ndomains; i++)
+        if (CPU_EQUAL(&cl->domains[i].cpus, &set))
+            return;
+
+    cl->domains = realloc(cl->domains, (cl->ndomains + 1) * sizeof cl->domains[0]);
+    if (cl->domains == NULL)
+        esh_sys_fatal_error("malloc: ");
+    cl->domains[cl->ndomains].cpus = set;
+    cl->domains[cl->ndomains].ncpus = CPU_COUNT(&set);
+    cl->domains[cl->ndomains].njobs = 0;
+    cl->ndomains++;
+}
+
+/* Read the cache domains of the CPUs the shell may run on */
+static void
+read_topology(void)
+{
+    char path[64];
+    int cpu;
+
+    if (topology_read)
+        return;
+    topology_read = true;
+    if (sched_getaffinity(0, sizeof allowed, &allowed) < 0)
+        return;
+
+    for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (!CPU_ISSET(cpu, &allowed))
+            continue;
+
+        snprintf(path, sizeof path, CPU_DIR "/cpu%d/cache", cpu);
+        DIR *dp = opendir(path);
+        struct dirent *d;
+        while (dp != NULL && (d = readdir(dp)) != NULL)
+            if (strncmp(d->d_name, "index", 5) == 0)
+                add_cache(cpu, d->d_name);
+        if (dp != NULL)
+            closedir(dp);
+    }
+}
+
+void
+esh_placement_set_auto(bool on)
+{
+    automatic = on;
+    if (on)
+        read_topology();
+}
+
+bool
+esh_placement_get_auto(void)
+{
+    return automatic;
+}
+
+static struct esh_placement *
+placement_create(struct esh_pipeline *pipe)
+{
+    if (pipe->placement == NULL) {
+        pipe->placement = calloc(1, sizeof *pipe->placement);
+        if (pipe->placement == NULL)
+            esh_sys_fatal_error("malloc: ");
+    }
+    return pipe->placement;
+}
+
+void
+esh_placement_assign(struct esh_pipeline *pipe)
+{
+    int ncmds = list_size(&pipe->commands), l, i;
+
+    if (!automatic || pipe->placement != NULL)
+        return;
+
+    for (l = 0; l < NLEVELS; l++) {
+        struct cache_level *cl = &levels[l];
+        struct domain *best = NULL;
+
+        for (i = 0; i < cl->ndomains; i++) {
+            struct domain *d = &cl->domains[i];
+            if (d->ncpus >= ncmds && (best == NULL || d->njobs < best->njobs))
+                best = d;
+        }
+        if (best == NULL)
+            continue;
+
+        /* a domain of all CPUs would not change anything */
+        if (CPU_EQUAL(&best->cpus, &allowed))
+            return;
+
+        struct esh_placement *p = placement_create(pipe);
+        p->cpus = best->cpus;
+        p->domain = best;
+        best->njobs++;
+        return;
+    }
+}
+
+/* Set the affinity of every thread of process 'pid' */
+static void
+pin_process(pid_t pid, const cpu_set_t *cpus)
+{
+    char path[64];
+
+    snprintf(path, sizeof path, "/proc/%d/task", pid);
+    DIR *dp = opendir(path);
+    struct dirent *d;
+    while (dp != NULL && (d = readdir(dp)) != NULL) {
+        pid_t tid = atoi(d->d_name);
+        if (tid > 0 && sched_setaffinity(tid, sizeof *cpus, cpus) < 0
+                && errno != ESRCH)
+            esh_sys_error("pin: %d: ", tid);
+    }
+    if (dp != NULL)
+        closedir(dp);
+}
+
+bool
+esh_placement_pin(struct esh_pipeline *pipe, const char *cpulist)
+{
+    cpu_set_t cpus;
+
+    if (!cpulist_parse(cpulist, &cpus)) {
+        printf("pin: invalid cpulist %s\n", cpulist);
+        return false;
+    }
+
+    esh_placement_release(pipe);
+    struct esh_placement *p = placement_create(pipe);
+    p->cpus = cpus;
+
+    /* processes the commands started themselves keep their CPUs */
+    struct list_elem *e = list_begin(&pipe->commands);
+    for (; e != list_end(&pipe->commands); e = list_next(e)) {
+        struct esh_command *cmd = list_entry(e, struct esh_command, elem);
+        if (cmd->pid != -1 && cmd->pidfd != -1)
+            pin_process(cmd->pid, &cpus);
+    }
+    return true;
+}
+
+void
+esh_placement_release(struct esh_pipeline *pipe)
+{
+    if (pipe->placement == NULL)
+        return;
+    if (pipe->placement->domain != NULL)
+        pipe->placement->domain->njobs--;
+    free(pipe->placement);
+    pipe->placement = NULL;
+}
+
+bool
+esh_placement_enter(struct esh_placement *p)
+{
+    if (sched_getaffinity(0, sizeof shell_cpus, &shell_cpus) < 0)
+        return false;
+    return sched_setaffinity(0, sizeof p->cpus, &p->cpus) == 0;
+}
+
+void
+esh_placement_leave(void)
+{
+    if (sched_setaffinity(0, sizeof shell_cpus, &shell_cpus) < 0)
+        esh_sys_error("sched_setaffinity: ");
+}
+
+void
+esh_placement_print(void)
+{
+    int l, i;
+
+    printf("pin: %s\n", automatic ? "auto" : "off");
+    read_topology();
+    for (l = 0; l < NLEVELS; l++) {
+        for (i = 0; i < levels[l].ndomains; i++) {
+            struct domain *d = &levels[l].domains[i];
+            printf("L%d ", levels[l].level);
+            cpulist_print(&d->cpus);
+            printf(": %d job(s)\n", d->njobs);
+        }
+    }
+
+    struct list *jobs = esh_jobs_get_list();
+    struct list_elem *e = list_begin(jobs);
+    for (; e != list_end(jobs); e = list_next(e)) {
+        struct esh_pipeline *job = list_entry(e, struct esh_pipeline, elem);
+        if (job->placement == NULL)
+            continue;
+        printf("[%d] ", job->jid);
+        cpulist_print(&job->placement->cpus);
+        printf("\n");
+    }
+}
@@ -0,0 +1,251 @@
+/*
+ * esh-plugin-cache.c
+ * The plugin manifest cache.
+ *
+ * Opening every plugin of a directory with dlopen() at startup costs
+ * time proportional to the number of plugins, most of which a session
+ * may never use.  The first time esh loads a plugin directory it
+ * records in a manifest what it learned about each plugin: its rank,
+ * the hooks it implements and the builtins it declares.  Later runs
+ * read the manifest instead, and open a plugin only once one of its
+ * hooks or builtins is needed.
+ *
+ * Manifests live in $XDG_CACHE_HOME/esh, or ~/.cache/esh, one per
+ * plugin directory, named after a hash of the directory's absolute
+ * path.  A manifest is used only if the modification time of the
+ * directory, and the modification time and size of every plugin in it,
+ * are those it recorded; otherwise the directory is loaded as if there
+ * were no manifest, and the manifest is written again.
+ *
+ * A manifest is a text file:
+ *
+ *   esh-plugin-manifest 1 <dir mtime sec> <dir mtime nsec> <count>
+ *   <file> <mtime sec> <mtime nsec> <size> <rank> <hooks> <eager> [builtin ...]
+ *   ...
+ *
+ * where <hooks> has bit (1 << h) set for each enum esh_plugin_hook h the
+ * plugin implements, and <eager> is 1 for plugins that must be loaded
+ * at startup.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "esh.h"
+
+#define MANIFEST_MAGIC "esh-plugin-manifest"
+#define MANIFEST_VERSION 1
+
+/* FNV-1a */
+static uint64_t
+path_hash(const char *s)
+{
+    uint64_t h = UINT64_C(14695981039346656037);
+    for (; *s; s++)
+        h = (h ^ (unsigned char) *s) * UINT64_C(1099511628211);
+    return h;
+}
+
+/* Name of the manifest of directory 'dirname' in 'buf'.  If 'create',
+ * the cache directory is created if needed.  Returns false if there is
+ * no place for manifests. */
+static bool
+manifest_path(const char *dirname, char *buf, size_t size, bool create)
+{
+    char dir[PATH_MAX], cachedir[PATH_MAX];
+    const char *xdg = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    int n;
+
+    if (realpath(dirname, dir) == NULL)
+        return false;
+
+    if (xdg != NULL && xdg[0] == '/')
+        n = snprintf(cachedir, sizeof cachedir, "%s/esh", xdg);
+    else if (home != NULL && home[0] == '/')
+        n = snprintf(cachedir, sizeof cachedir, "%s/.cache/esh", home);
+    else
+        return false;
+    if (n >= (int) sizeof cachedir)
+        return false;
+
+    if (create) {
+        /* create the parent (~/.cache) first, if needed */
+        char *slash = strrchr(cachedir, '/');
+        *slash = '\0';
+        if (mkdir(cachedir, 0700) < 0 && errno != EEXIST)
+            return false;
+        *slash = '/';
+        if (mkdir(cachedir, 0700) < 0 && errno != EEXIST)
+            return false;
+    }
+
+    n = snprintf(buf, size, "%s/plugins-%016llx", cachedir,
+                 (unsigned long long) path_hash(dir));
+    return n < (int) size;
+}
+
+static bool
+same_time(struct timespec a, struct timespec b)
+{
+    return a.tv_sec == b.tv_sec && a.tv_nsec == b.tv_nsec;
+}
+
+/* Parse one plugin line of a manifest into 'info' */
+static bool
+parse_plugin(char *line, struct esh_plugin_info *info)
+{
+    char *save, *word;
+    char *fields[7];
+    int i, nbuiltins = 0;
+
+    for (i = 0; i < 7; i++) {
+        fields[i] = strtok_r(i == 0 ? line : NULL, " \n", &save);
+        if (fields[i] == NULL)
+            return false;
+    }
+
+    info->file = strdup(fields[0]);
+    info->mtime.tv_sec = strtoll(fields[1], NULL, 10);
+    info->mtime.tv_nsec = strtol(fields[2], NULL, 10);
+    info->size = strtoll(fields[3], NULL, 10);
+    info->rank = atoi(fields[4]);
+    info->hooks = strtoul(fields[5], NULL, 10);
+    info->eager = atoi(fields[6]) != 0;
+
+    /* the remaining words are builtin names */
+    info->builtins = NULL;
+    while ((word = strtok_r(NULL, " \n", &save)) != NULL) {
+        info->builtins = realloc(info->builtins,
+                                 (nbuiltins + 2) * sizeof info->builtins[0]);
+        if (info->builtins == NULL || (word = strdup(word)) == NULL)
+            esh_sys_fatal_error("malloc: ");
+        info->builtins[nbuiltins++] = word;
+        info->builtins[nbuiltins] = NULL;
+    }
+    return info->file != NULL;
+}
+
+/* Read the manifest of plugin directory 'dirname'.  Returns NULL if
+ * there is none, or if it no longer describes the directory. */
+struct esh_plugin_manifest *
+esh_plugin_manifest_read(const char *dirname)
+{
+    char path[PATH_MAX], file[PATH_MAX];
+    char *line = NULL;
+    size_t linesize = 0;
+    struct stat st;
+    long long sec;
+    long nsec;
+    int version, count;
+    FILE *f;
+
+    if (!manifest_path(dirname, path, sizeof path, false)
+            || (f = fopen(path, "re")) == NULL)
+        return NULL;
+
+    struct esh_plugin_manifest *m = calloc(1, sizeof *m);
+    if (m == NULL)
+        esh_sys_fatal_error("malloc: ");
+
+    if (fscanf(f, MANIFEST_MAGIC " %d %lld %ld %d\n",
+               &version, &sec, &nsec, &count) != 4
+            || version != MANIFEST_VERSION || count < 0
+            || stat(dirname, &st) < 0
+            || st.st_mtim.tv_sec != sec || st.st_mtim.tv_nsec != nsec)
+        goto stale;
+
+    m->plugins = calloc(count ? count : 1, sizeof m->plugins[0]);
+    if (m->plugins == NULL)
+        esh_sys_fatal_error("malloc: ");
+
+    while (m->count < count) {
+        struct esh_plugin_info *info = &m->plugins[m->count++];
+
+        if (getline(&line, &linesize, f) < 0 || !parse_plugin(line, info))
+            goto stale;
+
+        snprintf(file, sizeof file, "%s/%s", dirname, info->file);
+        if (stat(file, &st) < 0 || !same_time(st.st_mtim, info->mtime)
+                || st.st_size != info->size)
+            goto stale;
+    }
+    free(line);
+    fclose(f);
+    return m;
+
+stale:
+    free(line);
+    fclose(f);
+    esh_plugin_manifest_free(m);
+    return NULL;
+}
+
+/* Write 'm' as the manifest of plugin directory 'dirname', whose
+ * modification time when it was read was 'dir_mtime'.  Failure to write
+ * it is not an error; the directory is then loaded fully next time. */
+void
+esh_plugin_manifest_write(const char *dirname, struct timespec dir_mtime,
+                          struct esh_plugin_manifest *m)
+{
+    char path[PATH_MAX], tmp[PATH_MAX + 32];
+    int i;
+
+    if (!manifest_path(dirname, path, sizeof path, true))
+        return;
+
+    /* names must not contain the separators of the format */
+    for (i = 0; i < m->count; i++) {
+        char **b = m->plugins[i].builtins;
+        if (strpbrk(m->plugins[i].file, " \n") != NULL)
+            return;
+        for (; b && *b; b++)
+            if (strpbrk(*b, " \n") != NULL || **b == '\0')
+                return;
+    }
+
+    /* write a new file and rename it, so that a shell starting at the
+     * same time never reads a partial manifest */
+    snprintf(tmp, sizeof tmp, "%s.%d", path, getpid());
+    FILE *f = fopen(tmp, "we");
+    if (f == NULL)
+        return;
+
+    fprintf(f, MANIFEST_MAGIC " %d %lld %ld %d\n", MANIFEST_VERSION,
+            (long long) dir_mtime.tv_sec, dir_mtime.tv_nsec, m->count);
+    for (i = 0; i < m->count; i++) {
+        struct esh_plugin_info *info = &m->plugins[i];
+        char **b = info->builtins;
+
+        fprintf(f, "%s %lld %ld %lld %d %u %d", info->file,
+                (long long) info->mtime.tv_sec, info->mtime.tv_nsec,
+                (long long) info->size, info->rank, info->hooks, info->eager);
+        for (; b && *b; b++)
+            fprintf(f, " %s", *b);
+        fputc('\n', f);
+    }
+
+    if (fclose(f) != 0 || rename(tmp, path) < 0)
+        unlink(tmp);
+}
+
+void
+esh_plugin_manifest_free(struct esh_plugin_manifest *m)
+{
+    int i;
+
+    for (i = 0; i < m->count; i++) {
+        char **b = m->plugins[i].builtins;
+        for (; b && *b; b++)
+            free(*b);
+        free(m->plugins[i].builtins);
+        free(m->plugins[i].file);
+    }
+    free(m->plugins);
+    free(m);
+}
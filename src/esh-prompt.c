@@ -0,0 +1,482 @@
+/*
+ * esh-prompt.c
+ * Composition of the prompt from the fragments plugins make.
+ *
+ * The prompt is made again every time it is shown.  A plugin whose
+ * fragment is costly to make, or rarely changes, can say through its
+ * prompt_events field after which events the fragment must be made
+ * again; until one happens, the fragment kept from the last call of its
+ * make_prompt is reused.  The shell raises ESH_PROMPT_JOBS and
+ * ESH_PROMPT_COMMAND, notices ESH_PROMPT_CWD itself, and plugins raise
+ * events of their own through the shell object's invalidate_prompt.
+ *
+ * A plugin whose fragment may take long to make, such as the status of
+ * a version control repository, sets prompt_deadline.  Its make_prompt
+ * then runs on a thread of its own, and the shell waits for it only
+ * until the deadline.  A fragment that misses it is shown as it was
+ * last made, or as a placeholder; when it is ready, the thread signals
+ * esh_prompt_notify_fd(), and the shell redraws the prompt with
+ * esh_prompt_refresh().
+ *
+ * Fragments are appended to one buffer that is kept from prompt to
+ * prompt, so a prompt costs no allocation once the buffer is large
+ * enough, and time linear in its length.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+
+#include "esh.h"
+
+#define STRBUF_MIN_SIZE 64
+#define PROMPT_SIZE 256
+#define DEFAULT_PLACEHOLDER "..."
+
+void
+esh_strbuf_init(struct esh_strbuf *sb, size_t size)
+{
+    sb->size = size < STRBUF_MIN_SIZE ? STRBUF_MIN_SIZE : size;
+    sb->buf = malloc(sb->size);
+    if (sb->buf == NULL)
+        esh_sys_fatal_error("malloc: ");
+    sb->buf[0] = '\0';
+    sb->len = 0;
+}
+
+/* Append the 'len' bytes at 's' */
+void
+esh_strbuf_append(struct esh_strbuf *sb, const char *s, size_t len)
+{
+    if (sb->len + len + 1 > sb->size) {
+        while (sb->len + len + 1 > sb->size)
+            sb->size *= 2;
+        sb->buf = realloc(sb->buf, sb->size);
+        if (sb->buf == NULL)
+            esh_sys_fatal_error("malloc: ");
+    }
+    memcpy(sb->buf + sb->len, s, len);
+    sb->len += len;
+    sb->buf[sb->len] = '\0';
+}
+
+/* Make 'sb' empty, keeping its memory */
+void
+esh_strbuf_clear(struct esh_strbuf *sb)
+{
+    sb->len = 0;
+    sb->buf[0] = '\0';
+}
+
+void
+esh_strbuf_free(struct esh_strbuf *sb)
+{
+    free(sb->buf);
+    sb->buf = NULL;
+    sb->len = sb->size = 0;
+}
+
+/* What is kept of the fragment of one plugin */
+struct fragment {
+    struct esh_plugin *plugin;
+    unsigned events;            /* Its prompt_events, or 0 */
+    unsigned max_age;           /* Its prompt_max_age, or 0 */
+    unsigned deadline;          /* Its prompt_deadline, or 0 */
+    const char *placeholder;
+    bool valid;                 /* 'text' may be reused */
+    bool has_text;              /* 'text' was made at least once */
+    double made;                /* When 'text' was made, in ms */
+    struct esh_strbuf text;
+
+    /* A fragment with a deadline is made by 'thread', which is started
+     * when it is first needed.  These fields are guarded by 'lock'. */
+    bool started;
+    pthread_t thread;
+    pthread_cond_t wake;        /* Signaled when requested or quit is set */
+    bool requested;             /* make_prompt is to be called (again) */
+    bool busy;                  /* It was requested and has not returned */
+    bool quit;                  /* The fragment is no longer used */
+    bool ready;                 /* 'result' was made and not taken yet */
+    char *result;
+};
+
+static struct fragment **fragments; /* Of the plugins, in rank order */
+static size_t nfragments;
+static unsigned generation;         /* Of the hook tables 'fragments' is for */
+static unsigned watched;            /* Union of the fragments' events */
+static unsigned pending;            /* Events since the last prompt */
+static struct esh_strbuf prompt;
+
+static struct stat cwd;             /* The working directory, when the
+                                       last prompt was made */
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t made;         /* Broadcast when a fragment is ready */
+static int notify_fd = -1;          /* eventfd written when one is */
+
+static double
+now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static void
+async_init(void)
+{
+    pthread_condattr_t attr;
+
+    if (notify_fd != -1)
+        return;
+    if ((notify_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+        esh_sys_fatal_error("eventfd: ");
+
+    /* deadlines are on the clock now_ms() reads */
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&made, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+int
+esh_prompt_notify_fd(void)
+{
+    async_init();
+    return notify_fd;
+}
+
+static void
+fragment_free(struct fragment *f)
+{
+    if (f->deadline)
+        pthread_cond_destroy(&f->wake);
+    free(f->result);
+    esh_strbuf_free(&f->text);
+    free(f);
+}
+
+/* The thread of fragment 'f': call make_prompt whenever asked to */
+static void *
+fragment_thread(void *arg)
+{
+    struct fragment *f = arg;
+    uint64_t one = 1;
+
+    pthread_mutex_lock(&lock);
+    for (;;) {
+        while (!f->requested && !f->quit)
+            pthread_cond_wait(&f->wake, &lock);
+        if (f->quit)
+            break;
+        f->requested = false;
+
+        pthread_mutex_unlock(&lock);
+        char *p = f->plugin->make_prompt();
+        pthread_mutex_lock(&lock);
+
+        free(f->result);
+        f->result = p;
+        f->ready = true;
+        f->busy = f->requested;
+        pthread_cond_broadcast(&made);
+        if (write(notify_fd, &one, sizeof one) < 0)
+            ;   /* the counter is full, so the shell will look anyway */
+    }
+    pthread_mutex_unlock(&lock);
+    fragment_free(f);
+    return NULL;
+}
+
+/* Ask the thread of 'f' to make it.  Unless 'again', a call that is
+ * under way is not followed by another. */
+static void
+fragment_request(struct fragment *f, bool again)
+{
+    pthread_mutex_lock(&lock);
+    if (!f->started) {
+        /* signals are for the main thread, which readline and the
+         * signalfd of the shell expect */
+        sigset_t all, old;
+        sigfillset(&all);
+        pthread_sigmask(SIG_SETMASK, &all, &old);
+        int rc = pthread_create(&f->thread, NULL, fragment_thread, f);
+        pthread_sigmask(SIG_SETMASK, &old, NULL);
+        if (rc != 0) {
+            errno = rc;
+            esh_sys_fatal_error("pthread_create: ");
+        }
+        pthread_detach(f->thread);
+        f->started = true;
+    }
+    if (!f->busy || again) {
+        f->requested = f->busy = true;
+        pthread_cond_signal(&f->wake);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+/* Stop using fragment 'f'; its thread, if it has one, frees it */
+static void
+fragment_drop(struct fragment *f)
+{
+    pthread_mutex_lock(&lock);
+    bool started = f->started;
+    f->quit = true;
+    if (started)
+        pthread_cond_signal(&f->wake);
+    pthread_mutex_unlock(&lock);
+
+    if (!started)
+        fragment_free(f);
+}
+
+static struct fragment *
+fragment_create(struct esh_plugin *plugin)
+{
+    struct fragment *f = calloc(1, sizeof *f);
+    if (f == NULL)
+        esh_sys_fatal_error("malloc: ");
+
+    f->plugin = plugin;
+    if (ESH_PLUGIN_HAS(plugin, prompt_placeholder)) {
+        f->deadline = plugin->prompt_deadline;
+        f->placeholder = plugin->prompt_placeholder;
+    }
+    if (f->placeholder == NULL)
+        f->placeholder = DEFAULT_PLACEHOLDER;
+    if (f->deadline) {
+        async_init();
+        pthread_cond_init(&f->wake, NULL);
+    }
+    esh_strbuf_init(&f->text, 0);
+    return f;
+}
+
+/* Set up a fragment for each plugin that implements make_prompt, after
+ * the hook tables changed.  Fragments of plugins that are still loaded
+ * are kept. */
+static void
+fragments_update(void)
+{
+    size_t n = 0, old;
+    struct list_elem *e;
+
+    for (e = list_begin(&esh_plugin_list); e != list_end(&esh_plugin_list);
+         e = list_next(e))
+        n += list_entry(e, struct esh_plugin, elem)->make_prompt != NULL;
+
+    struct fragment **f = calloc(n ? n : 1, sizeof *f);
+    if (f == NULL)
+        esh_sys_fatal_error("malloc: ");
+
+    n = 0;
+    watched = 0;
+    for (e = list_begin(&esh_plugin_list); e != list_end(&esh_plugin_list);
+         e = list_next(e)) {
+        struct esh_plugin *plugin = list_entry(e, struct esh_plugin, elem);
+        if (plugin->make_prompt == NULL)
+            continue;
+
+        for (old = 0; old < nfragments; old++)
+            if (fragments[old] != NULL && fragments[old]->plugin == plugin)
+                break;
+
+        if (old < nfragments) {
+            f[n] = fragments[old];
+            fragments[old] = NULL;
+        } else {
+            f[n] = fragment_create(plugin);
+        }
+
+        /* plugins may set these in init() */
+        unsigned events = 0, max_age = 0;
+        if (ESH_PLUGIN_HAS(plugin, prompt_max_age)) {
+            events = plugin->prompt_events;
+            max_age = plugin->prompt_max_age;
+        }
+        f[n]->valid &= f[n]->events == events && f[n]->max_age == max_age;
+        f[n]->events = events;
+        f[n]->max_age = max_age;
+        watched |= events;
+        n++;
+    }
+
+    for (old = 0; old < nfragments; old++)
+        if (fragments[old] != NULL)
+            fragment_drop(fragments[old]);
+    free(fragments);
+    fragments = f;
+    nfragments = n;
+    generation = esh_plugin_hooks.generation;
+}
+
+/* Has the working directory changed since the last prompt? */
+static bool
+cwd_changed(void)
+{
+    struct stat st;
+
+    if (stat(".", &st) < 0
+            || (st.st_dev == cwd.st_dev && st.st_ino == cwd.st_ino))
+        return false;
+    cwd = st;
+    return true;
+}
+
+/* Must 'f' be made again, after 'events'? */
+static bool
+fragment_stale(struct fragment *f, unsigned events, double now)
+{
+    return !f->valid || (f->events & events)
+        || (f->max_age && now - f->made >= f->max_age);
+}
+
+/* Keep 'p', which make_prompt of 'f' returned at time 'now' */
+static void
+fragment_set(struct fragment *f, char *p, double now)
+{
+    esh_strbuf_clear(&f->text);
+    if (p != NULL)
+        esh_strbuf_append(&f->text, p, strlen(p));
+    free(p);
+    f->made = now;
+    f->has_text = true;
+    f->valid = f->events != 0 || f->max_age != 0;
+}
+
+/* Take the fragments that threads made.  Returns how many there were. */
+static int
+fragments_take(void)
+{
+    double now = now_ms();
+    int taken = 0;
+    size_t i;
+
+    pthread_mutex_lock(&lock);
+    for (i = 0; i < nfragments; i++) {
+        struct fragment *f = fragments[i];
+        if (f->ready) {
+            fragment_set(f, f->result, now);
+            f->result = NULL;
+            f->ready = false;
+            taken++;
+        }
+    }
+    pthread_mutex_unlock(&lock);
+    return taken;
+}
+
+/* Wait for the fragments that threads are making, each until its
+ * deadline, counted from 'start' */
+static void
+fragments_wait(double start)
+{
+    size_t i;
+
+    pthread_mutex_lock(&lock);
+    for (i = 0; i < nfragments; i++) {
+        struct fragment *f = fragments[i];
+        double until = start + f->deadline;
+        struct timespec ts = {
+            .tv_sec = until / 1e3,
+            .tv_nsec = (until - (long long) (until / 1e3) * 1e3) * 1e6
+        };
+
+        while (f->deadline && f->busy && !f->ready)
+            if (pthread_cond_timedwait(&made, &lock, &ts) == ETIMEDOUT)
+                break;
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+/* Put the prompt together from the fragments as they are */
+static void
+prompt_assemble(void)
+{
+    size_t i;
+
+    if (prompt.buf == NULL)
+        esh_strbuf_init(&prompt, PROMPT_SIZE);
+    esh_strbuf_clear(&prompt);
+
+    for (i = 0; i < nfragments; i++) {
+        struct fragment *f = fragments[i];
+        if (f->has_text)
+            esh_strbuf_append(&prompt, f->text.buf, f->text.len);
+        else
+            esh_strbuf_append(&prompt, f->placeholder, strlen(f->placeholder));
+    }
+
+    /* default prompt */
+    if (nfragments == 0)
+        esh_strbuf_append(&prompt, "esh> ", 5);
+}
+
+const char *
+esh_prompt_compose(void)
+{
+    double t = ESH_TRACE_START();
+    bool async = false;
+    size_t i;
+
+    esh_plugin_load_hook(ESH_HOOK_MAKE_PROMPT);
+    if (fragments == NULL || generation != esh_plugin_hooks.generation)
+        fragments_update();
+
+    unsigned events = pending;
+    pending = 0;
+    if ((watched & ESH_PROMPT_CWD) && cwd_changed())
+        events |= ESH_PROMPT_CWD;
+
+    /* fragments made by threads are started first, so that they are
+     * made while the others are */
+    double now = now_ms();
+    for (i = 0; i < nfragments; i++) {
+        struct fragment *f = fragments[i];
+        if (f->deadline && fragment_stale(f, events, now)) {
+            fragment_request(f, (f->events & events) != 0);
+            async = true;
+        }
+    }
+    for (i = 0; i < nfragments; i++) {
+        struct fragment *f = fragments[i];
+        if (!f->deadline && fragment_stale(f, events, now))
+            fragment_set(f, f->plugin->make_prompt(), now);
+    }
+
+    if (async)
+        fragments_wait(now);
+    fragments_take();
+    prompt_assemble();
+
+    ESH_TRACE_SPAN("prompt", t, NULL);
+    return prompt.buf;
+}
+
+const char *
+esh_prompt_refresh(void)
+{
+    uint64_t count;
+
+    if (notify_fd != -1 && read(notify_fd, &count, sizeof count) < 0
+            && errno != EAGAIN)
+        esh_sys_error("eventfd: ");
+    if (nfragments == 0 || fragments_take() == 0)
+        return NULL;
+
+    prompt_assemble();
+    return prompt.buf;
+}
+
+void
+esh_prompt_invalidate(unsigned events)
+{
+    pending |= events;
+}
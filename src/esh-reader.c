@@ -0,0 +1,131 @@
+/*
+ * esh-reader.c
+ * Buffered line input for non-interactive shells.
+ *
+ * When esh runs a script, or reads commands from a file or pipe, it does
+ * not need readline's line editing.  A reader fills a large buffer with
+ * read(2) and hands out lines from it, so that thousands of lines cost
+ * only a few system calls.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+#include "esh.h"
+
+#define ESH_READER_BUFSIZE (64 * 1024)
+
+/* Create a reader for file descriptor 'fd' */
+struct esh_reader *
+esh_reader_create(int fd)
+{
+    struct esh_reader *r = malloc(sizeof *r);
+
+    if (r == NULL || (r->buf = malloc(ESH_READER_BUFSIZE)) == NULL)
+        esh_sys_fatal_error("malloc: ");
+    r->fd = fd;
+    r->size = ESH_READER_BUFSIZE;
+    r->pos = 0;
+    r->len = 0;
+    r->eof = false;
+    return r;
+}
+
+/* Read more input after the unconsumed part of the buffer, which is
+ * first moved to the front, growing the buffer if it is full.
+ * Returns false at end of file or on error. */
+static bool
+reader_fill(struct esh_reader *r)
+{
+    ssize_t n;
+
+    if (r->pos > 0) {
+        memmove(r->buf, r->buf + r->pos, r->len - r->pos);
+        r->len -= r->pos;
+        r->pos = 0;
+    }
+
+    /* keep room for the terminating NUL of a last line without newline */
+    if (r->len + 1 >= r->size) {
+        char *buf = realloc(r->buf, r->size * 2);
+        if (buf == NULL)
+            esh_sys_fatal_error("realloc: ");
+        r->buf = buf;
+        r->size *= 2;
+    }
+
+    do
+        n = read(r->fd, r->buf + r->len, r->size - r->len - 1);
+    while (n < 0 && errno == EINTR);
+
+    if (n < 0)
+        esh_sys_error("read: ");
+    if (n <= 0) {
+        r->eof = true;
+        return false;
+    }
+    r->len += n;
+    return true;
+}
+
+/* Return the next line without its newline, or NULL at end of input.
+ * The line is stored in the reader's buffer and remains valid until the
+ * next call. */
+char *
+esh_reader_getline(struct esh_reader *r)
+{
+    size_t scanned = r->pos;
+
+    for (;;) {
+        char *nl = memchr(r->buf + scanned, '\n', r->len - scanned);
+        if (nl != NULL) {
+            char *line = r->buf + r->pos;
+            *nl = '\0';
+            r->pos = nl - r->buf + 1;
+            return line;
+        }
+
+        /* no newline in what is buffered; only new input must be
+         * searched, which starts where the buffered input ends once
+         * reader_fill() has moved it to the front */
+        size_t buffered = r->len - r->pos;
+        if (r->eof || !reader_fill(r)) {
+            if (r->pos == r->len)
+                return NULL;
+
+            /* last line has no newline */
+            char *line = r->buf + r->pos;
+            r->buf[r->len] = '\0';
+            r->pos = r->len;
+            return line;
+        }
+        scanned = buffered;
+    }
+}
+
+/* Give input that was read but not yet returned back to the file, by
+ * seeking back to the start of it, so that commands that share the
+ * descriptor read it instead.  Not possible for pipes and terminals;
+ * returns false then. */
+bool
+esh_reader_unread(struct esh_reader *r)
+{
+    if (r->pos == r->len)
+        return true;
+
+    if (lseek(r->fd, -(off_t) (r->len - r->pos), SEEK_CUR) < 0)
+        return false;
+
+    r->pos = r->len = 0;
+    r->eof = false;
+    return true;
+}
+
+void
+esh_reader_free(struct esh_reader *r)
+{
+    free(r->buf);
+    free(r);
+}
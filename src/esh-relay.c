@@ -0,0 +1,193 @@
+/*
+ * esh-relay.c
+ * The relay of a fan-out redirection.
+ *
+ * 'cmd >& a.log b.log |> gzip' sends the output of cmd to both files
+ * and to gzip.  The parser turns it into 'cmd | esh-relay a.log b.log
+ * >(gzip)', so that the relay is one more process of the job: it is
+ * in the job's process group, is stopped and killed with it, and the
+ * job is done only once the relay has written everything out.  The
+ * shell starts its own executable as the relay; see main() in esh.c.
+ *
+ * The relay copies without the data reaching user space.  Its stdin is
+ * the pipe from cmd.  For each output but the last, it tee(2)s what is
+ * in that pipe into a pipe of its own, which is as large and empty;
+ * then it splice(2)s the same bytes out of the input pipe to the last
+ * output, and out of its own pipes to the other outputs.  Each output
+ * must take all of the bytes before the relay takes more from cmd, so
+ * an output that is slow to read holds up cmd, as with tee(1).  An
+ * output whose reader has gone is dropped; once all are, the relay
+ * exits, and cmd gets SIGPIPE as in a pipeline.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+
+#include "esh.h"
+
+struct output {
+    int fd;                     /* -1 once its reader has gone */
+    int mid[2];                 /* The relay's own pipe, or -1 for the
+                                   last output */
+};
+
+static int nopen;               /* Outputs not dropped */
+
+/* Copy 'len' bytes from pipe 'from' to 'out' the slow way, for outputs
+ * that splice(2) does not support */
+static bool
+copy(int from, struct output *out, size_t len)
+{
+    char buf[65536];
+
+    while (len > 0) {
+        ssize_t n = read(from, buf, len < sizeof buf ? len : sizeof buf);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        len -= n;
+
+        char *p = buf;
+        while (n > 0 && out->fd != -1) {
+            ssize_t w = write(out->fd, p, n);
+            if (w < 0 && errno == EINTR)
+                continue;
+            if (w < 0 && errno != EPIPE)
+                return false;
+            if (w < 0) {
+                close(out->fd);
+                out->fd = -1;
+                nopen--;
+                break;
+            }
+            p += w;
+            n -= w;
+        }
+    }
+    return true;
+}
+
+/* Move 'len' bytes out of pipe 'from' to 'out'.  The bytes are taken
+ * out of the pipe even if the output has been dropped. */
+static bool
+move(int from, struct output *out, size_t len)
+{
+    static int devnull = -1;
+
+    while (len > 0) {
+        int to = out->fd;
+        if (to == -1) {
+            if (devnull == -1
+                    && (devnull = open("/dev/null", O_WRONLY | O_CLOEXEC)) < 0)
+                return false;
+            to = devnull;
+        }
+
+        ssize_t n = splice(from, NULL, to, NULL, len, SPLICE_F_MOVE);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && errno == EPIPE) {
+            close(out->fd);
+            out->fd = -1;
+            nopen--;
+            continue;
+        }
+        if (n < 0 && errno == EINVAL)
+            return copy(from, out, len);
+        if (n <= 0)
+            return false;
+        len -= n;
+    }
+    return true;
+}
+
+int
+esh_relay_main(int ac, char *av[])
+{
+    int n = ac - 1, i;
+    struct output *outs = calloc(n, sizeof *outs);
+
+    if (outs == NULL || n == 0) {
+        fprintf(stderr, "%s: no outputs\n", ESH_RELAY);
+        return 1;
+    }
+
+    /* a reader that goes away is not fatal; see move() */
+    signal(SIGPIPE, SIG_IGN);
+
+    int size = fcntl(STDIN_FILENO, F_GETPIPE_SZ);
+    if (size < 0) {
+        fprintf(stderr, "%s: stdin is not a pipe\n", ESH_RELAY);
+        return 1;
+    }
+
+    for (i = 0; i < n; i++) {
+        outs[i].fd = open(av[i + 1], O_CREAT | O_WRONLY | O_TRUNC | O_CLOEXEC,
+                          S_IRWXU);
+        if (outs[i].fd < 0) {
+            fprintf(stderr, "%s: %s\n", av[i + 1], strerror(errno));
+            return 1;
+        }
+        outs[i].mid[0] = outs[i].mid[1] = -1;
+        if (i == n - 1)
+            continue;
+
+        /* as large as the input, so that a tee(2) into it, while it is
+         * empty, takes whatever one into another of them took */
+        if (pipe2(outs[i].mid, O_CLOEXEC) < 0
+                || fcntl(outs[i].mid[1], F_SETPIPE_SZ, size) < size) {
+            fprintf(stderr, "%s: pipe: %s\n", ESH_RELAY, strerror(errno));
+            return 1;
+        }
+    }
+    nopen = n;
+
+    while (nopen > 0) {
+        struct pollfd in = { .fd = STDIN_FILENO, .events = POLLIN };
+        int len;
+
+        /* wait until cmd has written something, or has exited */
+        if (poll(&in, 1, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "%s: poll: %s\n", ESH_RELAY, strerror(errno));
+            return 1;
+        }
+        if (ioctl(STDIN_FILENO, FIONREAD, &len) < 0 || len == 0)
+            break;
+
+        for (i = 0; i < n - 1; i++) {
+            if (outs[i].fd == -1)
+                continue;
+            ssize_t t;
+            do
+                t = tee(STDIN_FILENO, outs[i].mid[1], len, 0);
+            while (t < 0 && errno == EINTR);
+            if (t != len) {
+                fprintf(stderr, "%s: tee: %s\n", ESH_RELAY,
+                        t < 0 ? strerror(errno) : "short copy");
+                return 1;
+            }
+        }
+
+        /* the last output takes the bytes out of the input */
+        bool ok = move(STDIN_FILENO, &outs[n - 1], len);
+        for (i = 0; ok && i < n - 1; i++)
+            if (outs[i].fd != -1)
+                ok = move(outs[i].mid[0], &outs[i], len);
+        if (!ok) {
+            fprintf(stderr, "%s: %s\n", ESH_RELAY, strerror(errno));
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,177 @@
+/*
+ * esh-trace.c
+ * Tracing of the shell's launch path, written as Chrome trace-event
+ * JSON that chrome://tracing and Perfetto (ui.perfetto.dev) can load.
+ *
+ * Tracing is enabled with 'esh -T tracefile'.  The shell's own work,
+ * such as parsing, plugin hooks, spawning and terminal handoff, appears
+ * as spans on the shell's track; each command gets a track of its own,
+ * named after the command, that shows its lifetime and its stops,
+ * continues and exit.  All timestamps come from CLOCK_MONOTONIC, the
+ * clock the shell also uses for the start and end times of commands.
+ *
+ * When tracing is off, esh_trace_file is NULL and the ESH_TRACE_* macros
+ * in esh.h reduce to a test of it, so trace points cost next to nothing.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "esh.h"
+
+/* The trace file; NULL unless tracing is on */
+FILE *esh_trace_file;
+
+static pid_t shell_pid;
+
+/* Longest 'detail' argument written; longer ones are truncated */
+#define TRACE_DETAIL_MAX 256
+
+double
+esh_trace_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/* Write 's' as the contents of a JSON string */
+static void
+write_escaped(const char *s)
+{
+    int n;
+
+    /* cut off only between UTF-8 characters, not within one */
+    for (n = 0; *s && (n < TRACE_DETAIL_MAX || (*s & 0xC0) == 0x80);
+         s++, n++) {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\')
+            fprintf(esh_trace_file, "\\%c", c);
+        else if (c < 0x20)
+            fprintf(esh_trace_file, "\\u%04x", c);
+        else
+            putc(c, esh_trace_file);
+    }
+    if (*s)
+        fputs("...", esh_trace_file);
+}
+
+/* Write the fields common to all events, leaving the object open */
+static void
+write_event(const char *name, char ph, double ts, pid_t tid)
+{
+    fputs("{\"name\": \"", esh_trace_file);
+    write_escaped(name);
+    fprintf(esh_trace_file,
+            "\", \"cat\": \"esh\", \"ph\": \"%c\", "
+            "\"ts\": %.3f, \"pid\": %d, \"tid\": %d",
+            ph, ts, shell_pid, tid ? tid : shell_pid);
+}
+
+static void
+finish_event(const char *detail)
+{
+    if (detail) {
+        fputs(", \"args\": {\"detail\": \"", esh_trace_file);
+        write_escaped(detail);
+        fputs("\"}", esh_trace_file);
+    }
+    fputs("},\n", esh_trace_file);
+}
+
+/* Name the track of thread 'tid' */
+static void
+write_track_name(pid_t tid, const char *name)
+{
+    fprintf(esh_trace_file,
+            "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %d, "
+            "\"tid\": %d, \"args\": {\"name\": \"", shell_pid, tid);
+    write_escaped(name);
+    fputs("\"}},\n", esh_trace_file);
+}
+
+static void
+trace_close(void)
+{
+    if (esh_trace_file == NULL)
+        return;
+
+    /* a last event without a trailing comma closes the array */
+    fprintf(esh_trace_file,
+            "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %d, "
+            "\"args\": {\"name\": \"esh\"}}\n]\n", shell_pid);
+    fclose(esh_trace_file);
+    esh_trace_file = NULL;
+}
+
+/* Start writing a trace to 'path'.  The trace is completed when the
+ * shell exits. */
+void
+esh_trace_open(const char *path)
+{
+    esh_trace_file = fopen(path, "we");
+    if (esh_trace_file == NULL)
+        esh_sys_fatal_error("%s: ", path);
+
+    /* events are small and many; write them in large blocks */
+    setvbuf(esh_trace_file, NULL, _IOFBF, 1 << 16);
+
+    shell_pid = getpid();
+    fputs("[\n", esh_trace_file);
+    write_track_name(shell_pid, "shell");
+    atexit(trace_close);
+}
+
+/* Record a span of the shell's work that started at 'start' (from
+ * esh_trace_now()) and ends now.  'detail' may be NULL. */
+void
+esh_trace_span(const char *name, double start, const char *detail)
+{
+    double now = esh_trace_now();
+
+    write_event(name, 'X', start, 0);
+    fprintf(esh_trace_file, ", \"dur\": %.3f", now - start);
+    finish_event(detail);
+}
+
+/* Record an event that happened now to process 'pid', or to the shell
+ * if 'pid' is 0 */
+void
+esh_trace_instant(const char *name, pid_t pid, const char *detail)
+{
+    write_event(name, 'i', esh_trace_now(), pid);
+    fputs(", \"s\": \"t\"", esh_trace_file);
+    finish_event(detail);
+}
+
+/* Record that command 'cmd' was started; gives it a track */
+void
+esh_trace_command_started(struct esh_command *cmd)
+{
+    char name[64];
+
+    snprintf(name, sizeof name, "%s [%d]", cmd->argv[0], cmd->pid);
+    write_track_name(cmd->pid, name);
+    esh_trace_instant("started", cmd->pid, cmd->argv[0]);
+}
+
+/* Record the lifetime of command 'cmd', which was just reaped.  'pid'
+ * is the pid it had, as cmd->pid is reset when it is reaped. */
+void
+esh_trace_command_exited(struct esh_command *cmd, pid_t pid)
+{
+    double start = cmd->start_time.tv_sec * 1e6 + cmd->start_time.tv_nsec / 1e3;
+    double end = cmd->end_time.tv_sec * 1e6 + cmd->end_time.tv_nsec / 1e3;
+    char status[32];
+
+    if (WIFSIGNALED(cmd->exit_status))
+        snprintf(status, sizeof status, "signal %d", WTERMSIG(cmd->exit_status));
+    else
+        snprintf(status, sizeof status, "exit %d", WEXITSTATUS(cmd->exit_status));
+
+    write_event(cmd->argv[0], 'X', start, pid);
+    fprintf(esh_trace_file, ", \"dur\": %.3f", end - start);
+    finish_event(status);
+}
@@ -5,44 +5,80 @@
  * Developed by Godmar Back for CS 3214 Fall 2009
  * Virginia Tech.
  */
+#define _GNU_SOURCE
 #include <stdio.h>
+#include <stddef.h>
+#include <string.h>
 #include <sys/types.h>
 #include <dirent.h>
 #include <dlfcn.h>
+#include <link.h>
 #include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
 
 #include "esh.h"
 
 static const char rcsid [] = "$Id: esh-utils.c,v 1.5 2011/03/29 15:46:28 cs3214 Exp $";
 
+#define obstack_chunk_alloc malloc
+#define obstack_chunk_free free
+
 /* List of loaded plugins */
 struct list esh_plugin_list;
 
-/* Create new command structure and initialize first command word,
- * and/or input or output redirect file. */
+/* Per-hook dispatch tables, built by esh_plugin_initialize() */
+struct esh_plugin_hooks esh_plugin_hooks;
+
+/* Create new command structure in 'arena' and initialize first command
+ * word, and/or input or output redirect file. */
 struct esh_command * 
-esh_command_create(char ** argv, 
+esh_command_create(struct obstack *arena,
+                   char ** argv, 
                    char *iored_input, 
                    char *iored_output, 
                    bool append_to_output)
 {
-    struct esh_command *cmd = malloc(sizeof *cmd);
+    struct esh_command *cmd = obstack_alloc(arena, sizeof *cmd);
 
     cmd->iored_input = iored_input;
     cmd->iored_output = iored_output;
     cmd->argv = argv;
     cmd->append_to_output = append_to_output;
+    cmd->here_document = NULL;
+    cmd->here_end = NULL;
+    cmd->substitution = '\0';
+    cmd->subst_arg = -1;
+    cmd->subst_fd = -1;
+    cmd->relay = false;
+    cmd->pid = -1;
+    cmd->pidfd = -1;
+    memset(&cmd->start_time, 0, sizeof cmd->start_time);
+    memset(&cmd->end_time, 0, sizeof cmd->end_time);
+    memset(&cmd->rusage, 0, sizeof cmd->rusage);
+    cmd->exit_status = 0;
 
     return cmd;
 }
 
-/* Create a new pipeline containing only one command */
+/* Create a new pipeline in 'arena' containing only one command */
 struct esh_pipeline *
-esh_pipeline_create(struct esh_command *cmd)
+esh_pipeline_create(struct obstack *arena, struct esh_command *cmd)
 {
-    struct esh_pipeline *pipe = malloc(sizeof *pipe);
+    struct esh_pipeline *pipe = obstack_alloc(arena, sizeof *pipe);
 
     pipe->bg_job = false;
+    pipe->jid = 0;
+    pipe->group = NULL;
+    pipe->cgroup = NULL;
+    pipe->placement = NULL;
+    pipe->holds_slot = false;
+    pipe->holds_token = false;
+    memset(&pipe->start_time, 0, sizeof pipe->start_time);
+    memset(&pipe->end_time, 0, sizeof pipe->end_time);
+    memset(&pipe->rusage, 0, sizeof pipe->rusage);
     cmd->pipeline = pipe;
     list_init(&pipe->commands);
     list_push_back(&pipe->commands, &cmd->elem);
@@ -56,8 +92,11 @@ esh_pipeline_finish(struct esh_pipeline *pipe)
     if (list_size(&pipe->commands) == 0)
         return;
 
+    /* process substitutions come before the first command proper */
     struct esh_command *first;
-    first = list_entry(list_front(&pipe->commands), struct esh_command, elem);
+    struct list_elem *e = list_begin(&pipe->commands);
+    while ((first = list_entry(e, struct esh_command, elem))->substitution)
+        e = list_next(e);
     pipe->iored_input = first->iored_input;
 
     struct esh_command *last;
@@ -66,24 +105,117 @@ esh_pipeline_finish(struct esh_pipeline *pipe)
     pipe->append_to_output = last->append_to_output;
 }
 
-/* Create an empty command line */
+/* Create an empty command line with an empty arena */
 struct esh_command_line *
 esh_command_line_create_empty(void)
 {
     struct esh_command_line *cmdline = malloc(sizeof *cmdline);
 
+    if (cmdline == NULL)
+        esh_sys_fatal_error("malloc: ");
     list_init(&cmdline->pipes);
+    obstack_init(&cmdline->arena);
     return cmdline;
 }
 
-/* Create a command line with a single pipeline */
-struct esh_command_line *
-esh_command_line_create(struct esh_pipeline *pipe)
+/* Size of the part of a compact copy that holds 'cmd'; see below */
+static size_t
+command_copy_size(struct esh_command *cmd)
 {
-    struct esh_command_line *cmdline = esh_command_line_create_empty();
+    size_t sz = sizeof *cmd + sizeof(char *);
+    char **p;
 
-    list_push_back(&cmdline->pipes, &pipe->elem);
-    return cmdline;
+    for (p = cmd->argv; *p; p++)
+        sz += sizeof(char *) + strlen(*p) + 1;
+    if (cmd->iored_input)
+        sz += strlen(cmd->iored_input) + 1;
+    if (cmd->iored_output)
+        sz += strlen(cmd->iored_output) + 1;
+    if (cmd->here_document)
+        sz += strlen(cmd->here_document) + 1;
+    if (cmd->here_end)
+        sz += strlen(cmd->here_end) + 1;
+    return sz;
+}
+
+/* Bump allocator over a block sized by command_copy_size() */
+static void *
+copy_take(char **next, size_t sz)
+{
+    void *p = *next;
+    *next += sz;
+    return p;
+}
+
+static char *
+copy_string(char **next, const char *s)
+{
+    return s ? strcpy(copy_take(next, strlen(s) + 1), s) : NULL;
+}
+
+/* Copy a pipeline, its commands and their words into a single malloc'd
+ * block, so that it can outlive the command line it was parsed from.
+ * The block is laid out as the pipeline, then all commands, then all
+ * argv arrays, then all strings, which keeps everything suitably
+ * aligned.  Free it with esh_pipeline_free(). */
+struct esh_pipeline *
+esh_pipeline_copy(struct esh_pipeline *pipe)
+{
+    size_t ncmds = list_size(&pipe->commands);
+    size_t sz = sizeof *pipe;
+    struct list_elem *e;
+
+    for (e = list_begin(&pipe->commands); e != list_end(&pipe->commands);
+         e = list_next(e))
+        sz += command_copy_size(list_entry(e, struct esh_command, elem));
+
+    struct esh_pipeline *copy = malloc(sz);
+    if (copy == NULL)
+        esh_sys_fatal_error("malloc: ");
+
+    *copy = *pipe;
+    list_init(&copy->commands);
+
+    struct esh_command *cmds = (struct esh_command *) (copy + 1);
+    char *next = (char *) (cmds + ncmds);
+    size_t i = 0;
+
+    /* first, the commands and their argv arrays */
+    for (e = list_begin(&pipe->commands); e != list_end(&pipe->commands);
+         e = list_next(e), i++) {
+        struct esh_command *cmd = list_entry(e, struct esh_command, elem);
+        size_t argc = 0;
+
+        while (cmd->argv[argc])
+            argc++;
+        cmds[i] = *cmd;
+        cmds[i].pipeline = copy;
+        cmds[i].argv = copy_take(&next, (argc + 1) * sizeof(char *));
+        list_push_back(&copy->commands, &cmds[i].elem);
+    }
+
+    /* then, the strings they point to */
+    for (e = list_begin(&pipe->commands), i = 0; e != list_end(&pipe->commands);
+         e = list_next(e), i++) {
+        struct esh_command *cmd = list_entry(e, struct esh_command, elem);
+        size_t j;
+
+        for (j = 0; cmd->argv[j]; j++)
+            cmds[i].argv[j] = copy_string(&next, cmd->argv[j]);
+        cmds[i].argv[j] = NULL;
+        cmds[i].iored_input = copy_string(&next, cmd->iored_input);
+        cmds[i].iored_output = copy_string(&next, cmd->iored_output);
+        cmds[i].here_document = copy_string(&next, cmd->here_document);
+        cmds[i].here_end = copy_string(&next, cmd->here_end);
+    }
+
+    if (ncmds > 0) {
+        for (i = 0; cmds[i].substitution; i++)
+            continue;
+        copy->iored_input = cmds[i].iored_input;
+        copy->iored_output = cmds[ncmds - 1].iored_output;
+    }
+    return copy;
 }
 
 /* Print esh_command structure to stdout */
@@ -105,6 +237,10 @@ esh_command_print(struct esh_command *cmd)
 
     if (cmd->iored_input)
         printf("  stdin reads from %s\n", cmd->iored_input);
+
+    if (cmd->here_document)
+        printf("  stdin reads a here-document of %zu bytes\n",
+               strlen(cmd->here_document));
 }
   
 /* Print esh_pipeline structure to stdout */
@@ -142,56 +278,170 @@ esh_command_line_print(struct esh_command_line *cmdline)
     printf("==========================================\n");
 }
 
+/* Add the resource usage 'ru' to 'total'. ru_maxrss is the maximum. */
+void
+esh_rusage_add(struct rusage *total, const struct rusage *ru)
+{
+    timeradd(&total->ru_utime, &ru->ru_utime, &total->ru_utime);
+    timeradd(&total->ru_stime, &ru->ru_stime, &total->ru_stime);
+    if (ru->ru_maxrss > total->ru_maxrss)
+        total->ru_maxrss = ru->ru_maxrss;
+    total->ru_minflt += ru->ru_minflt;
+    total->ru_majflt += ru->ru_majflt;
+    total->ru_inblock += ru->ru_inblock;
+    total->ru_oublock += ru->ru_oublock;
+    total->ru_nvcsw += ru->ru_nvcsw;
+    total->ru_nivcsw += ru->ru_nivcsw;
+}
+
+static double
+timespec_seconds(const struct timespec *from, const struct timespec *to)
+{
+    return (to->tv_sec - from->tv_sec) + (to->tv_nsec - from->tv_nsec) / 1e9;
+}
+
+static double
+timeval_seconds(const struct timeval *tv)
+{
+    return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+/* Print one line of a usage table; 'ru' is NULL if not yet known */
+static void
+print_usage_line(const char *pid, const char *status, double real,
+                 const struct rusage *ru, const char *name)
+{
+    if (ru == NULL) {
+        printf("%8s %-10s %8.3f %8s %8s %8s %6s %6s  %s\n",
+               pid, status, real, "-", "-", "-", "-", "-", name);
+        return;
+    }
+    printf("%8s %-10s %8.3f %8.3f %8.3f %7ldK %6ld %6ld  %s\n",
+           pid, status, real,
+           timeval_seconds(&ru->ru_utime), timeval_seconds(&ru->ru_stime),
+           ru->ru_maxrss, ru->ru_nvcsw, ru->ru_nivcsw, name);
+}
+
+/* Print the resources used by each command of a pipeline and the totals.
+ * Commands that are still running show only their elapsed time. */
+void
+esh_pipeline_print_usage(struct esh_pipeline *pipe)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    printf("%8s %-10s %8s %8s %8s %8s %6s %6s  %s\n", "PID", "STATUS",
+           "REAL", "USER", "SYS", "MAXRSS", "VCSW", "IVCSW", "COMMAND");
+
+    struct list_elem * e = list_begin (&pipe->commands);
+    for (; e != list_end (&pipe->commands); e = list_next (e)) {
+        struct esh_command *cmd = list_entry(e, struct esh_command, elem);
+        char pid[16], status[16];
+
+        if (cmd->start_time.tv_sec == 0 && cmd->start_time.tv_nsec == 0)
+            continue;       /* never started, e.g. a builtin */
+
+        if (cmd->pid != -1) {
+            snprintf(pid, sizeof pid, "%d", cmd->pid);
+            print_usage_line(pid, "running",
+                    timespec_seconds(&cmd->start_time, &now), NULL, cmd->argv[0]);
+            continue;
+        }
+
+        if (WIFSIGNALED(cmd->exit_status))
+            snprintf(status, sizeof status, "signal %d", WTERMSIG(cmd->exit_status));
+        else
+            snprintf(status, sizeof status, "exit %d", WEXITSTATUS(cmd->exit_status));
+        print_usage_line("-", status,
+                timespec_seconds(&cmd->start_time, &cmd->end_time),
+                &cmd->rusage, cmd->argv[0]);
+    }
+
+    const struct timespec *end = pipe->nlive > 0 ? &now : &pipe->end_time;
+    print_usage_line("", "total", timespec_seconds(&pipe->start_time, end),
+                     &pipe->rusage, "");
+}
+
 /* Deallocation functions. */
+
+/* Free a command line and everything in its arena in one go */
 void 
 esh_command_line_free(struct esh_command_line *cmdline)
 {
-    struct list_elem * e = list_begin (&cmdline->pipes); 
-
-    for (; e != list_end (&cmdline->pipes); ) {
-        struct esh_pipeline *pipe = list_entry(e, struct esh_pipeline, elem);
-        e = list_remove(e);
-        esh_pipeline_free(pipe);
-    }
+    obstack_free(&cmdline->arena, NULL);
     free(cmdline);
 }
 
+/* Free a pipeline made by esh_pipeline_copy(), closing any pidfds its
+ * commands still hold, removing its cgroup and releasing its CPUs */
 void 
 esh_pipeline_free(struct esh_pipeline *pipe)
 {
     struct list_elem * e = list_begin (&pipe->commands); 
 
-    for (; e != list_end (&pipe->commands); ) {
+    for (; e != list_end (&pipe->commands); e = list_next (e)) {
         struct esh_command *cmd = list_entry(e, struct esh_command, elem);
-        e = list_remove(e);
-        esh_command_free(cmd);
+        if (cmd->pidfd != -1)
+            close(cmd->pidfd);
     }
+    if (pipe->cgroup != NULL)
+        esh_cgroup_destroy(pipe->cgroup);
+    esh_placement_release(pipe);
     free(pipe);
 }
 
-void 
-esh_command_free(struct esh_command * cmd)
+#define PSH_MODULE_NAME "esh_module"
+
+/* A plugin directory that was loaded without a valid manifest.  Its
+ * manifest is written once its plugins have been initialized. */
+struct plugin_dir {
+    struct list_elem elem;      /* Link element for new_dirs */
+    char *name;
+    struct timespec mtime;      /* Of the directory, before it was read */
+    bool incomplete;            /* A plugin failed to load */
+    int count;
+    struct plugin_file {
+        char *file;             /* File name, within the directory */
+        struct stat st;
+        struct esh_plugin *plugin;
+        bool eager;             /* Its init() changed the shell object */
+    } *files;
+};
+
+/* A plugin known from a manifest that has not been loaded yet */
+struct lazy_plugin {
+    struct esh_plugin stub;     /* Holds rank and builtins, and stands in
+                                   for the plugin in the builtin registry */
+    struct list_elem elem;      /* Link element for lazy_plugins */
+    char *path;
+    unsigned hooks;             /* Hooks it implements */
+};
+
+static struct list new_dirs;        /* Directories to write manifests for */
+static struct list lazy_plugins;    /* Plugins not loaded yet, by rank */
+static unsigned lazy_hooks;         /* Hooks that some of them implement */
+static struct esh_shell *plugin_shell;  /* For init() of lazy plugins */
+
+static void
+plugin_lists_init(void)
 {
-    char ** p = cmd->argv;
-    while (*p) {
-        free(*p++);
+    static bool done;
+
+    if (!done) {
+        list_init(&new_dirs);
+        list_init(&lazy_plugins);
+        done = true;
     }
-    if (cmd->iored_input)
-        free(cmd->iored_input);
-    if (cmd->iored_output)
-        free(cmd->iored_output);
-    free(cmd->argv);
-    free(cmd);
 }
 
-#define PSH_MODULE_NAME "esh_module"
-
-/* Load a plugin referred to by modname */
+/* Load a plugin referred to by modname; 'verbose' says so on stdout */
 static struct esh_plugin *
-load_plugin(char *modname)
+load_plugin(char *modname, bool verbose)
 {
-    printf("Loading %s ...", modname);
-    fflush(stdout);
+    if (verbose) {
+        printf("Loading %s ...", modname);
+        fflush(stdout);
+    }
 
     void *handle = dlopen(modname, RTLD_LAZY);
     if (handle == NULL) {
@@ -206,10 +456,34 @@ load_plugin(char *modname)
         return NULL;
     }
 
-    printf("done.\n");
+    if (verbose)
+        printf("done.\n");
     return p;
 }
 
+/* The plugins linked into esh, from section esh_plugins.  The linker
+ * defines these symbols only if some plugin was; they are weak so that
+ * esh links without any, in which case both are NULL. */
+extern const struct esh_static_plugin __start_esh_plugins[] __attribute__((weak));
+extern const struct esh_static_plugin __stop_esh_plugins[] __attribute__((weak));
+
+/* The module of plugin file 'file' (such as "cd.so") if that plugin is
+ * linked into esh, else NULL.  Such plugins are not loaded again from a
+ * plugin directory. */
+static struct esh_plugin *
+static_plugin(const char *file)
+{
+    const struct esh_static_plugin *sp = __start_esh_plugins;
+    size_t len;
+
+    for (; sp < __stop_esh_plugins; sp++) {
+        len = strlen(sp->name);
+        if (strncmp(file, sp->name, len) == 0 && strcmp(file + len, ".so") == 0)
+            return sp->module;
+    }
+    return NULL;
+}
+
 static bool sort_by_rank (const struct list_elem *a,
                           const struct list_elem *b,
                           void *aux __attribute__((unused)))
@@ -219,16 +493,121 @@ static bool sort_by_rank (const struct list_elem *a,
     return pa->rank < pb->rank;
 }
 
+static bool lazy_by_rank (const struct list_elem *a,
+                          const struct list_elem *b,
+                          void *aux __attribute__((unused)))
+{
+    struct lazy_plugin * pa =  list_entry(a, struct lazy_plugin, elem);
+    struct lazy_plugin * pb =  list_entry(b, struct lazy_plugin, elem);
+    return pa->stub.rank < pb->stub.rank;
+}
+
+/* Does plugin 'p' extend at least 'end' bytes?  The size of a loaded
+ * plugin's esh_module symbol tells which layout of struct esh_plugin it
+ * was compiled with; plugins that are not symbols have the current one. */
+bool
+esh_plugin_has_field(struct esh_plugin *p, size_t end)
+{
+    const ElfW(Sym) *sym = NULL;
+    Dl_info info;
+
+    return dladdr1(p, &info, (void **) &sym, RTLD_DL_SYMENT) == 0
+        || info.dli_saddr != p || sym == NULL || sym->st_size >= end;
+}
+
+/* The builtins field of plugin 'p', or NULL if 'p' was compiled against
+ * an esh.h whose struct esh_plugin ends before that field */
+static const char **
+plugin_builtins(struct esh_plugin *p)
+{
+    return ESH_PLUGIN_HAS(p, builtins) ? p->builtins : NULL;
+}
+
+/* The hooks that plugin 'p' implements, as a manifest records them */
+static unsigned
+plugin_hooks(struct esh_plugin *p)
+{
+    unsigned hooks = 0;
+
+    if (p->process_raw_cmdline)
+        hooks |= 1u << ESH_HOOK_PROCESS_RAW_CMDLINE;
+    if (p->process_pipeline)
+        hooks |= 1u << ESH_HOOK_PROCESS_PIPELINE;
+    if (p->process_builtin && plugin_builtins(p) == NULL)
+        hooks |= 1u << ESH_HOOK_PROCESS_BUILTIN;
+    if (p->make_prompt)
+        hooks |= 1u << ESH_HOOK_MAKE_PROMPT;
+    if (p->pipeline_forked)
+        hooks |= 1u << ESH_HOOK_PIPELINE_FORKED;
+    if (p->command_status_change)
+        hooks |= 1u << ESH_HOOK_COMMAND_STATUS_CHANGE;
+    return hooks;
+}
+
+static bool lazy_process_builtin(struct esh_command *cmd);
+
+/* Add the plugins that manifest 'm' of directory 'dirname' describes.
+ * Only plugins that must be are loaded now; the others are loaded when
+ * one of their hooks or builtins is first needed. */
+static void
+load_from_manifest(char *dirname, struct esh_plugin_manifest *m)
+{
+    int i;
+
+    for (i = 0; i < m->count; i++) {
+        struct esh_plugin_info *info = &m->plugins[i];
+        char modname[PATH_MAX + 1];
+
+        if (static_plugin(info->file))
+            continue;
+
+        snprintf(modname, sizeof modname, "%s/%s", dirname, info->file);
+        if (info->eager) {
+            struct esh_plugin * plugin = load_plugin(modname, true);
+            if (plugin)
+                list_push_back(&esh_plugin_list, &plugin->elem);
+            continue;
+        }
+
+        struct lazy_plugin *lp = calloc(1, sizeof *lp);
+        if (lp == NULL || (lp->path = strdup(modname)) == NULL)
+            esh_sys_fatal_error("malloc: ");
+        lp->stub.rank = info->rank;
+        lp->stub.builtins = (const char **) info->builtins;
+        lp->stub.process_builtin = lazy_process_builtin;
+        lp->hooks = info->hooks;
+        lazy_hooks |= info->hooks;
+        list_insert_ordered(&lazy_plugins, &lp->elem, lazy_by_rank, NULL);
+    }
+    /* the builtin names in 'm' remain in use by the stubs */
+}
+
 /* Load plugins from directory dirname */
 void 
 esh_plugin_load_from_directory(char *dirname)
 {
-    DIR * dir = opendir(dirname);
+    plugin_lists_init();
+
+    struct esh_plugin_manifest *m = esh_plugin_manifest_read(dirname);
+    if (m != NULL) {
+        load_from_manifest(dirname, m);
+        return;
+    }
+
+    /* the modification time is taken first, so that a plugin added
+     * while the directory is read invalidates the manifest */
+    struct stat st;
+    DIR * dir = stat(dirname, &st) == 0 ? opendir(dirname) : NULL;
     if (dir == NULL) {
         perror("opendir");
         return;
     }
 
+    struct plugin_dir *d = calloc(1, sizeof *d);
+    if (d == NULL || (d->name = strdup(dirname)) == NULL)
+        esh_sys_fatal_error("malloc: ");
+    d->mtime = st.st_mtim;
+
     struct dirent * dentry;
     while ((dentry = readdir(dir)) != NULL) {
         if (!strstr(dentry->d_name, ".so"))
@@ -237,26 +616,329 @@ esh_plugin_load_from_directory(char *dirname)
         char modname[PATH_MAX + 1];
         snprintf(modname, sizeof modname, "%s/%s", dirname, dentry->d_name);
 
-        struct esh_plugin * plugin = load_plugin(modname);
-        if (plugin)
+        /* a plugin linked into esh is not loaded again, but is still
+         * recorded in the manifest, which shells without it also use */
+        struct esh_plugin * linked = static_plugin(dentry->d_name);
+        struct esh_plugin * plugin = linked ? linked : load_plugin(modname, true);
+        if (plugin == NULL || stat(modname, &st) < 0) {
+            d->incomplete = true;
+            continue;
+        }
+        if (linked == NULL)
             list_push_back(&esh_plugin_list, &plugin->elem);
+
+        d->files = realloc(d->files, (d->count + 1) * sizeof d->files[0]);
+        if (d->files == NULL)
+            esh_sys_fatal_error("malloc: ");
+        d->files[d->count++] = (struct plugin_file) {
+            .file = strdup(dentry->d_name), .st = st, .plugin = plugin
+        };
     }
     closedir(dir);
+    list_push_back(&new_dirs, &d->elem);
+}
+
+/* Write the manifests of the directories loaded without one, now that
+ * their plugins have been initialized */
+static void
+write_manifests(void)
+{
+    while (!list_empty(&new_dirs)) {
+        struct list_elem *e = list_pop_front(&new_dirs);
+        struct plugin_dir *d = list_entry(e, struct plugin_dir, elem);
+        struct esh_plugin_manifest m = { .count = d->count };
+        int i;
+
+        m.plugins = calloc(d->count + 1, sizeof m.plugins[0]);
+        if (m.plugins == NULL)
+            esh_sys_fatal_error("malloc: ");
+
+        for (i = 0; i < d->count; i++) {
+            struct plugin_file *f = &d->files[i];
+            struct esh_plugin_info *info = &m.plugins[i];
+
+            info->file = f->file;
+            info->mtime = f->st.st_mtim;
+            info->size = f->st.st_size;
+            info->rank = f->plugin->rank;
+            info->hooks = plugin_hooks(f->plugin);
+            if (f->plugin->process_builtin)
+                info->builtins = (char **) plugin_builtins(f->plugin);
+
+            /* a plugin that changes the shell object in init(), or that
+             * does nothing but init(), must be loaded at startup */
+            info->eager = f->eager
+                || (info->hooks == 0 && info->builtins == NULL);
+        }
+
+        if (!d->incomplete)
+            esh_plugin_manifest_write(d->name, d->mtime, &m);
+
+        for (i = 0; i < d->count; i++)
+            free(d->files[i].file);
+        free(m.plugins);
+        free(d->files);
+        free(d->name);
+        free(d);
+    }
+}
+
+/* Call the init() method of 'plugin', and note whether it changed the
+ * shell object */
+static void
+init_plugin(struct esh_plugin *plugin, struct esh_shell *shell)
+{
+    struct esh_shell before;
+    struct list_elem *e;
+    int i;
+
+    if (plugin->init == NULL)
+        return;
+    if (shell != NULL)
+        before = *shell;
+    plugin->init(shell);
+    if (shell == NULL || memcmp(&before, shell, sizeof before) == 0)
+        return;
+
+    for (e = list_begin(&new_dirs); e != list_end(&new_dirs); e = list_next(e)) {
+        struct plugin_dir *d = list_entry(e, struct plugin_dir, elem);
+        for (i = 0; i < d->count; i++)
+            if (d->files[i].plugin == plugin)
+                d->files[i].eager = true;
+    }
+}
+
+/* Replace the dispatch table of 'hook' with one that holds the 'hook'
+ * functions of the plugins that implement it and for which 'want' is
+ * true, in list order, followed by NULL. */
+#define COLLECT_HOOK(hook, want) do {                                   \
+    size_t n = 0;                                                       \
+    free(esh_plugin_hooks.hook);                                        \
+    esh_plugin_hooks.hook = malloc((nplugins + 1)                       \
+                                   * sizeof esh_plugin_hooks.hook[0]);  \
+    if (esh_plugin_hooks.hook == NULL)                                  \
+        esh_sys_fatal_error("malloc: ");                                \
+    for (e = list_begin(&esh_plugin_list);                              \
+         e != list_end(&esh_plugin_list); e = list_next(e)) {           \
+        struct esh_plugin *plugin = list_entry(e, struct esh_plugin, elem); \
+        if (plugin->hook && (want))                                     \
+            esh_plugin_hooks.hook[n++] = plugin->hook;                  \
+    }                                                                   \
+    esh_plugin_hooks.hook[n] = NULL;                                    \
+} while (0)
+
+/* Build the dispatch tables from the loaded plugins.
+ * Hooks are called for every command line, pipeline and command; the
+ * tables spare calling them from walking the plugin list and skip
+ * plugins that do not implement them. */
+static void
+build_hook_tables(void)
+{
+    size_t nplugins = list_size(&esh_plugin_list);
+    struct list_elem *e;
+
+    COLLECT_HOOK(process_raw_cmdline, true);
+    COLLECT_HOOK(process_pipeline, true);
+    COLLECT_HOOK(make_prompt, true);
+    COLLECT_HOOK(pipeline_forked, true);
+    COLLECT_HOOK(command_status_change, true);
+
+    /* Plugins that declare their builtins are only asked about those,
+     * through the builtin registry; the others about every command. */
+    COLLECT_HOOK(process_builtin, plugin_builtins(plugin) == NULL);
+    esh_plugin_hooks.generation++;
+}
+
+/* Register the builtins that 'plugin' declares */
+static void
+register_builtins(struct esh_plugin *plugin)
+{
+    const char **name = plugin_builtins(plugin);
+
+    for (; plugin->process_builtin && name && *name; name++)
+        esh_builtin_register(*name, NULL, plugin);
 }
 
 /* Initialize loaded plugins */
 void 
 esh_plugin_initialize(struct esh_shell *shell)
 {
+    plugin_lists_init();
+    plugin_shell = shell;
+
+    /* Plugins linked into esh join those loaded with -p */
+    const struct esh_static_plugin *sp = __start_esh_plugins;
+    for (; sp < __stop_esh_plugins; sp++)
+        list_push_back(&esh_plugin_list, &sp->module->elem);
+
     /* Sort plugins and call init() method. */
     list_sort(&esh_plugin_list, sort_by_rank, NULL);
 
     struct list_elem * e = list_begin(&esh_plugin_list);
-    for (; e != list_end(&esh_plugin_list); e = list_next(e)) {
-        struct esh_plugin *plugin = list_entry(e, struct esh_plugin, elem);
-        if (plugin->init)
-            plugin->init(shell);
+    for (; e != list_end(&esh_plugin_list); e = list_next(e))
+        init_plugin(list_entry(e, struct esh_plugin, elem), shell);
+
+    /* Plugins may set their hooks in init(), so this is done last. */
+    build_hook_tables();
+
+    /* Register builtins in increasing rank, of loaded and not yet
+     * loaded plugins alike, so that the lowest ranked plugin gets a
+     * name that several declare */
+    struct list_elem *l = list_begin(&lazy_plugins);
+    e = list_begin(&esh_plugin_list);
+    while (e != list_end(&esh_plugin_list) || l != list_end(&lazy_plugins)) {
+        struct esh_plugin *plugin = e != list_end(&esh_plugin_list)
+            ? list_entry(e, struct esh_plugin, elem) : NULL;
+        struct lazy_plugin *lp = l != list_end(&lazy_plugins)
+            ? list_entry(l, struct lazy_plugin, elem) : NULL;
+
+        if (lp == NULL || (plugin != NULL && plugin->rank <= lp->stub.rank)) {
+            register_builtins(plugin);
+            e = list_next(e);
+        } else {
+            register_builtins(&lp->stub);
+            l = list_next(l);
+        }
+    }
+
+    write_manifests();
+}
+
+/* Load plugin 'lp', which is then no longer lazy.  Returns the plugin,
+ * or NULL if it could not be loaded. */
+static struct esh_plugin *
+lazy_load(struct lazy_plugin *lp)
+{
+    struct esh_plugin *plugin = load_plugin(lp->path, false);
+    const char **name;
+    struct list_elem *e;
+
+    /* its builtins now go to the plugin itself */
+    for (name = lp->stub.builtins; name && *name; name++) {
+        struct esh_builtin *b = esh_builtin_find(*name);
+        if (b != NULL && b->plugin == &lp->stub)
+            b->plugin = plugin;
     }
+
+    list_remove(&lp->elem);
+    free(lp->path);
+    free(lp);
+
+    lazy_hooks = 0;
+    for (e = list_begin(&lazy_plugins); e != list_end(&lazy_plugins);
+         e = list_next(e))
+        lazy_hooks |= list_entry(e, struct lazy_plugin, elem)->hooks;
+
+    if (plugin == NULL)
+        return NULL;
+
+    list_insert_ordered(&esh_plugin_list, &plugin->elem, sort_by_rank, NULL);
+    init_plugin(plugin, plugin_shell);
+    build_hook_tables();
+    return plugin;
+}
+
+/* process_builtin of the stub of a lazy plugin: load the plugin, which
+ * takes the stub's place in the registry, and let it run the command */
+static bool
+lazy_process_builtin(struct esh_command *cmd)
+{
+    struct esh_builtin *b = esh_builtin_find(cmd->argv[0]);
+    struct lazy_plugin *lp = (struct lazy_plugin *) b->plugin;
+    struct esh_plugin *plugin = lazy_load(lp);
+
+    return plugin != NULL && plugin->process_builtin != NULL
+        && plugin->process_builtin(cmd);
+}
+
+void
+esh_plugin_load_hook(enum esh_plugin_hook hook)
+{
+    struct list_elem *e = list_begin(&lazy_plugins);
+
+    while (e != list_end(&lazy_plugins)) {
+        struct lazy_plugin *lp = list_entry(e, struct lazy_plugin, elem);
+        e = list_next(e);
+        if (lp->hooks & (1u << hook))
+            lazy_load(lp);
+    }
+}
+
+/* Load the plugins that implement 'hook' before its table is used */
+#define LOAD_LAZY(hook) do {                                            \
+    if (__builtin_expect(lazy_hooks & (1u << (hook)), 0))               \
+        esh_plugin_load_hook(hook);                                     \
+} while (0)
+
+/* Offer the command line the user entered to plugins, in rank order,
+ * until one returns true.  Returns true if one did. */
+bool
+esh_plugin_process_raw_cmdline(char **cmdline)
+{
+    LOAD_LAZY(ESH_HOOK_PROCESS_RAW_CMDLINE);
+
+    bool (**hook)(char **) = esh_plugin_hooks.process_raw_cmdline;
+
+    for (; *hook; hook++)
+        if ((*hook)(cmdline))
+            return true;
+    return false;
+}
+
+/* Offer a pipeline to plugins, in rank order, until one returns true.
+ * Returns true if one did. */
+bool
+esh_plugin_process_pipeline(struct esh_pipeline *pipe)
+{
+    LOAD_LAZY(ESH_HOOK_PROCESS_PIPELINE);
+
+    bool (**hook)(struct esh_pipeline *) = esh_plugin_hooks.process_pipeline;
+
+    for (; *hook; hook++)
+        if ((*hook)(pipe))
+            return true;
+    return false;
+}
+
+/* Offer a command to the plugins that did not declare their builtins,
+ * in rank order, until one runs it as a built-in.  Returns true if one
+ * did. */
+bool
+esh_plugin_process_builtin(struct esh_command *cmd)
+{
+    LOAD_LAZY(ESH_HOOK_PROCESS_BUILTIN);
+
+    bool (**hook)(struct esh_command *) = esh_plugin_hooks.process_builtin;
+
+    for (; *hook; hook++)
+        if ((*hook)(cmd))
+            return true;
+    return false;
+}
+
+/* Tell all plugins that the processes of 'pipe' were started */
+void
+esh_plugin_pipeline_forked(struct esh_pipeline *pipe)
+{
+    LOAD_LAZY(ESH_HOOK_PIPELINE_FORKED);
+
+    void (**hook)(struct esh_pipeline *) = esh_plugin_hooks.pipeline_forked;
+
+    for (; *hook; hook++)
+        (*hook)(pipe);
+}
+
+/* Tell all plugins that the status of 'cmd' changed */
+void
+esh_plugin_command_status_change(struct esh_command *cmd, int status)
+{
+    LOAD_LAZY(ESH_HOOK_COMMAND_STATUS_CHANGE);
+
+    bool (**hook)(struct esh_command *, int) =
+        esh_plugin_hooks.command_status_change;
+
+    for (; *hook; hook++)
+        (*hook)(cmd, status);
 }
 
 /* TBD: implement unloading. */
@@ -4,149 +4,421 @@
  * Developed by Godmar Back for CS 3214 Fall 2009
  * Virginia Tech.
  */
+#define _GNU_SOURCE
 #include <stdio.h>
+#include <stdarg.h>
 #include <readline/readline.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
 
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <sys/wait.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/pidfd.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
 
 #include "esh.h"
 
-struct list jobs_list; //The jobs list
 struct termios *shell_termios = NULL; //The status of the shell
 
+static int epoll_fd = -1; //Event loop: watches stdin, signal_fd, pidfds and
+                          //the prompt's notification fd
+static int signal_fd = -1; //Delivers SIGCHLD, which stays blocked
+
+//epoll_event.data.ptr is the esh_command for a pidfd, or one of these tags
+static char input_source;
+static char sigchld_source;
+static char prompt_source;
+static char jobserver_source;
+static int jobserver_fd = -1; //The jobserver pipe, while it is watched
+static bool input_active = false; //True while readline shows a prompt
+static bool shell_done = false; //True once the user typed EOF
+static bool verbose = false; //Report events handled per wakeup
+static bool job_control = false; //True if the shell reads from a terminal and
+                                 //runs each job in a process group of its own
+static int last_status = 0; //Exit status of the last foreground pipeline
+static struct esh_pipeline *last_job = NULL; //Most recently finished job, for 'times'
+static bool interrupted = false; //True once ^C reached the shell while SIGINT
+                                 //is delivered through signal_fd
+
+extern struct esh_shell shell;
+static char *build_prompt_from_plugins(void);
+static bool start_pipeline(struct esh_pipeline *pipeline);
+static bool run_background(struct esh_pipeline *pipeline);
+static void start_queued_jobs(void);
+
+//Event loop statistics
+static unsigned long stat_wakeups = 0;
+static unsigned long stat_events = 0;
+static int stat_max_batch = 0;
+
 /**
- * Determines if the command entered by the user is a function built into the
- * shell itself. If so it will execute the builtin function, otherwise it will
- * attempt to execute the command entered by the user.
+ * Prints a job notice. If readline is showing a prompt, the prompt and any
+ * partially typed input are cleared first and redrawn afterwards.
  *
- * cmd - The command entered by the user
- * Return :
-    0 - The command is not builtin
-    1 - The command is builtin
+ * fmt - printf-style format
 **/
-static bool esh_isBuiltIn(char *cmd)
+static void print_notice(const char *fmt, ...)
 {
-    if ((strcmp(cmd, "kill") == 0) || (strcmp(cmd, "stop") == 0)
-        ||strcmp(cmd, "jobs") == 0 || (strcmp(cmd, "fg") == 0)
-        ||strcmp(cmd, "bg") == 0)
-        return 1;
-    return 0;
+    va_list ap;
+
+    if (input_active)
+        rl_clear_visible_line();
+
+    va_start(ap, fmt);
+    vprintf(fmt, ap);
+    va_end(ap);
+    fflush(stdout);
+
+    if (input_active)
+        rl_forced_update_display();
 }
 
 /**
- * A sighandler that is implemented to handle interceptions of the
- * SIGCHLD signal. Based off of how the signal was intercepted, it will
- * determine what should be done with the signal.
+ * Applies a status change of one command to the job table. When a command
+ * exits, its end time, exit status and resource usage are recorded and added
+ * to its pipeline's totals. A job is removed once all of its commands have
+ * exited; it is then kept as last_job until the next job finishes. Always
+ * runs on the main thread, from the event loop.
  *
- * sig - The signal to intercept
- * siginfo - Information about the signal
- * ptr - Callback
+ * cmd - The command whose process changed status
+ * status - The status of the process, as returned by waitpid
+ * ru - The resources the process used if it exited, otherwise NULL
 **/
-static void esh_sighandler(int sig, siginfo_t *siginfo, void *ptr)
+static void command_status_changed(struct esh_command *cmd, int status,
+                                   const struct rusage *ru)
 {
-    int child_status;
-    pid_t pid;
-    while ((pid = waitpid(-1, &child_status, WUNTRACED | WNOHANG)) > 0)
+    struct esh_pipeline *pipe = cmd->pipeline;
+
+    if (ru != NULL)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &cmd->end_time);
+        cmd->exit_status = status;
+        cmd->rusage = *ru;
+        esh_rusage_add(&pipe->rusage, ru);
+        pipe->end_time = cmd->end_time;
+    }
+
+    //Plugins see the change before the pipeline's status is updated
+    esh_plugin_command_status_change(cmd, status);
+
+    //The status of a pipeline is that of its last command
+    if (pipe->status == FOREGROUND
+        && &cmd->elem == list_back(&pipe->commands))
+    {
+        if (WIFEXITED(status))
+            last_status = WEXITSTATUS(status);
+        else if (WIFSIGNALED(status))
+            last_status = 128 + WTERMSIG(status);
+        else if (WIFSTOPPED(status))
+            last_status = 128 + WSTOPSIG(status);
+    }
+
+    if (WIFEXITED(status) || WIFSIGNALED(status)) //The child process is gone
     {
-        if (WIFEXITED(child_status)) //If child exited normally
+        esh_prompt_invalidate(ESH_PROMPT_JOBS);
+        if (pipe->group != NULL && (!WIFEXITED(status) || WEXITSTATUS(status) != 0))
+            pipe->group->failed++;
+
+        //Closing the pidfd also removes it from the event loop
+        close(cmd->pidfd);
+        cmd->pidfd = -1;
+
+        //Recorded before the job table forgets the command's pid
+        if (esh_tracing())
+            esh_trace_command_exited(cmd, cmd->pid);
+
+        if (esh_jobs_command_reaped(cmd))
         {
-            struct list_elem *j = list_begin(&jobs_list);
-            for (; j != list_end(&jobs_list); j = list_next(j))
+            //Notify the user if a background process ended on its own
+            if (job_control && pipe->status != FOREGROUND && WIFEXITED(status))
             {
-                struct esh_pipeline *pipe = list_entry(j, struct esh_pipeline, elem);
-                if (pipe->pgrp == pid)
-                {
-                    //Notify the user if a background process ended
-                    if (pipe->status != FOREGROUND)
-                    {
-                        printf("\n[%d] DONE\n", pipe->jid);
-                        list_remove(j);
-                        break;
-                    }
-                    else
-                    {
-                        list_remove(j);
-                    }
-                }
+                print_notice("\n[%d] DONE\n", pipe->jid);
             }
+            esh_jobs_remove(pipe);
+            if (last_job != NULL)
+                esh_pipeline_free(last_job);
+            last_job = pipe;
+
+            //The job's slot is free again
+            start_queued_jobs();
         }
-        else
+    }
+    else if (WIFSTOPPED(status)) //The child process was stopped (ex. ^Z)
+    {
+        ESH_TRACE_INSTANT("stopped", cmd->pid, strsignal(WSTOPSIG(status)));
+        esh_prompt_invalidate(ESH_PROMPT_JOBS);
+        if (pipe->group != NULL)
+            pipe->group->stopped = true;
+        if (pipe->status != STOPPED)
         {
-            if (WIFSTOPPED(child_status)) //If the child process was stopped (ex. ^Z)
+            struct list_elem *c = list_begin (&pipe->commands);
+            struct esh_command *first = list_entry(c, struct esh_command, elem);
+
+            //Tell the user if the job was stopped while in the foreground
+            if (pipe->status == FOREGROUND)
             {
-                //Set job to stopped
-                struct list_elem *j = list_begin(&jobs_list);
-                for (; j != list_end(&jobs_list); j = list_next(j))
-                {
-                    struct esh_pipeline *pipe = list_entry(j, struct esh_pipeline, elem);
-                    if (pipe->pgrp == pid)
-                    {
-                        pipe->status = STOPPED;
-                        break;
-                    }
-                }
+                print_notice("[%d] Stopped   (%s %s)\n", pipe->jid, first->argv[0], first->argv[1]);
             }
+            pipe->status = STOPPED;
         }
     }
 }
 
 /**
- * Handles certain situations just like the SIGCHLD handler except it is used
- * when the SIGCHLD handler needs to be blocked for special occasions. Mainly
- * for when the user issues ^Z.
+ * Converts the siginfo filled in by waitid into a waitpid-style status.
+ *
+ * info - The siginfo of a child status change
+**/
+static int wait_status(siginfo_t *info)
+{
+    switch (info->si_code)
+    {
+    case CLD_EXITED:
+        return W_EXITCODE(info->si_status, 0);
+    case CLD_KILLED:
+        return W_EXITCODE(0, info->si_status);
+    case CLD_DUMPED:
+        return W_EXITCODE(0, info->si_status) | WCOREFLAG;
+    default: //CLD_STOPPED or CLD_TRAPPED
+        return W_STOPCODE(info->si_status);
+    }
+}
+
+/**
+ * Reaps a command whose pidfd became readable, which means it exited, and
+ * collects its resource usage. The event leads straight to the command; no
+ * table needs to be searched.
+ *
+ * cmd - The command to reap
+ * Return: the number of status changes handled
+**/
+static int reap_command(struct esh_command *cmd)
+{
+    siginfo_t info;
+    struct rusage ru;
+    info.si_pid = 0;
+
+    //The waitid system call, unlike its glibc wrapper, also returns the
+    //child's resource usage, like wait4 does
+    if (syscall(SYS_waitid, P_PIDFD, cmd->pidfd, &info, WEXITED | WNOHANG, &ru) < 0
+        || info.si_pid == 0)
+        return 0;
+
+    command_status_changed(cmd, wait_status(&info), &ru);
+    return 1;
+}
+
+/**
+ * Handles stopped children. Called when signal_fd reports a SIGCHLD. Exits
+ * are reported through pidfds; SIGCHLD is only needed because pidfds do not
+ * report stops. Pending SIGCHLDs are drained first; since signals coalesce,
+ * waitid is then called until no stopped child is left to report. A SIGINT,
+ * which signal_fd only delivers while 'parallel' waits, is noted.
  *
- * status - The status of the process
- * pid - The pid of the process
+ * Return: the number of status changes handled
 **/
-static void possible_job_update(int status, pid_t pid)
+static int reap_stopped_children(void)
 {
-    if (WIFEXITED(status)) //The child process exits normally
+    struct signalfd_siginfo sinfo[16];
+    ssize_t n;
+    while ((n = read(signal_fd, sinfo, sizeof sinfo)) > 0)
     {
-        struct list_elem *j = list_begin(&jobs_list);
-        for (; j != list_end(&jobs_list); j = list_next(j))
+        size_t i;
+        for (i = 0; i < n / sizeof sinfo[0]; i++)
         {
-            struct esh_pipeline *pipe = list_entry(j, struct esh_pipeline, elem);
-            if (pipe->pgrp == pid)
-            {
-                //Notify the user if it was a background process
-                if (pipe->status != FOREGROUND)
-                {
-                    printf("\n[%d] DONE\n", pipe->jid);
-                    list_remove(j);
-                    break;
-                }
-                else
-                {
-                    list_remove(j);
-                }
-            }
+            if (sinfo[i].ssi_signo == SIGINT)
+                interrupted = true;
         }
     }
-    else
+
+    int handled = 0;
+    siginfo_t info;
+    for (;;)
     {
-        if (WIFSTOPPED(status)) //The child process is stopped (ex. ^Z)
+        info.si_pid = 0;
+        if (waitid(P_ALL, 0, &info, WSTOPPED | WNOHANG) < 0 || info.si_pid == 0)
+            break;
+
+        struct esh_command *cmd = esh_jobs_find_pid(info.si_pid);
+        if (cmd != NULL)
         {
-            struct list_elem *j = list_begin(&jobs_list);
-            for (; j != list_end(&jobs_list); j = list_next(j))
-            {
-                struct esh_pipeline *pipe = list_entry(j, struct esh_pipeline, elem);
-                struct list_elem *c = list_begin (&pipe->commands);
-                struct esh_command *cmd = list_entry(c, struct esh_command, elem);
-                if (pipe->pgrp == pid)
-                {
-                    //Set job to stopped
-                    pipe->status = STOPPED;
-                    printf("[%d] Stopped   (%s %s)\n", pipe->jid, cmd->argv[0], cmd->argv[1]);
-                    break;
-                }
-            }
+            command_status_changed(cmd, wait_status(&info), NULL);
+            handled++;
+        }
+    }
+    return handled;
+}
+
+/**
+ * Sets up the event loop. SIGCHLD is blocked for the lifetime of the shell
+ * and delivered through a signalfd instead, so that reaping never races with
+ * the main thread. Children have their signal mask reset when launched.
+ *
+ * watch_stdin - Whether input is read from stdin through readline
+**/
+static void event_loop_init(bool watch_stdin)
+{
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) < 0)
+        esh_sys_fatal_error("sigprocmask: ");
+
+    if ((signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC)) < 0)
+        esh_sys_fatal_error("signalfd: ");
+
+    if ((epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+        esh_sys_fatal_error("epoll_create1: ");
+
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = &sigchld_source };
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, signal_fd, &ev) < 0)
+        esh_sys_fatal_error("epoll_ctl: ");
+
+    if (!watch_stdin)
+        return;
+
+    //stdin is registered but only watched while readline shows a prompt
+    ev.events = 0;
+    ev.data.ptr = &input_source;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, STDIN_FILENO, &ev) < 0)
+        esh_sys_fatal_error("epoll_ctl: ");
+
+    //Prompt fragments made on threads of their own are shown once ready
+    ev.events = EPOLLIN;
+    ev.data.ptr = &prompt_source;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, esh_prompt_notify_fd(), &ev) < 0)
+        esh_sys_fatal_error("epoll_ctl: ");
+}
+
+/**
+ * Adds a newly started command's pidfd to the event loop, so that its exit
+ * is handled as soon as it happens.
+ *
+ * cmd - The command
+**/
+static void watch_command(struct esh_command *cmd)
+{
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = cmd };
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, cmd->pidfd, &ev) < 0)
+        esh_sys_fatal_error("epoll_ctl: ");
+}
+
+/**
+ * Starts or stops watching stdin. While a foreground job owns the terminal,
+ * the shell must not read from it.
+ *
+ * watch - Whether to watch stdin
+**/
+static void watch_input(bool watch)
+{
+    struct epoll_event ev = { .events = watch ? EPOLLIN : 0, .data.ptr = &input_source };
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, STDIN_FILENO, &ev) < 0)
+        esh_sys_fatal_error("epoll_ctl: ");
+}
+
+/**
+ * Watches the jobserver's pipe while a queued job waits for one of its tokens,
+ * or tokens are owed to it after it shrank, and stops watching it otherwise.
+**/
+static void watch_jobserver(void)
+{
+    int fd = esh_jobserver_wants_fd() ? esh_jobserver_fd() : -1;
+    if (fd == jobserver_fd)
+        return;
+
+    //Commands share the pipe, so closing it would not remove it from epoll
+    if (jobserver_fd != -1 && epoll_ctl(epoll_fd, EPOLL_CTL_DEL, jobserver_fd, NULL) < 0)
+        esh_sys_fatal_error("epoll_ctl: ");
+
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = &jobserver_source };
+    if (fd != -1 && epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0)
+        esh_sys_fatal_error("epoll_ctl: ");
+    jobserver_fd = fd;
+}
+
+/**
+ * Waits for events and handles all of them in one batch: exits reported by
+ * pidfds, stops reported through signal_fd, prompt fragments that became
+ * ready, jobserver tokens that came back and, if a prompt is showing, input
+ * for readline. Input is handled last, because running the entered command
+ * line may free commands whose events are still in this batch.
+ *
+ * Return: the number of events handled in this wakeup
+**/
+static int handle_events(void)
+{
+    struct epoll_event events[8];
+    int n = epoll_wait(epoll_fd, events, sizeof events / sizeof events[0], -1);
+    if (n < 0)
+    {
+        if (errno != EINTR)
+            esh_sys_fatal_error("epoll_wait: ");
+        return 0;
+    }
+
+    int i, handled = 0;
+    bool input_ready = false, prompt_ready = false;
+    for (i = 0; i < n; i++)
+    {
+        if (events[i].data.ptr == &sigchld_source)
+        {
+            handled += reap_stopped_children();
         }
+        else if (events[i].data.ptr == &input_source)
+        {
+            input_ready = input_active;
+        }
+        else if (events[i].data.ptr == &prompt_source)
+        {
+            prompt_ready = true;
+        }
+        else if (events[i].data.ptr == &jobserver_source)
+        {
+            //A token came back; queued jobs may start
+            esh_jobserver_readable();
+            start_queued_jobs();
+            handled++;
+        }
+        else
+        {
+            handled += reap_command(events[i].data.ptr);
+        }
+    }
+
+    if (prompt_ready)
+    {
+        //Redraw the prompt in place, keeping what the user has typed, unless
+        //a plugin replaced build_prompt
+        const char *prompt = esh_prompt_refresh();
+        if (prompt != NULL && input_active
+            && shell.build_prompt == build_prompt_from_plugins)
+        {
+            rl_set_prompt(prompt);
+            rl_forced_update_display();
+        }
+        handled++;
+    }
+
+    if (input_ready)
+    {
+        rl_callback_read_char();
+        handled++;
     }
+
+    stat_wakeups++;
+    stat_events += handled;
+    if (handled > stat_max_batch)
+        stat_max_batch = handled;
+    if (verbose)
+        fprintf(stderr, "esh: wakeup %lu handled %d events\n", stat_wakeups, handled);
+
+    return handled;
 }
 
 /**
@@ -161,37 +433,114 @@ static void possible_job_update(int status, pid_t pid)
 **/
 static void give_terminal_to(pid_t pgrp, struct termios *pg_tty_state)
 {
+  //Without job control, jobs share the shell's process group and terminal
+  if (!job_control)
+    return;
+
   esh_signal_block(SIGTTOU);
+  double t = ESH_TRACE_START();
   int rc = tcsetpgrp(esh_sys_tty_getfd(), pgrp);
   if (rc == -1)
     esh_sys_fatal_error("tcsetpgrp: ");
+  ESH_TRACE_SPAN("tcsetpgrp", t, NULL);
 
   if (pg_tty_state)
+  {
+    t = ESH_TRACE_START();
     esh_sys_tty_restore(pg_tty_state);
+    ESH_TRACE_SPAN("tcsetattr", t, NULL);
+  }
   esh_signal_unblock(SIGTTOU);
 }
 
+/**
+ * Hands the terminal to a foreground job and runs the event loop until every
+ * process in the job has exited or the job was stopped. Only then does the
+ * shell take the terminal back.
+ *
+ * job - The foreground job
+**/
+static void wait_for_job(struct esh_pipeline *job)
+{
+    int jid = job->jid;
+    give_terminal_to(job->pgrp, shell_termios);
+
+    //The job is freed by the event loop once all its processes are reaped
+    double t = ESH_TRACE_START();
+    while ((job = esh_jobs_find_jid(jid)) != NULL && job->status == FOREGROUND)
+    {
+        handle_events();
+    }
+    ESH_TRACE_SPAN("wait", t, NULL);
+
+    give_terminal_to(getpgrp(), shell_termios);
+}
+
+/**
+ * Sends a signal to every process of a job. While the process group leader
+ * has not been reaped, its process group cannot have been reused, so the
+ * whole group, grandchildren included, is signalled at once. Afterwards each
+ * remaining process is signalled through its pidfd, which cannot refer to a
+ * different process even if the pid was reused. Without job control the job
+ * has no process group of its own and is always signalled through pidfds.
+ *
+ * job - The job to signal
+ * sig - The signal to send
+ * Return: 0 on success, -1 on error
+**/
+static int signal_job(struct esh_pipeline *job, int sig)
+{
+    ESH_TRACE_INSTANT("signal", 0, strsignal(sig));
+    if (job_control && esh_jobs_find_pid(job->pgrp) != NULL)
+        return kill(-(job->pgrp), sig);
+
+    struct list_elem *c = list_begin (&job->commands);
+    for (; c != list_end (&job->commands); c = list_next (c))
+    {
+        struct esh_command *cmd = list_entry(c, struct esh_command, elem);
+        if (cmd->pidfd != -1 && pidfd_send_signal(cmd->pidfd, sig, NULL, 0) < 0
+            && errno != ESRCH)
+            return -1;
+    }
+    return 0;
+}
+
 /**
  * Kills the job with the given jobID. Essentially sends a SIGTERM to all processes
- * in the jobID group that way they can safely terminate. Will also remove the job
- * from the job list.
+ * in the jobID group that way they can safely terminate. A job that has a cgroup
+ * is killed through it instead, which also removes processes that left its group.
+ * The job is removed from the job list once its processes have been reaped.
  *
- * jobID - The id of the job to terminate
+ * argv - The arguments of the kill command, argv[1] being the id of the job
 **/
-static void killJob(int jobID)
+static void killJob(char **argv)
 {
-    struct list_elem *e = list_begin (&jobs_list);
+    if (argv[1] == NULL)
+    {
+        printf("kill: usage: kill jobid\n");
+        return;
+    }
 
-    for(; e != list_end(&jobs_list); e = list_next(e))
+    struct esh_pipeline *job = esh_jobs_find_jid(atoi(argv[1]));
+
+    if (job != NULL && job->status == QUEUED)
     {
-        struct esh_pipeline *job = list_entry(e, struct esh_pipeline, elem);
-        if (job->jid == jobID)
-        {
-            if (kill(-(job->pgrp), SIGTERM) < 0)
-                esh_sys_fatal_error("Error kill: killJob SIGTERM Error");
-            list_remove(e);
-            break;
-        }
+        //Nothing was started, the job is only dropped
+        esh_jobs_remove(job);
+        esh_pipeline_free(job);
+    }
+    else if (job != NULL && job->cgroup != NULL && esh_cgroup_kill(job->cgroup))
+    {
+        ESH_TRACE_INSTANT("signal", 0, "cgroup.kill");
+    }
+    else if (job != NULL)
+    {
+        if (signal_job(job, SIGTERM) < 0)
+            esh_sys_fatal_error("Error kill: killJob SIGTERM Error");
+
+        //A stopped process only acts on SIGTERM once it is continued
+        if (signal_job(job, SIGCONT) < 0)
+            esh_sys_fatal_error("Error kill: killJob SIGCONT Error");
     }
 }
 
@@ -200,37 +549,46 @@ static void killJob(int jobID)
  * group. These processes can later be continued by using the fg and bg commands
  * builtin to esh.
  *
- * jobID - The id of the job to stop
+ * argv - The arguments of the stop command, argv[1] being the id of the job
 **/
-static void stopJob(int jobID)
+static void stopJob(char **argv)
 {
-    struct list_elem *e = list_begin (&jobs_list);
+    if (argv[1] == NULL)
+    {
+        printf("stop: usage: stop jobid\n");
+        return;
+    }
 
-    for(; e != list_end(&jobs_list); e = list_next(e))
+    struct esh_pipeline *job = esh_jobs_find_jid(atoi(argv[1]));
+
+    if (job != NULL && job->status == QUEUED)
     {
-        struct esh_pipeline *job = list_entry(e, struct esh_pipeline, elem);
-        if (job->jid == jobID)
-        {
-            job->status = BACKGROUND;
-            if (kill(-(job->pgrp), SIGSTOP) < 0)
-                esh_sys_fatal_error("Error stop: stopJob SIGSTOP Error");
-            break;
-        }
+        printf("stop: job %d is queued\n", job->jid);
+    }
+    else if (job != NULL)
+    {
+        job->status = BACKGROUND;
+        if (signal_job(job, SIGSTOP) < 0)
+            esh_sys_fatal_error("Error stop: stopJob SIGSTOP Error");
     }
 }
 
 /**
  * Shows the user the list of all jobs that are currently running and stopped
  * by the terminal. They are provided the jobid, the status of the process and
- * what command was entered for that process.
- *
+ * what command was entered for that process. A job in a cgroup of its own is
+ * followed by what the cgroup uses. With 'jobs -l', each job is followed by
+ * the pid, elapsed time and resource usage of every command.
  *
+ * argv - The arguments of the jobs command; "-l" asks for per-command details
 **/
-static void showJobs()
+static void showJobs(char **argv)
 {
-    struct list_elem *e = list_begin (&jobs_list);
+    bool longFormat = argv[1] != NULL && strcmp(argv[1], "-l") == 0;
+    struct list *jobs_list = esh_jobs_get_list();
+    struct list_elem *e = list_begin (jobs_list);
 
-    for(; e != list_end(&jobs_list); e = list_next(e))
+    for(; e != list_end(jobs_list); e = list_next(e))
     {
         struct esh_pipeline *job = list_entry(e, struct esh_pipeline, elem);
         struct list_elem *c = list_begin (&job->commands);
@@ -244,6 +602,76 @@ static void showJobs()
         {
             printf("[%d] Stopped   (%s %s)\n", job->jid, cmd->argv[0], cmd->argv[1]);
         }
+        else if (job->status == QUEUED)
+        {
+            printf("[%d] Queued    (%s %s)\n", job->jid, cmd->argv[0], cmd->argv[1]);
+        }
+
+        //What the job's cgroup uses, grandchildren included
+        if (job->cgroup != NULL)
+        {
+            esh_cgroup_print_usage(job->cgroup);
+        }
+
+        if (longFormat)
+        {
+            esh_pipeline_print_usage(job);
+        }
+    }
+}
+
+/**
+ * Implements the 'times' builtin. Like in POSIX shells, prints the user and
+ * system time used by the shell and by all of its reaped children, then shows
+ * per-command resource usage of the most recently finished job.
+ *
+ * argv - The arguments of the times command, which takes none
+**/
+static void showTimes(char **argv)
+{
+    struct rusage self, children;
+    getrusage(RUSAGE_SELF, &self);
+    getrusage(RUSAGE_CHILDREN, &children);
+
+    printf("%ldm%ld.%03lds %ldm%ld.%03lds\n",
+           self.ru_utime.tv_sec / 60, self.ru_utime.tv_sec % 60, self.ru_utime.tv_usec / 1000,
+           self.ru_stime.tv_sec / 60, self.ru_stime.tv_sec % 60, self.ru_stime.tv_usec / 1000);
+    printf("%ldm%ld.%03lds %ldm%ld.%03lds\n",
+           children.ru_utime.tv_sec / 60, children.ru_utime.tv_sec % 60, children.ru_utime.tv_usec / 1000,
+           children.ru_stime.tv_sec / 60, children.ru_stime.tv_sec % 60, children.ru_stime.tv_usec / 1000);
+
+    if (last_job != NULL)
+    {
+        printf("Last job [%d]:\n", last_job->jid);
+        esh_pipeline_print_usage(last_job);
+    }
+}
+
+/**
+ * Inspects or resets the cache of resolved command names. Without arguments
+ * the cached commands are listed with their hit counts; -r empties the cache;
+ * otherwise each argument is looked up and added to the cache.
+ *
+ * argv - The arguments of the hash command, argv[0] being "hash"
+**/
+static void hashCommands(char **argv)
+{
+    if (argv[1] == NULL)
+    {
+        esh_path_cache_print();
+    }
+    else if (strcmp(argv[1], "-r") == 0)
+    {
+        esh_path_cache_clear();
+    }
+    else
+    {
+        int i;
+        for (i = 1; argv[i] != NULL; i++)
+        {
+            if (esh_path_resolve(argv[i]) == NULL)
+                printf("hash: %s: not found\n", argv[i]);
+        }
     }
 }
 
@@ -252,37 +680,44 @@ static void showJobs()
  * take over control of the terminal until it is stopped, killed, or has finised
  * running.
  *
- * jobID - The id of the job to bring to the foreground
+ * argv - The arguments of the fg command, argv[1] being the id of the job
 **/
-static void fg(int jobID)
+static void fg(char **argv)
 {
-    struct list_elem *e = list_begin (&jobs_list);
-    esh_signal_block(SIGCHLD);
+    if (argv[1] == NULL)
+    {
+        printf("fg: usage: fg jobid\n");
+        return;
+    }
+
+    struct esh_pipeline *job = esh_jobs_find_jid(atoi(argv[1]));
 
-    for(; e != list_end(&jobs_list); e = list_next(e))
+    if (job != NULL)
     {
-        struct esh_pipeline *job = list_entry(e, struct esh_pipeline, elem);
         struct list_elem *c = list_begin (&job->commands);
         struct esh_command *cmd = list_entry(c, struct esh_command, elem);
 
-        if (job->jid == jobID)
+        printf("%s %s\n", cmd->argv[0], cmd->argv[1]);
+        if (job->status == QUEUED)
         {
-            printf("%s %s\n", cmd->argv[0], cmd->argv[1]);
+            //A queued job is started right away, without a slot
+            esh_jobs_unqueue(job);
             job->status = FOREGROUND;
-            if (kill(-(job->pgrp), SIGCONT) < 0)
-                esh_sys_fatal_error("Error fg: fg SIGCONT Error");
-            give_terminal_to(job->pgrp, shell_termios);
-            int status;
-            pid_t id;
-            if ((id = waitpid(job->pgrp, &status, WUNTRACED)) < 0)
+            if (!start_pipeline(job))
             {
-                printf("ERROR");
+                esh_jobs_remove(job);
+                esh_pipeline_free(job);
+                return;
             }
-            possible_job_update(status, id);
-            give_terminal_to(getpgrp(), shell_termios);
-            esh_signal_unblock(SIGCHLD);
-            break;
+            esh_jobs_started(job);
+        }
+        else
+        {
+            job->status = FOREGROUND;
+            if (signal_job(job, SIGCONT) < 0)
+                esh_sys_fatal_error("Error fg: fg SIGCONT Error");
         }
+        wait_for_job(job);
     }
 }
 
@@ -291,430 +726,893 @@ static void fg(int jobID)
  * the process to continue running but it will be in the background that way the
  * user still has control of the shell.
  *
- * jobID - The id of the job to continue in the background
+ * argv - The arguments of the bg command, argv[1] being the id of the job
 **/
-static void bg(int jobID)
+static void bg(char **argv)
 {
-    struct list_elem *e = list_begin (&jobs_list);
+    if (argv[1] == NULL)
+    {
+        printf("bg: usage: bg jobid\n");
+        return;
+    }
+
+    struct esh_pipeline *job = esh_jobs_find_jid(atoi(argv[1]));
 
-    for(; e != list_end(&jobs_list); e = list_next(e))
+    if (job != NULL)
     {
-        struct esh_pipeline *job = list_entry(e, struct esh_pipeline, elem);
         struct list_elem *c = list_begin (&job->commands);
         struct esh_command *cmd = list_entry(c, struct esh_command, elem);
 
-        if (job->jid == jobID)
+        //A queued job starts in the background once it gets a slot
+        if (job->status == QUEUED)
         {
-            job->status = BACKGROUND;
-            if (kill(-(job->pgrp), SIGCONT) < 0)
-                esh_sys_fatal_error("Error bg: bg SIGCONT Error");
-            printf("[%d] %s\n", job->jid, cmd->argv[0]);
-            break;
+            printf("bg: job %d is queued\n", job->jid);
+            return;
         }
+
+        job->status = BACKGROUND;
+        if (signal_job(job, SIGCONT) < 0)
+            esh_sys_fatal_error("Error bg: bg SIGCONT Error");
+        printf("[%d] %s\n", job->jid, cmd->argv[0]);
     }
 }
 
-static void
-usage(char *progname)
+/**
+ * Interrupts the jobs of a 'parallel' group: running jobs are sent SIGINT,
+ * queued ones are dropped without being started.
+ *
+ * group - The group
+**/
+static void interruptGroup(struct esh_job_group *group)
 {
-    printf("Usage: %s -h\n"
-        " -h            print this help\n"
-        " -p  plugindir directory from which to load plug-ins\n",
-        progname);
+    struct list *jobs_list = esh_jobs_get_list();
+    struct list_elem *e = list_begin (jobs_list);
 
-    exit(EXIT_SUCCESS);
+    while (e != list_end (jobs_list))
+    {
+        struct esh_pipeline *job = list_entry(e, struct esh_pipeline, elem);
+        e = list_next (e);
+        if (job->group != group)
+            continue;
+
+        if (job->status == QUEUED)
+        {
+            esh_jobs_remove(job);
+            esh_pipeline_free(job);
+        }
+        else if (signal_job(job, SIGINT) < 0 || signal_job(job, SIGCONT) < 0)
+        {
+            esh_sys_error("parallel: ");
+        }
+    }
 }
 
-/* Build a prompt by assembling fragments from loaded plugins that 
- * implement 'make_prompt.'
+/**
+ * Implements the 'parallel' builtin. 'parallel cmd args ::: a b c' runs
+ * 'cmd args a', 'cmd args b' and 'cmd args c' as background jobs, at most N of
+ * them at a time; the others are queued and started as running ones exit. The
+ * shell waits until every job of the group has finished, or one of them was
+ * stopped. While it waits, ^C interrupts the whole group. The status is 1 if
+ * any command failed.
  *
- * This function demonstrates how to iterate over all loaded plugins.
- */
-static char *
-build_prompt_from_plugins(void)
+ * argv - "parallel", then optionally "-j" and N, which defaults to the number
+ *        of online CPUs, then the command, ":::" and the arguments
+**/
+static void parallelJobs(char **argv)
 {
-    char *prompt = NULL;
-    struct list_elem * e = list_begin(&esh_plugin_list);
+    int max = sysconf(_SC_NPROCESSORS_ONLN);
+    int i = 1;
+
+    if (argv[1] != NULL && strcmp(argv[1], "-j") == 0)
+    {
+        max = argv[2] != NULL ? atoi(argv[2]) : 0;
+        i = 3;
+    }
+
+    int cmd = i;
+    while (argv[i] != NULL && strcmp(argv[i], ":::") != 0)
+        i++;
+    if (max <= 0 || i == cmd || argv[i] == NULL)
+    {
+        printf("parallel: usage: parallel [-j N] command [args] ::: arg...\n");
+        last_status = 2;
+        return;
+    }
+
+    //The words of the command came from the parser, so a line made of them
+    //parses to the same words
+    struct esh_strbuf line;
+    esh_strbuf_init(&line, 0);
+
+    struct esh_job_group *group = esh_jobs_group_create(max);
+    int arg;
+    for (arg = i + 1; argv[arg] != NULL; arg++)
+    {
+        esh_strbuf_clear(&line);
+        int w;
+        for (w = cmd; w < i; w++)
+        {
+            esh_strbuf_append(&line, argv[w], strlen(argv[w]));
+            esh_strbuf_append(&line, " ", 1);
+        }
+        esh_strbuf_append(&line, argv[arg], strlen(argv[arg]));
 
-    for (; e != list_end(&esh_plugin_list); e = list_next(e)) {
-        struct esh_plugin *plugin = list_entry(e, struct esh_plugin, elem);
+        //The pipeline is copied, so the command line can go right away
+        struct esh_command_line *cline = shell.parse_command_line(line.buf);
+        if (cline == NULL || list_empty(&cline->pipes))
+        {
+            group->failed++;
+            if (cline != NULL)
+                esh_command_line_free(cline);
+            continue;
+        }
 
-        if (plugin->make_prompt == NULL)
+        struct esh_pipeline *pipeline = esh_pipeline_copy(list_entry(list_front(&cline->pipes), struct esh_pipeline, elem));
+        esh_command_line_free(cline);
+        if (esh_plugin_process_pipeline(pipeline))
+        {
+            esh_pipeline_free(pipeline);
             continue;
+        }
 
-        /* append prompt fragment created by plug-in */
-        char * p = plugin->make_prompt();
-        if (prompt == NULL) {
-            prompt = p;
-        } else {
-            prompt = realloc(prompt, strlen(prompt) + strlen(p) + 1);
-            strcat(prompt, p);
-            free(p);
+        pipeline->group = group;
+        pipeline->bg_job = true;
+        pipeline->jid = 0;
+        run_background(pipeline);
+    }
+    esh_strbuf_free(&line);
+
+    //The jobs run in the background, so ^C is sent to the shell. It is read
+    //from signal_fd while the shell waits, and passed on to the group.
+    sigset_t mask, old;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigprocmask(SIG_BLOCK, &mask, &old);
+    sigaddset(&mask, SIGCHLD);
+    if (signalfd(signal_fd, &mask, 0) < 0)
+        esh_sys_fatal_error("signalfd: ");
+
+    interrupted = false;
+    while (group->njobs > 0 && !group->stopped)
+    {
+        handle_events();
+        if (interrupted)
+        {
+            interruptGroup(group);
+            interrupted = false;
         }
     }
 
-    /* default prompt */
-    if (prompt == NULL)
-        prompt = strdup("esh> ");
-
-    return prompt;
+    //A ^C that came after the last job ended must not reach the shell
+    struct timespec now = { 0, 0 };
+    sigdelset(&mask, SIGCHLD);
+    while (sigtimedwait(&mask, NULL, &now) > 0)
+        continue;
+    sigaddset(&mask, SIGCHLD);
+    sigdelset(&mask, SIGINT);
+    if (signalfd(signal_fd, &mask, 0) < 0)
+        esh_sys_fatal_error("signalfd: ");
+    sigprocmask(SIG_SETMASK, &old, NULL);
+
+    last_status = group->failed > 0 ? 1 : 0;
+    esh_jobs_group_done(group);
 }
 
-/* The shell object plugins use.
- * Some methods are set to defaults.
- */
-struct esh_shell shell =
-{
-    .build_prompt = build_prompt_from_plugins,
-    .readline = readline,       /* GNU readline(3) */ 
-    .parse_command_line = esh_parse_command_line /* Default parser */
-};
-
-int
-main(int ac, char *av[])
+/**
+ * Implements the 'jobs-max' builtin, which limits how many background jobs
+ * run at once. Background jobs started beyond the limit are queued. Without
+ * an argument the current limit is printed; 0 means no limit.
+ *
+ * argv - "jobs-max", then optionally the new limit
+**/
+static void setJobsMax(char **argv)
 {
-    int opt;
-    list_init(&esh_plugin_list);
-    list_init(&jobs_list); //Initialize the jobs list
-
-    /* Process command-line arguments. See getopt(3) */
-    while ((opt = getopt(ac, av, "hp:")) > 0) {
-        switch (opt) {
-        case 'h':
-            usage(av[0]);
-            break;
+    if (argv[1] == NULL)
+    {
+        printf("%d\n", esh_jobs_get_max());
+        return;
+    }
 
-        case 'p':
-            esh_plugin_load_from_directory(optarg);
-            break;
-        }
+    char *end;
+    long max = strtol(argv[1], &end, 10);
+    if (*end != '\0' || end == argv[1] || max < 0)
+    {
+        printf("jobs-max: usage: jobs-max [N]\n");
+        return;
     }
 
-    esh_plugin_initialize(&shell);
+    esh_jobs_set_max(max);
 
-    //Set the initial state of the shell, give it a pid, and hand the terminal
-    //over to it
-    shell_termios = esh_sys_tty_init();
+    //Slots may have been freed by raising the limit
+    start_queued_jobs();
+}
 
-    setpgid(0, 0);
-    give_terminal_to(getpgrp(), shell_termios);
+/**
+ * Implements the 'jobserver' builtin. 'jobserver N' makes esh a GNU make
+ * jobserver with N tokens, which commands it launches find in MAKEFLAGS and
+ * its own background jobs take as well; 'jobserver 0' removes it. Without an
+ * argument the pool is shown.
+ *
+ * argv - "jobserver", then optionally the number of tokens
+**/
+static void setJobserver(char **argv)
+{
+    if (argv[1] == NULL)
+    {
+        esh_jobserver_print();
+        return;
+    }
 
-    int numJobs = 1;
+    char *end;
+    long n = strtol(argv[1], &end, 10);
+    if (*end != '\0' || end == argv[1] || n < 0 || n > 4096)
+    {
+        printf("jobserver: usage: jobserver [N]\n");
+        return;
+    }
 
-    /* Read/eval loop. */
-    for (;;) {
-        /* Do not output a prompt unless shell's stdin is a terminal */
-        char * prompt = isatty(0) ? shell.build_prompt() : NULL;
-        char * cmdline = shell.readline(prompt);
-        free (prompt);
+    //The pipe may be replaced; it is watched again as needed
+    int fd = jobserver_fd;
+    jobserver_fd = -1;
+    if (fd != -1 && epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL) < 0)
+        esh_sys_fatal_error("epoll_ctl: ");
 
-        if (cmdline == NULL)  /* User typed EOF */
-            break;
+    if (!esh_jobserver_set(n))
+        last_status = 1;
 
-        struct esh_command_line * cline = shell.parse_command_line(cmdline);
-        free (cmdline);
-        if (cline == NULL)                  /* Error in command line */
-            continue;
+    //New tokens may let queued jobs start
+    start_queued_jobs();
+}
 
-        if (list_empty(&cline->pipes)) {    /* User hit enter */
-            esh_command_line_free(cline);
-            continue;
-        }
+/**
+ * Implements the 'limit' builtin, which limits what a job that has a cgroup of
+ * its own may use: 'cpu=P' caps it at P percent of one CPU, 'mem=SIZE' at SIZE
+ * bytes of memory, with an optional K, M or G suffix, and 'pids=N' at N
+ * processes. A limit of 'max' removes it. Without limits to set, the job's
+ * current limits are shown.
+ *
+ * argv - "limit", the id of the job, then the limits
+**/
+static void limitJob(char **argv)
+{
+    if (argv[1] == NULL)
+    {
+        printf("limit: usage: limit jobid [cpu=percent] [mem=size] [pids=n]\n");
+        return;
+    }
 
-/////////////////////////////////////////////////////////////
+    struct esh_pipeline *job = esh_jobs_find_jid(atoi(argv[1]));
+    if (job == NULL || job->cgroup == NULL)
+    {
+        printf("limit: job %s has no cgroup; see esh -g\n", argv[1]);
+        last_status = 1;
+        return;
+    }
 
-        esh_signal_sethandler(SIGCHLD, esh_sighandler);
-     
-        struct list_elem *e = list_begin (&cline->pipes);
+    if (argv[2] == NULL)
+    {
+        esh_cgroup_print_limits(job->cgroup);
+        return;
+    }
 
-        //If the job list is empty, the first job will be 1
-        if (list_empty(&jobs_list))
+    int i;
+    for (i = 2; argv[i] != NULL; i++)
+    {
+        char value[64];
+        bool ok;
+        if (strncmp(argv[i], "cpu=", 4) == 0)
         {
-            numJobs = 1;
+            char *end;
+            long percent = strtol(argv[i] + 4, &end, 10);
+            if (strcmp(argv[i] + 4, "max") == 0)
+            {
+                ok = esh_cgroup_set(job->cgroup, "cpu.max", "max 100000");
+            }
+            else if (*end != '\0' || end == argv[i] + 4 || percent <= 0)
+            {
+                printf("limit: invalid cpu percentage %s\n", argv[i] + 4);
+                ok = false;
+            }
+            else
+            {
+                //The quota of each 100ms period
+                snprintf(value, sizeof value, "%ld 100000", percent * 1000);
+                ok = esh_cgroup_set(job->cgroup, "cpu.max", value);
+            }
+        }
+        else if (strncmp(argv[i], "mem=", 4) == 0)
+        {
+            ok = esh_cgroup_set(job->cgroup, "memory.max", argv[i] + 4);
         }
-        else //Otherwise we get the highest jid and add 1 to it
+        else if (strncmp(argv[i], "pids=", 5) == 0)
         {
-            struct list_elem *j = list_back (&jobs_list);
-            struct esh_pipeline *job = list_entry (j, struct esh_pipeline, elem);
-            numJobs = job->jid + 1;
+            ok = esh_cgroup_set(job->cgroup, "pids.max", argv[i] + 5);
+        }
+        else
+        {
+            printf("limit: unknown limit %s\n", argv[i]);
+            ok = false;
         }
 
+        if (!ok)
+            last_status = 1;
+    }
+}
 
-        for (; e != list_end (&cline->pipes); e = list_next (e)) 
-        {
-            bool ranBuiltIn = false;
-            bool ranPlugin = false;
-            struct esh_pipeline *pipeline = list_entry(e, struct esh_pipeline, elem);
+/**
+ * Implements the 'pin' builtin. 'pin auto' pins each new job to CPUs that share
+ * a cache, spreading jobs over the caches, and 'pin off' stops doing so. 'pin
+ * JID cpulist' pins a job, including its running commands, to the CPUs in
+ * cpulist, such as 0-3,8. Without arguments the cache domains and the jobs
+ * pinned to CPUs are shown.
+ *
+ * argv - "pin", then "auto", "off", or the id of a job and a cpulist
+**/
+static void pinJob(char **argv)
+{
+    if (argv[1] == NULL)
+    {
+        esh_placement_print();
+    }
+    else if (strcmp(argv[1], "auto") == 0 || strcmp(argv[1], "off") == 0)
+    {
+        esh_placement_set_auto(strcmp(argv[1], "auto") == 0);
+    }
+    else if (argv[2] == NULL)
+    {
+        printf("pin: usage: pin [auto | off | jobid cpulist]\n");
+    }
+    else
+    {
+        struct esh_pipeline *job = esh_jobs_find_jid(atoi(argv[1]));
+        if (job == NULL)
+            printf("pin: no job %s\n", argv[1]);
+        else if (esh_placement_pin(job, argv[2]))
+            return;
+        last_status = 1;
+    }
+}
 
-            pipeline->jid = numJobs++;
-            pipeline->pgrp = -1;
+//The builtins the shell implements itself. The builtin registry hashes these
+//names perfectly; see esh-builtins.c before adding one.
+static const struct
+{
+    const char *name;
+    void (*run)(char **argv);
+} coreBuiltins[] =
+{
+    { "kill", killJob },
+    { "stop", stopJob },
+    { "jobs", showJobs },
+    { "fg", fg },
+    { "bg", bg },
+    { "times", showTimes },
+    { "hash", hashCommands },
+    { "parallel", parallelJobs },
+    { "jobs-max", setJobsMax },
+    { "jobserver", setJobserver },
+    { "limit", limitJob },
+    { "pin", pinJob },
+};
 
-            int pipe1[2]; //Our pipe
-            int fd2 = 0; //A file descriptor to assist the pipe
-            bool piped = false;
-            int *pipeArray[50]; //A suitable size for the possible number of pipes
-            int count = 0;
+static void
+usage(char *progname)
+{
+    printf("Usage: %s [-ghv] [-p plugindir] [-T tracefile] [-c cmdline | script]\n"
+        " -g            run every job in a cgroup of its own\n"
+        " -h            print this help\n"
+        " -p  plugindir directory from which to load plug-ins\n"
+        " -T  tracefile write a Chrome trace-event JSON trace to tracefile\n"
+        " -v            report events handled per event loop wakeup\n"
+        " -c  cmdline   run cmdline instead of reading commands\n"
+        " script        run the commands in file script\n"
+        "Exits with the status of the last foreground pipeline.\n",
+        progname);
 
-            //If we have more than 1 command, we are piped
-            if (list_size(&pipeline->commands) > 1)
-            {
-                piped = true;
-            }
-                    
-            struct list_elem * p = list_begin (&pipeline->commands);
-            struct list_elem *cmdTail = list_tail(&pipeline->commands);
-            pid_t pid;
+    exit(EXIT_SUCCESS);
+}
 
-            for (; p != list_end (&pipeline->commands); p = list_next (p)) 
-            {
-                struct esh_command *cmd = list_entry(p, struct esh_command, elem);
+/* Build a prompt by assembling fragments from loaded plugins that 
+ * implement 'make_prompt.'  The shell itself uses esh_prompt_compose(),
+ * which does not copy the prompt.
+ */
+static char *
+build_prompt_from_plugins(void)
+{
+    return strdup(esh_prompt_compose());
+}
 
-                struct list_elem *plug = list_begin(&esh_plugin_list);
-                for (; plug != list_end(&esh_plugin_list); plug = list_next(plug))
-                {
-                    struct esh_plugin *plugin = list_entry (plug, struct esh_plugin, elem);
+/* The shell object plugins use.
+ * Some methods are set to defaults.
+ */
+struct esh_shell shell =
+{
+    .get_jobs = esh_jobs_get_list,
+    .get_job_from_jid = esh_jobs_find_jid,
+    .get_job_from_pgrp = esh_jobs_find_pgrp,
+    .get_cmd_from_pid = esh_jobs_find_pid,
+    .build_prompt = build_prompt_from_plugins,
+    .readline = readline,       /* GNU readline(3) */ 
+    .parse_command_line = esh_parse_command_line, /* Default parser */
+    .invalidate_prompt = esh_prompt_invalidate
+};
 
-                    if (plugin->process_builtin(cmd))
-                    {
-                        ranPlugin = true;
-                        continue;
-                    }
-                }
+/**
+ * Runs the commands of a pipeline. Builtins run in the shell, other commands
+ * are spawned into the job's process group, which the first of them creates.
+ * The commands of a process substitution are started before the command whose
+ * argument it is, and belong to the job like any other.
+ *
+ * pipeline - The pipeline, whose pgrp is -1. Unless it was queued, it gets its
+ *            jid once its builtins have run, since they may add jobs.
+ * Return: true if a process was started, which makes the pipeline a job
+**/
+static bool start_pipeline(struct esh_pipeline *pipeline)
+{
+    double pipeline_start = ESH_TRACE_START();
 
-                if (!ranPlugin)
+    //With 'pin auto', the job gets CPUs that share a cache
+    esh_placement_assign(pipeline);
+
+    //Connects the stages of the pipeline, one pipe per adjacent pair, and
+    //those of its process substitutions, which run before their command
+    struct esh_pipe_wiring wiring, substWiring;
+    esh_wiring_init(&wiring, esh_pipeline_nstages(pipeline));
+
+    struct list_elem * p = list_begin (&pipeline->commands);
+
+    for (; p != list_end (&pipeline->commands); p = list_next (p)) 
+    {
+        struct esh_command *cmd = list_entry(p, struct esh_command, elem);
+        struct esh_pipe_wiring *w = cmd->substitution ? &substWiring : &wiring;
+        if (cmd->substitution)
+            esh_subst_begin_command(w, cmd);
+        else
+            esh_wiring_begin_stage(w);
+
+        //One lookup tells whether the command is a builtin, and whose.
+        //Plugins get the first chance to run it.
+        struct esh_builtin *builtin = esh_builtin_find(cmd->argv[0]);
+        double t = ESH_TRACE_START();
+        bool ranPlugin = (builtin != NULL && builtin->plugin != NULL
+                          && builtin->plugin->process_builtin(cmd))
+                         || esh_plugin_process_builtin(cmd);
+        ESH_TRACE_SPAN("plugins", t, cmd->argv[0]);
+
+        if (!ranPlugin)
+        {
+            if (builtin != NULL && builtin->run != NULL)
+            {
+                t = ESH_TRACE_START();
+                builtin->run(cmd->argv);
+                ESH_TRACE_SPAN("builtin", t, cmd->argv[0]);
+            }
+            else //We have to execute a command that isn't builtin
+            {
+                //A background job that ran builtins first takes its slot now.
+                //Its builtins have run, so it cannot be queued any more; if
+                //no slot or jobserver token is free, it runs without one.
+                if (pipeline->bg_job && !pipeline->holds_slot)
+                    esh_jobs_take_slot(pipeline);
+
+                //With -g, the job gets a cgroup before its first process
+                if (pipeline->cgroup == NULL && esh_cgroup_enabled())
+                    pipeline->cgroup = esh_cgroup_create();
+
+                //Spawn the child straight into the job's process group
+                pid_t pgrp = job_control ? pipeline->pgrp : 0;
+                if (esh_launch_command(cmd, pgrp, w->infd, w->outfd) == -1)
                 {
-                    //Check if command is builtin
-                    if (esh_isBuiltIn(cmd->argv[0]))
-                    {
-                        /*
-                        We are given a small number of builtin commands initially. Therefore
-                        for now we can easily just do a simple if else loop through the builtin
-                        commands to see which one was entered. If we were to add many more, we could
-                        easily rewrite this to handle the expansion.
-                        */
-                        ranBuiltIn = true;
-                        if (strcmp(cmd->argv[0], "kill") == 0)
-                        {
-                            if (cmd->argv[1] == NULL)
-                            {
-                                printf("kill: usage: kill jobid\n");
-                            }
-                            else
-                            {
-                                killJob(atoi(cmd->argv[1]));
-                            }
-                        }
-                        else if (strcmp(cmd->argv[0], "stop") == 0)
-                        {
-                            if (cmd->argv[1] == NULL)
-                            {
-                                printf("stop: usage: stop jobid\n");
-                            }
-                            else
-                            {
-                                stopJob(atoi(cmd->argv[1]));
-                            }
-                        }
-                        else if (strcmp(cmd->argv[0], "jobs") == 0)
-                        {
-                            showJobs();
-                        }
-                        else if (strcmp(cmd->argv[0], "bg") == 0)
-                        {
-                            if (cmd->argv[1] == NULL)
-                            {
-                                printf("bg: usage: bg jobid\n");
-                            }
-                            else
-                            {
-                                bg(atoi(cmd->argv[1]));
-                            }
-                        }
-                        else if (strcmp(cmd->argv[0], "fg") == 0)
-                        {
-                            if (cmd->argv[1] == NULL)
-                            {
-                                printf("fg: usage: fg jobid\n");
-                            }
-                            else
-                            {
-                                fg(atoi(cmd->argv[1]));
-                            }
-                        }
-                    }
-                    else //We have to execute a command that isn't builtin
-                    {
-                        esh_signal_block(SIGCHLD); //BLOCK SIGCHLD
-                        pipe(pipe1); //Setup our pipe
-
-                        if ((pid = fork()) == 0) //FORK SUCCEEDS
-                        {
-                            pid = getpid();
-
-                            if (pipeline->pgrp == -1)
-                            {
-                                pipeline->pgrp = pid;
-                            }
-
-                            if (setpgid(pid, pipeline->pgrp) < 0)
-                            {
-                                esh_sys_fatal_error("Error setpgid: Couldn't set process group in child");
-                            }
-
-                            esh_signal_unblock(SIGCHLD); //UNBLOCK SIGCHLD in child
-
-                            //If there is input from a file
-                            if (cmd->iored_input != NULL)
-                            {
-                                int fd0 = open(cmd->iored_input, O_RDONLY, 0);
-
-                                if (dup2(fd0, STDIN_FILENO) < 0)
-                                    esh_sys_fatal_error("Error dup2: Couldn't perform dup2 in input");
-
-                                if (close(fd0) < 0)
-                                    esh_sys_fatal_error("Error close: Couldn't close fd0");
-                            }
-
-                            //If we are outputting to a file
-                            if (cmd->iored_output != NULL)
-                            {
-                                int fd1;
-
-                                //Check if we are outputting or appending
-                                if (cmd->append_to_output)
-                                {
-                                    fd1 = open(cmd->iored_output, O_CREAT|O_WRONLY|O_APPEND, S_IRWXU);    
-                                }
-                                else
-                                {
-                                    fd1 = open(cmd->iored_output, O_CREAT|O_WRONLY|O_TRUNC, S_IRWXU);
-                                }
-
-                                if(dup2(fd1, STDOUT_FILENO) < 0)
-                                    esh_sys_fatal_error("Error dup2: Couldn't perform dup2 in output");
-
-                                if (close(fd1) < 0)
-                                    esh_sys_fatal_error("Error close: Couldn't close fd1");
-                            }
-
-                            //Everything else is necessary to pipe our commands together
-                            if (dup2(fd2, 0) < 0)
-                                esh_sys_fatal_error("Error dup2: Couldn't perform dup2 for piping");
-
-                            if (list_next(p) != cmdTail && piped)
-                            {
-                                if (dup2(pipe1[1], 1) < 0)
-                                    esh_sys_fatal_error("Error dup2: Couldn't perform dup2 for pipe1");
-                            }
-
-                            //Close all fd's before we execute the child process
-                            if (close(pipe1[0]) < 0)
-                                esh_sys_fatal_error("Error close: Couldn't close pipe1[0] in child");
-
-                            if (close(pipe1[1]) < 0)
-                                esh_sys_fatal_error("Error close: Couldn't close pipe1[1] in child");
-
-                            if (execvp(cmd->argv[0], &cmd->argv[0]) < 0)
-                            {
-                                printf("%s: command not found\n", cmd->argv[0]);
-                                exit(0);
-                            }
-                            exit(0);
-                        }
-                        else if (pid < 0) //The child process failed to fork
-                        {
-                            printf("There was an error forking the child process\n");
-                            return -1;
-                        }
-
-                        //Close the write end of the pipe. Also add any fd's that will
-                        //need to be closed at the end of the execution to our pipeArray.
-                        if (close(pipe1[1]) < 0)
-                            esh_sys_fatal_error("Error close: Couldn't close pipe1[1] in parent");
-
-                        fd2 = pipe1[0];
-                        int *i = malloc(sizeof(int));
-                        *i = pipe1[0];
-                        pipeArray[count] = i;
-
-                        if (pipeline->pgrp == -1)
-                        {
-                            pipeline->pgrp = pid;
-                        }
-
-                        if (setpgid(pid, pipeline->pgrp) < 0)
-                            esh_sys_fatal_error("Error setpgid: Couldn't set process group in parent");
-                    }
-                    count++;
+                    last_status = 127;
                 }
                 else
                 {
-                    give_terminal_to(getpgrp(), shell_termios);
+                    watch_command(cmd);
+                    if (pipeline->pgrp == -1)
+                    {
+                        pipeline->pgrp = cmd->pid;
+                        pipeline->start_time = cmd->start_time;
+                    }
                 }
             }
+        }
+        else
+        {
+            give_terminal_to(getpgrp(), shell_termios);
+        }
 
-            //If we didn't run a builtin command, clean up all the file descriptors
-            //by closing all the ones that were opened up
-            int i;
-            if (!ranBuiltIn)
-            {
-                for (i = 0; i < count; i++)
-                {
-                    if (close(*pipeArray[i]) < 0)
-                        esh_sys_fatal_error("Error close: Couldn't close a pipe in the pipeArray");
-                }
-            }
+        //The children have their copies, the shell closes its own
+        esh_wiring_end_stage(w);
+        if (!cmd->substitution)
+            esh_subst_close(cmd);
+    }
+    ESH_TRACE_SPAN("pipeline", pipeline_start, NULL);
+
+    //Any pipeline with a running process is a job, even if some of its
+    //commands were builtins. Nothing to wait for if no process was started.
+    if (pipeline->pgrp == -1)
+        return false;
+
+    //The first job is 1, otherwise we take the highest jid and add 1 to it
+    if (pipeline->jid == 0)
+        pipeline->jid = esh_jobs_next_jid();
+    esh_plugin_pipeline_forked(pipeline);
+    return true;
+}
 
-            if (!ranBuiltIn && !ranPlugin)
-            {
-                if (!pipeline->bg_job)
-                {
-                    //Set job status to FOREGROUND and add to jobs list
-                    pipeline->status = FOREGROUND;
-                    e = list_pop_front(&cline->pipes);
-                    list_push_back(&jobs_list, e);
-                    e = list_begin(&cline->pipes);
+/**
+ * Starts a background pipeline if a job slot is free, and otherwise adds it
+ * to the job table as a queued job, which is started once a slot frees up. A
+ * pipeline that starts with a builtin, such as 'parallel ... &', runs it right
+ * away and takes its slot only once it starts a process, so that the jobs the
+ * builtin starts and waits for do not queue behind it.
+ *
+ * pipeline - The pipeline, whose jid is 0
+ * Return: true if the pipeline became a job, running or queued
+**/
+static bool run_background(struct esh_pipeline *pipeline)
+{
+    pipeline->pgrp = -1;
+    struct esh_command *first = list_entry(list_front(&pipeline->commands), struct esh_command, elem);
+    if (esh_builtin_find(first->argv[0]) == NULL && !esh_jobs_take_slot(pipeline))
+    {
+        esh_jobs_queue(pipeline);
+        watch_jobserver();
+        return true;
+    }
 
-                    //Hand the terminal over to the job
-                    give_terminal_to(pipeline->pgrp, shell_termios);
+    pipeline->status = BACKGROUND;
+    if (!start_pipeline(pipeline))
+    {
+        esh_jobs_release_slot(pipeline);
+        esh_pipeline_free(pipeline);
+        return false;
+    }
+    esh_jobs_add(pipeline);
+    return true;
+}
 
-                    //Wait for the job to finish running unless there is an interruption
-                    int status;
-		            pid_t id;
+/**
+ * Starts queued jobs for as long as job slots are free. Called on the
+ * child-exit path whenever a job leaves the job table, and when the limit is
+ * raised, so that slots are refilled without polling.
+**/
+static void start_queued_jobs(void)
+{
+    struct esh_pipeline *job;
+    while ((job = esh_jobs_next_startable()) != NULL)
+    {
+        job->status = BACKGROUND;
+        if (start_pipeline(job))
+        {
+            esh_jobs_started(job);
+        }
+        else //It only ran builtins
+        {
+            esh_jobs_remove(job);
+            esh_pipeline_free(job);
+        }
+    }
+    watch_jobserver();
+}
 
-                    if ((id = waitpid(pid, &status, WUNTRACED)) < 0)
-                    {
-                        printf("ERROR");
-                    }
+/**
+ * Runs every pipeline of a command line. Builtins run in the shell, other
+ * pipelines become jobs; foreground jobs are waited for before the next
+ * pipeline runs, background jobs may have to wait for a job slot. Each
+ * pipeline is run from a compact copy, so that a job does not keep the command
+ * line's arena alive.
+ *
+ * cline - The parsed command line
+**/
+static void run_command_line(struct esh_command_line *cline)
+{
+    struct list_elem *e = list_begin (&cline->pipes);
 
-                    //Make any changes to the jobs list if something happened
-                    //while the SIGCHLD handler was blocked
-		            possible_job_update(status, id);
+    for (; e != list_end (&cline->pipes); e = list_next (e)) 
+    {
+        struct esh_pipeline *pipeline = esh_pipeline_copy(list_entry(e, struct esh_pipeline, elem));
 
-                    //Hand the terminal back to the shell and unblock SIGCHLD
-                    give_terminal_to(getpgrp(), shell_termios);
+        //A plugin may change the pipeline, or handle it entirely
+        if (esh_plugin_process_pipeline(pipeline))
+        {
+            esh_pipeline_free(pipeline);
+            continue;
+        }
 
-                    esh_signal_unblock(SIGCHLD);
-                }
+        //The jid is set once the pipeline's builtins have run, since one such
+        //as 'parallel' may add jobs
+        pipeline->jid = 0;
+        pipeline->pgrp = -1;
+        last_status = 0;
+
+        if (pipeline->bg_job)
+        {
+            //Notify the user that the job is in the background, or queued
+            if (run_background(pipeline) && job_control)
+            {
+                if (pipeline->status == QUEUED)
+                    printf("[%d] Queued\n", pipeline->jid);
                 else
-                {
-                    //If the process is in the background, add it to the job list
-                    //and notify the user it is in the background
-                    pipeline->status = BACKGROUND;
-                    e = list_pop_front(&cline->pipes);
-                    list_push_back(&jobs_list, e);
-                    e = list_begin(&cline->pipes);
                     printf("[%d] %d\n", pipeline->jid, pipeline->pgrp);
-                    esh_signal_unblock(SIGCHLD);
-                }
+            }
+        }
+        else if (start_pipeline(pipeline))
+        {
+            //Set job status to FOREGROUND and add to jobs list
+            pipeline->status = FOREGROUND;
+            esh_jobs_add(pipeline);
 
-                //Stop executing commands if we are at the end
-                if (e == list_tail(&cline->pipes))
-                {
-                    break;
-                }
+            //Wait for the job to finish running unless there is an interruption
+            wait_for_job(pipeline);
+        }
+        else
+        {
+            esh_pipeline_free(pipeline);
+        }
+    }
+
+    //Pipelines that became jobs were copied to the job table
+    esh_command_line_free(cline);
+}
+
+/**
+ * Parses and runs one line of input. The lines of its here-documents are read
+ * from the same input, through next_line.
+ *
+ * line - The line, without its newline
+ * next_line - Returns the next line of input, without its newline, or NULL
+ * ctx - Passed to next_line
+**/
+static void run_line(char *line, char *(*next_line)(void *ctx), void *ctx)
+{
+    //A plugin may rewrite the line, or handle it entirely
+    if (esh_plugin_process_raw_cmdline(&line))
+        return;
+
+    double t = ESH_TRACE_START();
+    struct esh_command_line * cline = shell.parse_command_line(line);
+    ESH_TRACE_SPAN("parse", t, line);
+    if (cline == NULL)                  /* Error in command line */
+    {
+        last_status = 2;
+        return;
+    }
+
+    if (list_empty(&cline->pipes)) {    /* User hit enter */
+        esh_command_line_free(cline);
+        return;
+    }
+
+    esh_command_line_read_heredocs(cline, next_line, ctx);
+    run_command_line(cline);
+}
+
+/**
+ * Reads a line of a here-document from the terminal, after a "> " prompt.
+ *
+ * ctx - Where the line is kept; the previous line kept there is freed
+**/
+static char *read_terminal_line(void *ctx)
+{
+    char **line = ctx;
+    free(*line);
+    *line = shell.readline("> ");
+    return *line;
+}
+
+/**
+ * Called by readline once the user has entered a complete line. The prompt
+ * is taken down while the line runs and put back up by the main loop.
+ *
+ * cmdline - The line, or NULL on EOF
+**/
+static void handle_line(char *cmdline)
+{
+    rl_callback_handler_remove();
+    input_active = false;
+    watch_input(false);
+
+    if (cmdline == NULL)  /* User typed EOF */
+    {
+        shell_done = true;
+        return;
+    }
+
+    char *here_line = NULL;
+    run_line(cmdline, read_terminal_line, &here_line);
+    free (here_line);
+    free (cmdline);
+    esh_prompt_invalidate(ESH_PROMPT_COMMAND);
+}
+
+//A script being run, and whether it shares its descriptor with commands
+struct script
+{
+    struct esh_reader *reader;
+    bool shared;
+};
+
+/**
+ * Reads the next line of a script.
+ *
+ * ctx - The script
+**/
+static char *read_script_line(void *ctx)
+{
+    struct script *script = ctx;
+    char *line = esh_reader_getline(script->reader);
+
+    //Commands that read stdin must not miss input the shell read ahead.
+    //That input can be given back if stdin is a file, but not if it is a pipe.
+    if (line != NULL && script->shared)
+        esh_reader_unread(script->reader);
+    return line;
+}
+
+/**
+ * Runs every line of a script or of non-terminal stdin. Lines are read
+ * through a large buffer, not through readline. Lines starting with '#',
+ * such as a '#!' line, are skipped.
+ *
+ * reader - The reader for the script
+**/
+static void run_script(struct esh_reader *reader)
+{
+    struct script script = {
+        .reader = reader,
+        .shared = reader->fd == STDIN_FILENO
+                  && lseek(STDIN_FILENO, 0, SEEK_CUR) >= 0,
+    };
+
+    char *line;
+    while ((line = read_script_line(&script)) != NULL)
+    {
+        if (line[strspn(line, " \t")] == '#')
+            continue;
+
+        run_line(line, read_script_line, &script);
+    }
+}
+
+/**
+ * Reads the next line of the string given with -c.
+ *
+ * ctx - The rest of the string
+**/
+static char *read_string_line(void *ctx)
+{
+    return strsep((char **) ctx, "\n");
+}
+
+/**
+ * Runs the lines of the string given with -c.
+ *
+ * cmdstring - The command string; it is modified
+**/
+static void run_string(char *cmdstring)
+{
+    char *line, *rest = cmdstring;
+    while ((line = read_string_line(&rest)) != NULL)
+    {
+        run_line(line, read_string_line, &rest);
+    }
+}
+
+int
+main(int ac, char *av[])
+{
+    int opt;
+    char *cmdstring = NULL;
+    struct esh_reader *reader = NULL;
+
+    //Started as the relay of a fan-out redirection; see esh-relay.c
+    if (strcmp(av[0], ESH_RELAY) == 0)
+        return esh_relay_main(ac, av);
+
+    //Every running command holds a pidfd, so the shell needs more descriptors
+    //than the usual soft limit of 1024 once it has about as many jobs
+    struct rlimit nofile;
+    if (getrlimit(RLIMIT_NOFILE, &nofile) == 0 && nofile.rlim_cur < nofile.rlim_max) {
+        nofile.rlim_cur = nofile.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &nofile);
+    }
+
+    list_init(&esh_plugin_list);
+    esh_jobs_init(); //Initialize the job table
+
+    /* Process command-line arguments. See getopt(3) */
+    while ((opt = getopt(ac, av, "c:ghp:T:v")) > 0) {
+        switch (opt) {
+        case 'c':
+            cmdstring = optarg;
+            break;
+
+        case 'g':
+            if (!esh_cgroup_init())
+                fprintf(stderr, "esh: cgroups are not delegated to the shell; "
+                        "jobs run without them\n");
+            break;
+
+        case 'h':
+            usage(av[0]);
+            break;
+
+        case 'p':
+            esh_plugin_load_from_directory(optarg);
+            break;
+
+        case 'T':
+            esh_trace_open(optarg);
+            break;
+
+        case 'v':
+            verbose = true;
+            break;
+        }
+    }
+
+    //Commands come from -c, a script, non-terminal stdin, or the user
+    if (cmdstring == NULL && optind < ac) {
+        int fd = open(av[optind], O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            esh_sys_error("%s: ", av[optind]);
+            return 127;
+        }
+        reader = esh_reader_create(fd);
+    } else if (cmdstring == NULL && !isatty(STDIN_FILENO)) {
+        reader = esh_reader_create(STDIN_FILENO);
+    }
+    job_control = cmdstring == NULL && reader == NULL;
+
+    size_t i;
+    for (i = 0; i < sizeof coreBuiltins / sizeof coreBuiltins[0]; i++)
+        esh_builtin_register(coreBuiltins[i].name, coreBuiltins[i].run, NULL);
+    esh_plugin_initialize(&shell);
+
+    //Set the initial state of the shell, give it a pid, and hand the terminal
+    //over to it. Without a terminal there is nothing to hand over.
+    if (job_control) {
+        shell_termios = esh_sys_tty_init();
+
+        setpgid(0, 0);
+        give_terminal_to(getpgrp(), shell_termios);
+    }
+
+    event_loop_init(job_control);
+
+    if (cmdstring != NULL) {
+        run_string(cmdstring);
+    } else if (reader != NULL) {
+        run_script(reader);
+        esh_reader_free(reader);
+    }
+
+    //Queued background jobs are still started before the shell exits
+    while (!job_control && esh_jobs_nqueued() > 0)
+        handle_events();
+
+    /* Read/eval loop, driven by readline's callback interface. */
+    while (job_control && !shell_done) {
+        if (!input_active) {
+            //readline copies the prompt. A plugin may have replaced
+            //build_prompt; otherwise the composed prompt need not be copied.
+            if (shell.build_prompt == build_prompt_from_plugins) {
+                rl_callback_handler_install(esh_prompt_compose(), handle_line);
+            } else {
+                char * prompt = shell.build_prompt();
+                rl_callback_handler_install(prompt, handle_line);
+                free (prompt);
             }
+            input_active = true;
+            watch_input(true);
         }
+
+        handle_events();
     }
-    return 0;
-}
\ No newline at end of file
+
+    if (verbose)
+        fprintf(stderr, "esh: %lu events in %lu wakeups, at most %d per wakeup\n",
+                stat_events, stat_wakeups, stat_max_batch);
+    return last_status;
+}
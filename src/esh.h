@@ -8,9 +8,13 @@
  */
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
 #include <obstack.h>
 #include <stdlib.h>
 #include <termios.h>
+#include <time.h>
+#include <sys/resource.h>
 #include "esh-sys-utils.h"
 #include "list.h"
 
@@ -45,6 +49,10 @@ struct esh_shell {
 
     /* Parse command line */
     struct esh_command_line * (* parse_command_line) (char *);
+
+    /* Report that 'events', a set of ESH_PROMPT_* values, happened, so
+     * that the prompt fragments that depend on them are made again */
+    void (* invalidate_prompt) (unsigned events);
 };
 
 /* 
@@ -95,19 +103,54 @@ struct esh_plugin {
 
     /* Notify the plugin about a child's status change.
      * 'waitstatus' is the value returned by waitpid(2) 
+     * If the child exited, its end_time, rusage and exit_status
+     * fields are already set.
      *
-     * May be called from SIGCHLD handler.
+     * Called on the main thread from the shell's event loop, never
+     * from a signal handler.
      * The status of the associated pipeline has not yet been
      * updated.
      * */
     bool (* command_status_change)(struct esh_command *, int waitstatus);
 
+    /* Optional.  The names of the built-in commands the plugin
+     * implements, ending with NULL.  If set, process_builtin is called
+     * only for commands with one of these names; if NULL, it is called
+     * for every command.  Plugins compiled before this field existed
+     * are treated as if it were NULL. */
+    const char **builtins;
+
+    /* Optional.  The events, a set of ESH_PROMPT_* values, after which
+     * the fragment make_prompt returned must be made again; until one
+     * happens, the shell reuses it.  If 0, make_prompt is called for
+     * every prompt.  Plugins compiled before this field existed are
+     * treated as if it were 0. */
+    unsigned prompt_events;
+
+    /* Optional.  If not 0, the fragment is also made again once it is
+     * this many milliseconds old, as a clock needs. */
+    unsigned prompt_max_age;
+
+    /* Optional.  If not 0, make_prompt is called on a thread of its
+     * own, for fragments that take long to make, and the shell waits
+     * at most this many milliseconds for it.  A fragment that is not
+     * ready by then is shown as it was last made, or as
+     * prompt_placeholder, and the prompt is redrawn once it is ready.
+     * Such a make_prompt must not use the shell object. */
+    unsigned prompt_deadline;
+
+    /* Optional.  Shown until such a fragment was first made; "..." if
+     * NULL. */
+    const char *prompt_placeholder;
+
     /* Add additional fields here if needed. */
 };
 
 /* A command line may contain multiple pipelines. */
 struct esh_command_line {
     struct list/* <esh_pipeline> */ pipes;        /* List of pipelines */
+    struct obstack arena;    /* Holds all pipelines, commands, argv arrays
+                                and words of this command line. */
 
     /* Add additional fields here if needed. */
 };
@@ -119,6 +162,22 @@ enum job_status  {
     STOPPED,        /* job is stopped via SIGSTOP */
     NEEDSTERMINAL,  /* job is stopped because it was a background job
                        and requires exclusive terminal access */
+    QUEUED,         /* job waits for a job slot; none of its commands
+                       has been started */
+};
+
+/* Jobs started by one 'parallel' builtin, of which at most 'max' run
+ * at once.  See the job slots in esh-jobs.c. */
+struct esh_job_group {
+    int max;                 /* Jobs that may run at once, or 0 */
+    int running;             /* Jobs holding a job slot */
+    int njobs;               /* Jobs in the job table */
+    int failed;              /* Commands that exited with an error */
+    bool stopped;            /* A job of the group was stopped */
+    bool in_use;             /* Not freed with its last job while set */
+    struct list queue;       /* QUEUED jobs, in jid order */
+    struct list_elem elem;   /* Link element in the list of groups with
+                                QUEUED jobs */
 };
 
 /* A pipeline is a list of one or more commands. 
@@ -134,12 +193,29 @@ struct esh_pipeline {
     bool bg_job;             /* True if user entered & */
     struct list_elem elem;   /* Link element. */
 
-    int     jid;             /* Job id. */
+    int     jid;             /* Job id, or 0 until it becomes a job. */
     pid_t   pgrp;            /* Process group. */
     enum job_status status;  /* Job status. */ 
     struct termios saved_tty_state;  /* The state of the terminal when this job was 
                                         stopped after having been in foreground */
 
+    struct list_elem jid_elem;   /* Link element in job table's jid index. */
+    struct list_elem pgrp_elem;  /* Link element in job table's pgrp index. */
+    int     nlive;           /* Number of commands that have not been reaped. */
+    struct timespec start_time;  /* When the first command was started. */
+    struct timespec end_time;    /* When the last command was reaped. */
+    struct rusage rusage;        /* Totals over all reaped commands. */
+
+    struct esh_job_group *group; /* Group of a 'parallel' job, or NULL */
+    bool holds_slot;             /* True if the job takes up a job slot */
+    bool holds_token;            /* True if the slot took a jobserver token */
+    struct esh_cgroup *cgroup;   /* The job's cgroup, or NULL; see
+                                    esh-cgroup.c */
+    struct esh_placement *placement; /* The CPUs the job is pinned to,
+                                    or NULL; see esh-placement.c */
+    struct list_elem queue_elem; /* Link element in its group's queue,
+                                    while QUEUED. */
+
     /* Add additional fields here if needed. */
 };
 
@@ -152,54 +228,446 @@ struct esh_command {
     char *iored_output;      /* If non-NULL, command should write to
                                 file 'iored_output' */
     bool append_to_output;   /* True if user typed >> to append */
+    char *here_document;     /* If non-NULL, command should read this text,
+                                given with <<< or <<, from stdin */
+    char *here_end;          /* Delimiter of a << here-document whose lines
+                                have not been read yet, or NULL */
+    char substitution;       /* '<' or '>' if this command is part of a
+                                process substitution <(...) or >(...),
+                                otherwise '\0' */
+    int subst_arg;           /* If so, the index of the argument it stands
+                                for, of the next command that is not */
+    int subst_fd;            /* Set on the first command of a substitution
+                                while it runs: the end of its pipe that is
+                                passed as that argument, or -1 */
+    bool relay;              /* True if this is the relay of a fan-out
+                                redirection >&, run by the shell's own
+                                executable; see esh-relay.c */
     struct list_elem elem;   /* Link element to link commands in pipeline. */
 
     pid_t   pid;             /* Process id. */
     struct esh_pipeline * pipeline; 
                               /* The pipeline of which this job is a part. */
+    struct list_elem pid_elem;  /* Link element in job table's pid index. */
+    int     pidfd;           /* pidfd referring to process, or -1. */
+    struct timespec start_time;  /* When the process was started. */
+    struct timespec end_time;    /* When the process was reaped. */
+    struct rusage rusage;        /* Resources used; valid once reaped. */
+    int     exit_status;         /* waitpid(2) status; valid once reaped. */
 
     /* Add additional fields here if needed. */
 };
 
 /** ----------------------------------------------------------- */
 
-/* Create new command structure and initialize it */
-struct esh_command * esh_command_create(char ** argv, 
+/* Create new command structure in 'arena' and initialize it */
+struct esh_command * esh_command_create(struct obstack *arena,
+                   char ** argv, 
                    char *iored_input, 
                    char *iored_output, 
                    bool append_to_output);
 
-/* Create a new pipeline containing only one command */
-struct esh_pipeline * esh_pipeline_create(struct esh_command *cmd);
+/* Create a new pipeline in 'arena' containing only one command */
+struct esh_pipeline * esh_pipeline_create(struct obstack *arena,
+                                          struct esh_command *cmd);
 
 /* Complete a pipe's setup by copying I/O redirection information
  * from first and last command */
 void esh_pipeline_finish(struct esh_pipeline *pipe);
 
-/* Create an empty command line */
+/* Create an empty command line.  Its arena owns everything
+ * that is parsed into it. */
 struct esh_command_line * esh_command_line_create_empty(void);
 
-/* Create a command line with a single pipeline */
-struct esh_command_line * esh_command_line_create(struct esh_pipeline *pipe);
+/* Copy a pipeline out of its command line's arena into a single
+ * malloc'd block, e.g. for a job that outlives the command line */
+struct esh_pipeline * esh_pipeline_copy(struct esh_pipeline *pipe);
 
-/* Deallocation functions */
+/* Deallocation functions.  esh_command_line_free frees the whole arena;
+ * esh_pipeline_free is for pipelines made by esh_pipeline_copy. */
 void esh_command_line_free(struct esh_command_line *);
 void esh_pipeline_free(struct esh_pipeline *);
-void esh_command_free(struct esh_command *);
 
 /* Print functions */
 void esh_command_print(struct esh_command *cmd);
 void esh_pipeline_print(struct esh_pipeline *pipe);
 void esh_command_line_print(struct esh_command_line *line);
 
-/* Parse a command line.  Implemented in esh-grammar.y */
+/* Print the resources used by each command of a pipeline and the totals */
+void esh_pipeline_print_usage(struct esh_pipeline *pipe);
+
+/* Add the resource usage 'ru' to 'total'. ru_maxrss is the maximum. */
+void esh_rusage_add(struct rusage *total, const struct rusage *ru);
+
+/* Parse a command line.  Implemented in esh-grammar.y
+ * Reentrant; may be called from several threads at once. */
 struct esh_command_line * esh_parse_command_line(char * line);
 
-/* Load plugins from directory dir */
+/* Here-documents.  Implemented in esh-heredoc.c
+ * esh_command_line_read_heredocs reads the lines of the << here-documents
+ * of a parsed command line, calling 'next_line' for each line until the
+ * delimiter; 'next_line' returns the line without its newline, or NULL
+ * at end of input.  esh_heredoc_open returns a descriptor, close-on-exec,
+ * from which a command can read 'text', or -1 on failure. */
+void esh_command_line_read_heredocs(struct esh_command_line *cline,
+                                    char *(*next_line)(void *ctx), void *ctx);
+int esh_heredoc_open(const char *text);
+
+/* Job table.  Implemented in esh-jobs.c
+ * Must only be changed on the main thread. */
+void esh_jobs_init(void);
+
+/* Return the list of current jobs, in increasing jid order */
+struct list * esh_jobs_get_list(void);
+
+/* Return the job id to assign to the next job */
+int esh_jobs_next_jid(void);
+
+/* Add/remove a pipeline whose jid, pgrp and pids are set */
+void esh_jobs_add(struct esh_pipeline *pipe);
+void esh_jobs_remove(struct esh_pipeline *pipe);
+
+/* Record that a command was reaped.
+ * Returns true if it was the last live command of its pipeline. */
+bool esh_jobs_command_reaped(struct esh_command *cmd);
+
+/* Job slots.  At most esh_jobs_get_max() background jobs, and at most
+ * group->max jobs of a group, run at once; a max of 0 means no limit.
+ * With a jobserver, each slot also takes a token. */
+void esh_jobs_set_max(int max);
+int esh_jobs_get_max(void);
+
+/* Take a slot for a pipeline that is about to be started in the
+ * background.  Returns false if none is free. */
+bool esh_jobs_take_slot(struct esh_pipeline *pipe);
+void esh_jobs_release_slot(struct esh_pipeline *pipe);
+
+/* Add a pipeline to the job table as a QUEUED job, giving it the next
+ * jid unless it has one */
+void esh_jobs_queue(struct esh_pipeline *pipe);
+
+/* Take a QUEUED job off its queue without giving it a slot */
+void esh_jobs_unqueue(struct esh_pipeline *pipe);
+
+/* Return the QUEUED job, lowest jid first, for which a slot is free,
+ * taken off its queue and holding the slot; or NULL */
+struct esh_pipeline * esh_jobs_next_startable(void);
+
+/* Record that the commands of a job that was QUEUED were started; its
+ * pgrp and pids are set */
+void esh_jobs_started(struct esh_pipeline *pipe);
+
+/* Number of QUEUED jobs */
+int esh_jobs_nqueued(void);
+
+/* Create a group whose jobs may run at most 'max' at once.  The group
+ * is freed with its last job once esh_jobs_group_done() was called. */
+struct esh_job_group * esh_jobs_group_create(int max);
+void esh_jobs_group_done(struct esh_job_group *group);
+
+/* The GNU make jobserver.  Implemented in esh-jobserver.c
+ * A pool of n tokens shared through MAKEFLAGS with the commands esh
+ * launches; n = 0 removes it.  Returns false if it could not be set. */
+bool esh_jobserver_set(int n);
+int esh_jobserver_get(void);
+void esh_jobserver_print(void);
+
+/* Take a token for a background job: returns 1 if one was taken, 0 if
+ * there is no pool, -1 if none is free.  esh_jobserver_put gives one
+ * back. */
+int esh_jobserver_take(void);
+void esh_jobserver_put(void);
+
+/* The read end of the pool's pipe, which is to be watched while
+ * esh_jobserver_wants_fd() is true; esh_jobserver_readable() is called
+ * when it is readable. */
+int esh_jobserver_fd(void);
+bool esh_jobserver_wants_fd(void);
+void esh_jobserver_readable(void);
+
+/* Per-job cgroups.  Implemented in esh-cgroup.c
+ * esh_cgroup_init makes the shell's cgroup subtree; it returns false,
+ * and jobs get no cgroups, if cgroups are not delegated to the shell. */
+struct esh_cgroup;
+
+bool esh_cgroup_init(void);
+bool esh_cgroup_enabled(void);
+
+/* Make a cgroup for a job; returns NULL on failure.  Destroying it
+ * fails silently if processes are left in it. */
+struct esh_cgroup * esh_cgroup_create(void);
+void esh_cgroup_destroy(struct esh_cgroup *cg);
+
+/* Move the shell into 'cg', so that the commands it spawns start there,
+ * and back into its own cgroup */
+bool esh_cgroup_enter(struct esh_cgroup *cg);
+void esh_cgroup_leave(void);
+int esh_cgroup_fd(struct esh_cgroup *cg);
+
+/* Kill every process in 'cg'.  Returns false if the kernel cannot. */
+bool esh_cgroup_kill(struct esh_cgroup *cg);
+
+/* Write 'value' to interface file 'file' of 'cg', such as memory.max */
+bool esh_cgroup_set(struct esh_cgroup *cg, const char *file, const char *value);
+void esh_cgroup_print_limits(struct esh_cgroup *cg);
+void esh_cgroup_print_usage(struct esh_cgroup *cg);
+
+/* Placement of jobs onto CPUs.  Implemented in esh-placement.c
+ * With automatic placement on, esh_placement_assign pins a job to a
+ * cache domain; esh_placement_pin pins it to a cpulist such as "0-3,8",
+ * including its running commands.  Release undoes either. */
+struct esh_placement;
+
+void esh_placement_set_auto(bool on);
+bool esh_placement_get_auto(void);
+void esh_placement_assign(struct esh_pipeline *pipe);
+bool esh_placement_pin(struct esh_pipeline *pipe, const char *cpulist);
+void esh_placement_release(struct esh_pipeline *pipe);
+void esh_placement_print(void);
+
+/* Give the calling thread the CPUs of 'p', so that the commands it
+ * spawns inherit them, and its own back */
+bool esh_placement_enter(struct esh_placement *p);
+void esh_placement_leave(void);
+
+/* O(1) lookups; return NULL if not found */
+struct esh_pipeline * esh_jobs_find_jid(int jid);
+struct esh_pipeline * esh_jobs_find_pgrp(pid_t pgrp);
+struct esh_command * esh_jobs_find_pid(pid_t pid);
+
+/* Start a command in process group pgrp (-1 for a new group, 0 for
+ * the shell's group), with
+ * optional pipe ends infd/outfd as stdin/stdout.  Implemented in
+ * esh-launch.c.  Sets cmd->pidfd and sets and returns cmd->pid, or
+ * returns -1 on failure. */
+pid_t esh_launch_command(struct esh_command *cmd, pid_t pgrp, int infd, int outfd);
+
+/* Command name resolution.  Implemented in esh-pathcache.c
+ * Resolved names are cached until PATH or a directory on it changes.
+ * esh_path_resolve returns NULL if 'name' is not an executable on PATH;
+ * names containing a slash are returned as is. */
+const char * esh_path_resolve(const char *name);
+void esh_path_forget(const char *name);
+void esh_path_cache_clear(void);
+void esh_path_cache_print(void);
+
+/* Buffered line input for scripts.  Implemented in esh-reader.c */
+struct esh_reader {
+    int fd;             /* Descriptor input is read from */
+    char *buf;          /* Buffered input */
+    size_t size;        /* Size of buf */
+    size_t pos;         /* Start of input not yet returned */
+    size_t len;         /* End of buffered input */
+    bool eof;           /* True once read(2) returned 0 */
+};
+
+struct esh_reader * esh_reader_create(int fd);
+char * esh_reader_getline(struct esh_reader *r);
+bool esh_reader_unread(struct esh_reader *r);
+void esh_reader_free(struct esh_reader *r);
+
+/* Connects the stages of a pipeline.  Implemented in esh-launch.c */
+struct esh_pipe_wiring {
+    int nstages;        /* Number of commands in pipeline */
+    int stage;          /* Index of the stage being launched */
+    int infd;           /* Read end of pipe into this stage, or -1 */
+    int outfd;          /* Write end of pipe out of this stage, or -1 */
+    int nextfd;         /* Read end of pipe out of this stage, or -1 */
+    int endfd;          /* Write end of the pipe out of the last stage of
+                           a <(...) substitution, or -1 */
+};
+
+void esh_wiring_init(struct esh_pipe_wiring *w, int nstages);
+void esh_wiring_begin_stage(struct esh_pipe_wiring *w);
+void esh_wiring_end_stage(struct esh_pipe_wiring *w);
+
+/* Process substitutions, whose commands precede the command they are an
+ * argument of in its pipeline.  esh_pipeline_nstages counts the other
+ * commands, which esh_wiring_* connect.  A wiring of their own connects
+ * the commands of substitutions, begun with esh_subst_begin_command
+ * instead of esh_wiring_begin_stage.  esh_subst_close closes the shell's
+ * ends of the substitutions of 'cmd' once it has been started, or has
+ * failed to. */
+int esh_pipeline_nstages(struct esh_pipeline *pipe);
+void esh_subst_begin_command(struct esh_pipe_wiring *w, struct esh_command *cmd);
+void esh_subst_close(struct esh_command *cmd);
+
+/* Fan-out redirection.  Implemented in esh-relay.c.
+ * 'cmd >& file... |> cmd...' is parsed as 'cmd | esh-relay file...
+ * >(cmd)...', where esh-relay is the shell's executable, started with
+ * argv[0] ESH_RELAY, whose main() then calls esh_relay_main. */
+#define ESH_RELAY "esh-relay"
+int esh_relay_main(int ac, char *av[]);
+
+/* Tracing of the launch path as Chrome trace-event JSON.
+ * Implemented in esh-trace.c.  esh_trace_file is NULL unless tracing
+ * was turned on; the macros below only call into esh-trace.c if it is. */
+extern FILE *esh_trace_file;
+#define esh_tracing() __builtin_expect(esh_trace_file != NULL, 0)
+
+void esh_trace_open(const char *path);
+double esh_trace_now(void);
+void esh_trace_span(const char *name, double start, const char *detail);
+void esh_trace_instant(const char *name, pid_t pid, const char *detail);
+void esh_trace_command_started(struct esh_command *cmd);
+void esh_trace_command_exited(struct esh_command *cmd, pid_t pid);
+
+/* Start time of a span, in microseconds, or 0 if tracing is off */
+#define ESH_TRACE_START() (esh_tracing() ? esh_trace_now() : 0)
+/* Record a span of the shell's work from 'start' until now */
+#define ESH_TRACE_SPAN(name, start, detail) \
+    do { if (esh_tracing()) esh_trace_span(name, start, detail); } while (0)
+/* Record an event of process 'pid', or of the shell if 'pid' is 0 */
+#define ESH_TRACE_INSTANT(name, pid, detail) \
+    do { if (esh_tracing()) esh_trace_instant(name, pid, detail); } while (0)
+
+/* Load plugins from directory dir.  If the directory has a valid
+ * manifest, plugins are only loaded once they are needed. */
 void esh_plugin_load_from_directory(char *dirname);
 
 /* Initialize loaded plugins */
 void esh_plugin_initialize(struct esh_shell *shell);
 
+/* The hooks of struct esh_plugin */
+enum esh_plugin_hook {
+    ESH_HOOK_PROCESS_RAW_CMDLINE,
+    ESH_HOOK_PROCESS_PIPELINE,
+    ESH_HOOK_PROCESS_BUILTIN,       /* For every command, not declared */
+    ESH_HOOK_MAKE_PROMPT,
+    ESH_HOOK_PIPELINE_FORKED,
+    ESH_HOOK_COMMAND_STATUS_CHANGE,
+};
+
+/* Load the plugins not yet loaded that implement 'hook', so that its
+ * table in esh_plugin_hooks is complete.  The esh_plugin_* dispatch
+ * functions do this themselves. */
+void esh_plugin_load_hook(enum esh_plugin_hook hook);
+
+/* What a plugin manifest records about one plugin */
+struct esh_plugin_info {
+    char *file;                 /* File name, within the directory */
+    struct timespec mtime;      /* Modification time of the file */
+    off_t size;                 /* Size of the file */
+    int rank;
+    unsigned hooks;             /* Bit (1 << h) for each hook h it implements */
+    bool eager;                 /* Must be loaded at startup */
+    char **builtins;            /* Declared builtins, ending with NULL, or NULL */
+};
+
+/* The manifest of a plugin directory */
+struct esh_plugin_manifest {
+    int count;
+    struct esh_plugin_info *plugins;
+};
+
+struct esh_plugin_manifest *esh_plugin_manifest_read(const char *dirname);
+void esh_plugin_manifest_write(const char *dirname, struct timespec dir_mtime,
+                               struct esh_plugin_manifest *m);
+void esh_plugin_manifest_free(struct esh_plugin_manifest *m);
+
+/* Events after which prompt fragments are made again; see the
+ * prompt_events field of struct esh_plugin */
+enum esh_prompt_event {
+    ESH_PROMPT_STATIC = 1 << 0,     /* Never happens: for fragments that
+                                       do not change */
+    ESH_PROMPT_CWD = 1 << 1,        /* The working directory changed */
+    ESH_PROMPT_JOBS = 1 << 2,       /* A job stopped or ended */
+    ESH_PROMPT_COMMAND = 1 << 3,    /* A command line was run */
+    ESH_PROMPT_PLUGIN = 1 << 8,     /* This and higher bits are free for
+                                       plugins' own events */
+};
+
+/* A string that grows as text is appended to it */
+struct esh_strbuf {
+    char *buf;                      /* Always NUL-terminated */
+    size_t len;
+    size_t size;                    /* Allocated size of buf */
+};
+
+void esh_strbuf_init(struct esh_strbuf *sb, size_t size);
+void esh_strbuf_append(struct esh_strbuf *sb, const char *s, size_t len);
+void esh_strbuf_clear(struct esh_strbuf *sb);
+void esh_strbuf_free(struct esh_strbuf *sb);
+
+/* The prompt, made of the fragments of the plugins that implement
+ * make_prompt.  The string remains valid until the next call. */
+const char *esh_prompt_compose(void);
+
+/* Record that 'events' happened; see struct esh_shell */
+void esh_prompt_invalidate(unsigned events);
+
+/* A file descriptor that becomes readable when a fragment made on a
+ * thread of its own is ready */
+int esh_prompt_notify_fd(void);
+
+/* Take the fragments that became ready since the prompt was composed.
+ * Returns the prompt with them, valid until the next call, or NULL if
+ * there were none. */
+const char *esh_prompt_refresh(void);
+
+/* The hooks of the loaded plugins, one table per hook.  Each holds the
+ * functions of only the plugins that implement the hook, in increasing
+ * rank, and ends with NULL.  Valid once esh_plugin_initialize() ran. */
+struct esh_plugin_hooks {
+    bool (**process_raw_cmdline)(char **);
+    bool (**process_pipeline)(struct esh_pipeline *);
+    bool (**process_builtin)(struct esh_command *);
+    char *(**make_prompt)(void);
+    void (**pipeline_forked)(struct esh_pipeline *);
+    bool (**command_status_change)(struct esh_command *, int waitstatus);
+    unsigned generation;        /* Incremented when the tables change */
+};
+extern struct esh_plugin_hooks esh_plugin_hooks;
+
+/* Does loaded plugin 'p' have 'field'?  Plugins compiled against an
+ * older esh.h have a shorter struct esh_plugin. */
+#define ESH_PLUGIN_HAS(p, field) \
+    esh_plugin_has_field(p, offsetof(struct esh_plugin, field) + sizeof (p)->field)
+bool esh_plugin_has_field(struct esh_plugin *p, size_t end);
+
+/* A built-in command.  Core builtins are run by 'run'; builtins that a
+ * plugin declares are run by its process_builtin hook. */
+struct esh_builtin {
+    const char *name;
+    void (*run)(char **argv);       /* Core builtin, or NULL */
+    struct esh_plugin *plugin;      /* Plugin that declared it, or NULL */
+};
+
+/* Registry of builtins, by name */
+void esh_builtin_register(const char *name, void (*run)(char **argv),
+                          struct esh_plugin *plugin);
+struct esh_builtin *esh_builtin_find(const char *name);
+
+/* Call a hook of all plugins that implement it, in increasing rank.
+ * The process_* hooks stop at the first plugin that returns true, and
+ * return whether one did. */
+bool esh_plugin_process_raw_cmdline(char **cmdline);
+bool esh_plugin_process_pipeline(struct esh_pipeline *pipe);
+bool esh_plugin_process_builtin(struct esh_command *cmd);
+void esh_plugin_pipeline_forked(struct esh_pipeline *pipe);
+void esh_plugin_command_status_change(struct esh_command *cmd, int status);
+
 /* List of loaded plugins */
-extern struct list esh_plugin_list;
\ No newline at end of file
+extern struct list esh_plugin_list;
+
+/* A plugin compiled into esh rather than loaded with -p.  The linker
+ * collects these in section 'esh_plugins', which esh_plugin_initialize()
+ * enumerates. */
+struct esh_static_plugin {
+    const char *name;           /* File name of the plugin, without .so */
+    struct esh_plugin *module;
+};
+
+/*
+ * The Makefile compiles a plugin that is to be linked into esh with
+ * -DESH_STATIC_PLUGIN='"name"' -Desh_module=esh_module_name, so that
+ * several plugins can be linked together.  The plugin's source is the
+ * same either way.
+ */
+#ifdef ESH_STATIC_PLUGIN
+extern struct esh_plugin esh_module;
+static const struct esh_static_plugin esh_static_plugin
+    __attribute__((used, section("esh_plugins"))) = {
+    ESH_STATIC_PLUGIN, &esh_module
+};
+#endif
@@ -43,8 +43,11 @@ chdir_builtin(struct esh_command *cmd)
     return true;
 }
 
+static const char *builtins[] = { "cd", NULL };
+
 struct esh_plugin esh_module = {
   .rank = 1,
   .init = init_plugin,
-  .process_builtin = chdir_builtin
+  .process_builtin = chdir_builtin,
+  .builtins = builtins
 };
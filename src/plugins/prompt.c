@@ -19,5 +19,6 @@ prompt(void)
 struct esh_plugin esh_module = {
     .rank = 10,
     .init = init_plugin,
-    .make_prompt = prompt
+    .make_prompt = prompt,
+    .prompt_events = ESH_PROMPT_STATIC      /* the prompt never changes */
 };